@@ -0,0 +1,546 @@
+/**
+  ******************************************************************************
+  * @file    DS2438_Coroutine.hpp
+  * @brief   C++20 coroutine interface of the DS2438 Libary
+  ******************************************************************************
+  * Awaitable wrappers around the ...Async functions of DS2438_Library.h and
+  * a single-threaded executor that drives them with DS2438_Poll(). A
+  * coroutine waiting for a conversion or a transfer is suspended, the
+  * executor resumes it from the completion callback. Coroutine frames come
+  * from a static pool of DS2438_CORO_FRAMES blocks of DS2438_CORO_FRAME_SIZE
+  * bytes, there is no heap allocation.
+  *
+  * Usage:
+  *     ds2438::Executor executor;
+  *     ds2438::Device battery(executor, &dev);
+  *     ds2438::Task<> monitor(ds2438::Device& battery) {
+  *         auto snapshot = co_await battery.read_snapshot();
+  *         ...
+  *     }
+  *     executor.spawn(monitor(battery));
+  *     executor.run();
+  ******************************************************************************
+  */
+
+#ifndef DS2438_COROUTINE_HPP
+#define DS2438_COROUTINE_HPP
+
+#include "DS2438_Library.h"
+#include "DS2438_Hal.h"
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+/**
+*   \brief Size (in bytes) of one coroutine frame. A Task whose frame is
+*   bigger cannot be started.
+*/
+#ifndef DS2438_CORO_FRAME_SIZE
+#define DS2438_CORO_FRAME_SIZE 512
+#endif
+
+/**
+*   \brief Number of coroutine frames, i.e. Tasks alive at the same time.
+*/
+#ifndef DS2438_CORO_FRAMES
+#define DS2438_CORO_FRAMES 8
+#endif
+
+namespace ds2438 {
+
+// ===========================================================
+//                      FRAME POOL
+// ===========================================================
+
+class FramePool
+{
+public:
+    // nullptr if the frame is too big or all blocks are in use
+    static void* allocate(std::size_t size) noexcept
+    {
+        if (size > DS2438_CORO_FRAME_SIZE)
+            return nullptr;
+        Block* block = free_;
+        if (block)
+            free_ = block->next;
+        else if (fresh_ < DS2438_CORO_FRAMES)
+            block = &blocks_[fresh_++];//never used before
+        else
+            return nullptr;
+        if (++used_ > peak_)
+            peak_ = used_;
+        return block->data;
+    }
+
+    static void release(void* frame) noexcept
+    {
+        Block* block = static_cast<Block*>(frame);
+        block->next = free_;
+        free_ = block;
+        used_--;
+    }
+
+    static std::size_t used() { return used_; }
+    static std::size_t peak() { return peak_; }
+
+private:
+    union Block
+    {
+        Block* next;
+        alignas(std::max_align_t) unsigned char data[DS2438_CORO_FRAME_SIZE];
+    };
+
+    static inline Block blocks_[DS2438_CORO_FRAMES];
+    static inline Block* free_ = nullptr;
+    static inline std::size_t fresh_ = 0;   // blocks never handed out start here
+    static inline std::size_t used_ = 0;
+    static inline std::size_t peak_ = 0;
+};
+
+// ===========================================================
+//                      RESULT
+// ===========================================================
+
+// Status and value of an operation. DS2438_BUSY if no coroutine frame was free.
+template <class T>
+struct Result
+{
+    uint8_t status = DS2438_BUSY;
+    T value{};
+
+    bool ok() const { return status == DS2438_OP_SUCCESS; }
+};
+
+class Executor;
+
+// Coroutine waiting in one of the executor lists
+struct Waiter
+{
+    Waiter* next = nullptr;
+    std::coroutine_handle<> handle;
+};
+
+// ===========================================================
+//                      TASK
+// ===========================================================
+
+struct PromiseBase
+{
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    Executor* owner = nullptr;              // set for tasks started with Executor::spawn()
+    Waiter start;                           // first resume of a spawned task
+
+    static void* operator new(std::size_t size) noexcept { return FramePool::allocate(size); }
+    static void operator delete(void* frame) noexcept { FramePool::release(frame); }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        template <class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept;
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { std::terminate(); }
+};
+
+template <class T>
+struct Promise : PromiseBase
+{
+    T value{};
+
+    template <class U>
+    void return_value(U&& result) { value = std::forward<U>(result); }
+};
+
+template <>
+struct Promise<void> : PromiseBase
+{
+    void return_void() {}
+};
+
+// Lazily started coroutine, co_await it or hand it to Executor::spawn()
+template <class T = void>
+class Task
+{
+public:
+    struct promise_type : Promise<T>
+    {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        static Task get_return_object_on_allocation_failure() { return Task(); }
+    };
+
+    Task() = default;
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    ~Task()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    // false if no frame was free
+    bool valid() const { return static_cast<bool>(handle_); }
+
+    // a task without frame completes at once with T{}
+    bool await_ready() const noexcept { return !handle_; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        handle_.promise().continuation = caller;
+        return handle_;
+    }
+
+    T await_resume()
+    {
+        if constexpr (!std::is_void_v<T>)
+            return handle_ ? std::move(handle_.promise().value) : T{};
+    }
+
+private:
+    friend class Executor;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// ===========================================================
+//                      EXECUTOR
+// ===========================================================
+
+class Request;
+class Sleep;
+
+// Runs spawned tasks on one thread, polls the driver while they wait
+class Executor
+{
+public:
+    // idle is called when nothing is ready, e.g. to sleep until the next interrupt
+    explicit Executor(void (*idle)() = nullptr) : idle_(idle) {}
+
+    // false if the task has no frame
+    bool spawn(Task<> task)
+    {
+        if (!task.valid())
+            return false;
+        auto handle = std::exchange(task.handle_, nullptr);
+        handle.promise().owner = this;
+        handle.promise().start.handle = handle;
+        live_++;
+        ready(&handle.promise().start);
+        return true;
+    }
+
+    // One round: poll the driver, wake due sleepers, resume ready coroutines.
+    // Returns false once all spawned tasks are done.
+    bool run_once()
+    {
+        DS2438_Poll();
+        retry_blocked();
+        wake_sleepers();
+        if (!ready_head_)
+        {
+            if (idle_)
+                idle_();
+            return live_ != 0;
+        }
+        //only the coroutines ready now, the ones they wake wait for the next round
+        Waiter* waiter = std::exchange(ready_head_, nullptr);
+        ready_tail_ = nullptr;
+        while (waiter)
+        {
+            Waiter* next = waiter->next;
+            waiter->handle.resume();
+            waiter = next;
+        }
+        return live_ != 0;
+    }
+
+    void run()
+    {
+        while (run_once())
+        {
+        }
+    }
+
+    std::size_t live() const { return live_; }
+
+    inline Sleep sleep_for_us(uint32_t us);
+
+private:
+    friend struct PromiseBase;
+    friend class Request;
+    friend class Sleep;
+
+    void ready(Waiter* waiter)
+    {
+        waiter->next = nullptr;
+        if (ready_tail_)
+            ready_tail_->next = waiter;
+        else
+            ready_head_ = waiter;
+        ready_tail_ = waiter;
+    }
+
+    void finished() { live_--; }
+
+    inline void block(Request* request);
+    inline void retry_blocked();
+    inline void wake_sleepers();
+
+    void (*idle_)();
+    std::size_t live_ = 0;
+    Waiter* ready_head_ = nullptr;
+    Waiter* ready_tail_ = nullptr;
+    Request* blocked_head_ = nullptr;       // requests waiting for a free slot of the driver queue
+    Request* blocked_tail_ = nullptr;
+    Sleep* sleepers_ = nullptr;
+};
+
+template <class Promise>
+std::coroutine_handle<> PromiseBase::FinalAwaiter::await_suspend(std::coroutine_handle<Promise> handle) noexcept
+{
+    PromiseBase& promise = handle.promise();
+    if (!promise.owner)
+        return promise.continuation;
+    //a spawned task has no one to return to
+    promise.owner->finished();
+    handle.destroy();
+    return std::noop_coroutine();
+}
+
+// ===========================================================
+//                      AWAITABLES
+// ===========================================================
+
+// One queued driver request, co_await gives Result<ds2438_async_result_t>
+class Request : public Waiter
+{
+public:
+    enum Kind : uint8_t { READ_PAGE, WRITE_PAGE, READ_VOLTAGE, READ_TEMPERATURE };
+
+    Request(Executor& executor, ds2438_t* dev, Kind kind, uint8_t page_number = 0, const uint8_t* page_data = nullptr)
+        : executor_(executor), dev_(dev), kind_(kind)
+    {
+        result_.value.page_number = page_number;
+        for (int i = 0; i < 9; i++)
+            result_.value.page_data[i] = page_data ? page_data[i] : 0;
+    }
+    Request(const Request&) = delete;
+    Request& operator=(const Request&) = delete;
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> caller)
+    {
+        handle = caller;
+        if (!submit())
+            executor_.block(this);
+    }
+
+    Result<ds2438_async_result_t> await_resume() const { return result_; }
+
+private:
+    friend class Executor;
+
+    // false while the driver queue is full
+    bool submit()
+    {
+        uint8_t status;
+        switch (kind_)
+        {
+        case READ_PAGE:
+            status = DS2438_ReadPageAsync(dev_, result_.value.page_number, &Request::done, this);
+            break;
+        case WRITE_PAGE:
+            status = DS2438_WritePageAsync(dev_, result_.value.page_number, result_.value.page_data, &Request::done, this);
+            break;
+        case READ_VOLTAGE:
+            status = DS2438_ReadVoltageAsync(dev_, &Request::done, this);
+            break;
+        default:
+            status = DS2438_ReadTemperatureAsync(dev_, &Request::done, this);
+            break;
+        }
+        if (status == DS2438_BUSY)
+            return false;
+        if (status != DS2438_OP_SUCCESS)//rejected, e.g. bad page number
+        {
+            result_.status = status;
+            executor_.ready(this);
+        }
+        return true;
+    }
+
+    // completion callback, runs inside DS2438_Poll()
+    static void done(ds2438_t*, uint8_t status, const ds2438_async_result_t* result, void* context)
+    {
+        Request* request = static_cast<Request*>(context);
+        request->result_.status = status;
+        request->result_.value = *result;
+        request->executor_.ready(request);
+    }
+
+    Executor& executor_;
+    ds2438_t* dev_;
+    Kind kind_;
+    Request* next_blocked_ = nullptr;
+    Result<ds2438_async_result_t> result_;
+};
+
+// co_await executor.sleep_for_us(us)
+class Sleep : public Waiter
+{
+public:
+    Sleep(Executor& executor, uint32_t us)
+        : executor_(executor), until_(ds2438_hal_cycles() + us * (ds2438_hal_cycles_per_s() / 1000000))
+    {
+    }
+    Sleep(const Sleep&) = delete;
+    Sleep& operator=(const Sleep&) = delete;
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> caller)
+    {
+        handle = caller;
+        next_sleeper_ = executor_.sleepers_;
+        executor_.sleepers_ = this;
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    friend class Executor;
+
+    Executor& executor_;
+    uint32_t until_;                        // CPU cycle counter at the end of the sleep
+    Sleep* next_sleeper_ = nullptr;
+};
+
+inline Sleep Executor::sleep_for_us(uint32_t us)
+{
+    return Sleep(*this, us);
+}
+
+inline void Executor::block(Request* request)
+{
+    request->next_blocked_ = nullptr;
+    if (blocked_tail_)
+        blocked_tail_->next_blocked_ = request;
+    else
+        blocked_head_ = request;
+    blocked_tail_ = request;
+}
+
+inline void Executor::retry_blocked()
+{
+    //in order, stop at the first one that still does not fit
+    while (blocked_head_ && blocked_head_->submit())
+    {
+        blocked_head_ = blocked_head_->next_blocked_;
+        if (!blocked_head_)
+            blocked_tail_ = nullptr;
+    }
+}
+
+inline void Executor::wake_sleepers()
+{
+    uint32_t now = ds2438_hal_cycles();
+    Sleep** link = &sleepers_;
+    while (*link)
+    {
+        Sleep* sleep = *link;
+        if (static_cast<int32_t>(now - sleep->until_) >= 0)
+        {
+            *link = sleep->next_sleeper_;
+            ready(sleep);
+        }
+        else
+        {
+            link = &sleep->next_sleeper_;
+        }
+    }
+}
+
+// ===========================================================
+//                      DEVICE
+// ===========================================================
+
+// Awaitable operations of one DS2438
+class Device
+{
+public:
+    Device(Executor& executor, ds2438_t* dev) : executor_(executor), dev_(dev) {}
+
+    ds2438_t* handle() const { return dev_; }
+
+    Request read_page(uint8_t page_number) { return Request(executor_, dev_, Request::READ_PAGE, page_number); }
+
+    // page_data (9 bytes) is copied
+    Request write_page(uint8_t page_number, const uint8_t* page_data)
+    {
+        return Request(executor_, dev_, Request::WRITE_PAGE, page_number, page_data);
+    }
+
+    // value: voltage in V, page_data: page 0 after the conversion
+    Request convert_voltage() { return Request(executor_, dev_, Request::READ_VOLTAGE); }
+
+    // value: temperature in C, page_data: page 0 after the conversion
+    Request convert_temperature() { return Request(executor_, dev_, Request::READ_TEMPERATURE); }
+
+    // Like DS2438_ReadSnapshot(). The current comes from the page 0 read
+    // that ends the voltage conversion, so it takes one page read less.
+    Task<Result<ds2438_snapshot_t>> read_snapshot()
+    {
+        Result<ds2438_snapshot_t> snapshot;
+        auto temperature = co_await convert_temperature();
+        snapshot.status = temperature.status;
+        if (!temperature.ok())
+            co_return snapshot;
+        snapshot.value.temperature = temperature.value.value;
+        snapshot.value.temperature_us = DS2438_GetTimestamp_us(dev_);
+
+        auto voltage = co_await convert_voltage();
+        snapshot.status = voltage.status;
+        if (!voltage.ok())
+            co_return snapshot;
+        snapshot.value.voltage = voltage.value.value;
+        snapshot.value.voltage_us = DS2438_GetTimestamp_us(dev_);
+        snapshot.value.current = DS2438_DecodeCurrent(dev_, voltage.value.page_data);
+        snapshot.value.current_us = snapshot.value.voltage_us;
+
+        auto page1 = co_await read_page(0x01);
+        snapshot.status = page1.status;
+        if (!page1.ok())
+            co_return snapshot;
+        snapshot.value.ica = page1.value.page_data[4];
+        snapshot.value.ica_us = DS2438_GetTimestamp_us(dev_);
+        co_return snapshot;
+    }
+
+private:
+    Executor& executor_;
+    ds2438_t* dev_;
+};
+
+} // namespace ds2438
+
+#endif
@@ -0,0 +1,141 @@
+/**
+  ******************************************************************************
+  * @file    DS2438_Hal.h
+  * @brief   Hardware abstraction layer of the DS2438 Libary
+  ******************************************************************************
+  * Everything DS2438_Library.c needs from the hardware: the 1-Wire pin,
+  * delays, the cycle counter and the UART transmitter. DS2438_Hal_STM32.c
+  * implements it for the STM32F103 (PA0, USART1 + DMA1 channel 4, DWT, TIM2),
+  * host/ds2438_hal_sim.cpp for the DS2438 simulator on Linux.
+  ******************************************************************************
+ */
+
+#ifndef DS2438_HAL_H
+#define DS2438_HAL_H
+
+#include <stdint.h>
+
+/**
+*   \brief Returned by ds2438_hal_uart_init() for a baudrate the UART clock cannot produce.
+*/
+#define DS2438_HAL_UART_BAD_BAUDRATE INT32_MIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*---------------------------Prototypes ---------------------------------------*/
+    // ===========================================================
+    //                  1-WIRE PIN
+    // ===========================================================
+
+    // Every function takes the line of the bus (ds2438_bus_t.line), so one
+    // HAL can drive several buses. Line 0 is the default line.
+
+    /**
+    *   \brief Configures the 1-Wire pin as open drain output, released.
+    */
+void ds2438_hal_pin_init(uint8_t line);
+
+    /**
+    *   \brief Drives the 1-Wire line low.
+    */
+void ds2438_hal_pin_low(uint8_t line);
+
+    /**
+    *   \brief Releases the 1-Wire line, the pull-up pulls it high.
+    */
+void ds2438_hal_pin_release(uint8_t line);
+
+    /**
+    *   \brief Samples the 1-Wire line.
+    *   \return 0 if the line is low, 1 if it is high.
+    */
+int ds2438_hal_pin_read(uint8_t line);
+
+    // ===========================================================
+    //                  TIME
+    // ===========================================================
+
+    /**
+    *   \brief Busy waits for the given number of microseconds.
+    */
+void ds2438_hal_delay_us(uint32_t us);
+
+    /**
+    *   \brief Waits at least the given number of microseconds with the core
+    *   asleep (WFI), woken by a timer. Interrupts are served meanwhile.
+    *   The cycle counter includes the time asleep.
+    *   \return microseconds the core was asleep
+    */
+uint32_t ds2438_hal_sleep_us(uint32_t us);
+
+    /**
+    *   \brief Starts the free running CPU cycle counter.
+    */
+void ds2438_hal_cycles_init(void);
+
+    /**
+    *   \brief Current value of the 32-bit CPU cycle counter.
+    */
+uint32_t ds2438_hal_cycles(void);
+
+    /**
+    *   \brief Nominal CPU cycles per second.
+    */
+uint32_t ds2438_hal_cycles_per_s(void);
+
+    // ===========================================================
+    //                  UART TRANSMITTER
+    // ===========================================================
+
+    /**
+    *   \brief Initializes the UART (8N1) for transmitting in the background.
+    *   \param baudrate requested baudrate
+    *   \return error of the real baudrate in ppm, #DS2438_HAL_UART_BAD_BAUDRATE
+    *   without touching the UART if the baudrate is 0 or out of range
+    */
+int32_t ds2438_hal_uart_init(uint32_t baudrate);
+
+    /**
+    *   \brief Starts sending length chars in the background.
+    *   The HAL calls uart_tx_complete() when the transfer is done,
+    *   data must stay valid until then.
+    */
+void ds2438_hal_uart_start_tx(const char* data, uint16_t length);
+
+    /**
+    *   \brief Returns 1 once the last char has left the transmitter.
+    */
+int ds2438_hal_uart_tx_idle(void);
+
+    /**
+    *   \brief Called by the HAL (in interrupt context) when a transfer
+    *   started with ds2438_hal_uart_start_tx() is complete.
+    *   Implemented in DS2438_Library.c.
+    */
+void uart_tx_complete(void);
+
+    // ===========================================================
+    //                  INTERRUPTS
+    // ===========================================================
+
+    /**
+    *   \brief Disables interrupts.
+    *   \return the interrupt state before, for ds2438_hal_irq_enable(). The
+    *   caller may already run with interrupts disabled.
+    */
+uint32_t ds2438_hal_irq_disable(void);
+
+    /**
+    *   \brief Restores the interrupt state saved by ds2438_hal_irq_disable(),
+    *   i.e. enables interrupts only if they were enabled before.
+    *   \param state the return value of ds2438_hal_irq_disable().
+    */
+void ds2438_hal_irq_enable(uint32_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,244 @@
+/**
+  ******************************************************************************
+  * @file    DS2438_Hal_STM32.c
+  * @brief   STM32F103 implementation of the DS2438 Libary HAL
+  ******************************************************************************
+  * 1-Wire on PA0 (open drain, bit-band access), USART1 TX on PA9 fed by
+  * DMA1 channel 4, DWT cycle counter, TIM2 (1 us ticks) as sleep wakeup.
+  ******************************************************************************
+ */
+
+#include <stm32f10x.h>
+
+#include "DS2438_Hal.h"
+
+/*----------------------------- Define Pins for Onewire--------------*/
+#define GPIOA_IDR GPIOA_BASE + 2*sizeof(uint32_t)    // Calc peripheral address GPIOA IDR
+#define GPIOA_ODR GPIOA_BASE + 3*sizeof(uint32_t)   // Calc peripheral address GPIOA ODR
+
+// Calc Bit Band Adress from peripheral address: a = peripheral address b = Bit number
+#define BITBAND_PERI(a, b) ((PERIPH_BB_BASE + (a-PERIPH_BASE)*32 + (b*4)))
+
+// Line n of the HAL is pin PAn (PA9 and PA10 are used by USART1)
+#define Onewire_Out(line)  *((volatile unsigned long *)(BITBAND_PERI(GPIOA_ODR,(line))))  // PAn; OneWire Leitung Out
+#define Onewire_In(line)  *((volatile unsigned long *)(BITBAND_PERI(GPIOA_IDR,(line))))  // PAn; OneWire Leitung In
+
+/*----------------------------- Sleep --------------------------------*/
+#define SLEEP_CHUNK_US 60000    // longest TIM2 period, 16 bit counter with 1 us ticks
+#define SLEEP_MIN_US 50         // shorter waits are not worth the wakeup
+
+static volatile uint8_t sleep_timer_done;
+static uint32_t sleep_cycles;   // cycles asleep, the DWT counter stops during WFI
+
+// ===========================================================
+//                 FUNCTION BODIES
+// ===========================================================
+
+void ds2438_hal_pin_init(uint8_t line)
+{
+    uint32_t temp;
+    uint32_t shift = (line & 0x7) * 4;
+    volatile uint32_t* cr = line < 8 ? &GPIOA->CRL : &GPIOA->CRH;   // PA0-7: CRL, PA8-15: CRH
+    RCC->APB2ENR |= 0x4;       // enable clock for GPIOA
+
+    Onewire_Out(line)=1;       // released before the pin becomes an output
+//Configure GPIO lines OneWire
+    temp = *cr;
+    temp &= ~(0xFu << shift);  // Reset PAn Configuration Bits
+    temp |= 0x7u << shift;     // Set PAn to GP OD mode
+    *cr = temp;
+}
+
+void ds2438_hal_pin_low(uint8_t line)
+{
+    Onewire_Out(line)=0; // Drives DQ low
+}
+
+void ds2438_hal_pin_release(uint8_t line)
+{
+    Onewire_Out(line)=1; // Releases the bus
+}
+
+int ds2438_hal_pin_read(uint8_t line)
+{
+    return Onewire_In(line);
+}
+
+void ds2438_hal_delay_us(uint32_t us)	//8 loop iterations per us at 8 MHz
+{
+    uint32_t j;
+    for(j = 0; j < 8*us; j++) {
+    }
+}
+
+uint32_t ds2438_hal_sleep_us(uint32_t us)
+{
+    uint32_t tim_clk, cycles_per_us, asleep_us = 0;
+    if (us < SLEEP_MIN_US)
+    {
+        ds2438_hal_delay_us(us);
+        return 0;
+    }
+    RCC->APB1ENR |= 0x1;          // TIM2 mit einem Takt versorgen
+    //TIM2 is clocked by PCLK1, doubled if the APB1 prescaler is not 1
+    tim_clk = SystemCoreClock;
+    if (RCC->CFGR & 0x400)        // PPRE1: 1xx --> HCLK divided by 2, 4, 8, 16
+    {
+        tim_clk = (SystemCoreClock >> (((RCC->CFGR >> 8) & 0x3) + 1)) * 2;
+    }
+    cycles_per_us = SystemCoreClock / 1000000;
+    TIM2->CR1 = 0;
+    TIM2->PSC = tim_clk / 1000000 - 1;
+    NVIC_EnableIRQ(TIM2_IRQn);
+
+    while (us)
+    {
+        uint32_t chunk = us > SLEEP_CHUNK_US ? SLEEP_CHUNK_US : us;
+        uint32_t start = DWT->CYCCNT;
+        uint32_t counted;
+        TIM2->ARR = chunk;
+        TIM2->CNT = 0;
+        TIM2->EGR = 0x1;          // UG: load the prescaler
+        TIM2->SR = 0;
+        sleep_timer_done = 0;
+        TIM2->DIER = 0x1;         // UIE: update interrupt
+        TIM2->CR1 = 0x8 | 0x4 | 0x1;  // OPM: stop at the update, URS: only on overflow, CEN
+
+        //WFI also wakes on an interrupt pending while PRIMASK is set,
+        //so none can slip in between the check and the sleep
+        __disable_irq();
+        while (!sleep_timer_done)
+        {
+            __WFI();
+            __enable_irq();       // serve the interrupt that woke the core
+            __disable_irq();
+        }
+        __enable_irq();
+
+        //the DWT counter only ran while the core was awake
+        counted = DWT->CYCCNT - start;
+        if (chunk * cycles_per_us > counted)
+        {
+            sleep_cycles += chunk * cycles_per_us - counted;
+            asleep_us += chunk - counted / cycles_per_us;
+        }
+        us -= chunk;
+    }
+    return asleep_us;
+}
+
+void TIM2_IRQHandler(void)
+{
+    if (TIM2->SR & 0x1)//UIF: update
+    {
+        TIM2->SR = 0;
+        sleep_timer_done = 1;
+    }
+}
+
+void ds2438_hal_cycles_init(void)
+{
+    //enable the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t ds2438_hal_cycles(void)
+{
+    return DWT->CYCCNT + sleep_cycles;
+}
+
+uint32_t ds2438_hal_cycles_per_s(void)
+{
+    return SystemCoreClock;
+}
+
+int32_t ds2438_hal_uart_init(uint32_t baudrate)
+{
+    uint32_t pclk2, brr, actual;
+
+    //USART1 is clocked by PCLK2 = HCLK / APB2 prescaler
+    SystemCoreClockUpdate();
+    pclk2 = SystemCoreClock;
+    if (RCC->CFGR & 0x2000)       // PPRE2: 1xx --> HCLK divided by 2, 4, 8, 16
+    {
+        pclk2 >>= ((RCC->CFGR >> 11) & 0x3) + 1;
+    }
+    if (baudrate == 0)
+    {
+        return DS2438_HAL_UART_BAD_BAUDRATE;
+    }
+    //BRR = USARTDIV * 16 = PCLK2 / baudrate, rounded to the nearest value
+    brr = (pclk2 + baudrate / 2) / baudrate;
+    if (brr < 16 || brr > 0xFFFF) // USARTDIV from 1 to 4095.9375 --> PCLK2/16 down to PCLK2/65535 Baud
+    {
+        return DS2438_HAL_UART_BAD_BAUDRATE;
+    }
+
+    RCC->APB2ENR |= 0x4; //GPIOA mit einem Takt versorgen
+
+    GPIOA->CRH &= 0xFFFFFF0F;     // reset  PA.9 configuration-bits
+    GPIOA->CRH |= 0xB0;           //Tx (PA9) - alt. out push-pull
+
+    GPIOA->CRH &= 0xFFFFF0FF;     //reset PA.10 configuration-bits
+    GPIOA->CRH |= 0x400;          //Rx (PA10) - floating
+
+    RCC->APB2ENR |= 0x4000;       //USART1 mit einem Takt versrogen
+
+    USART1->CR1 &= ~0x1000;       // M: Word length:0 --> Start bit, 8 Data bits, n Stop bit
+    USART1->CR1 &= ~0x0400;       // PCE (Parity control enable):0 --> No Parity
+
+    USART1->CR2 &= ~0x3000;       // STOP:00 --> 1 Stop bit
+
+    USART1->BRR = brr;
+
+    USART1->CR3 |= 0x80;          // DMAT: transmit via DMA
+
+    USART1->CR1 |= 0x0C;          // enable  Receiver and Transmitter
+    USART1->CR1 |= 0x2000;        // Set USART Enable Bit
+
+    RCC->AHBENR |= 0x1;           // DMA1 mit einem Takt versorgen
+    DMA1_Channel4->CCR = 0;       // disable channel 4 (USART1_TX) while configuring
+    DMA1_Channel4->CPAR = (uint32_t)&USART1->DR;
+    // MINC: increment memory address, DIR: memory to peripheral, TCIE: transfer complete interrupt
+    DMA1_Channel4->CCR = 0x80 | 0x10 | 0x02;
+    NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+
+    //error of the real baudrate in ppm
+    actual = pclk2 / brr;
+    return (int32_t)(((int64_t)actual - baudrate) * 1000000 / baudrate);
+}
+
+void ds2438_hal_uart_start_tx(const char* data, uint16_t length)
+{
+    DMA1_Channel4->CCR &= ~0x01;
+    DMA1_Channel4->CMAR = (uint32_t)data;
+    DMA1_Channel4->CNDTR = length;
+    DMA1_Channel4->CCR |= 0x01;
+}
+
+int ds2438_hal_uart_tx_idle(void)
+{
+    return (USART1->SR & 0x40) != 0; //TC: the last char has been sent
+}
+
+void DMA1_Channel4_IRQHandler(void)
+{
+    if (DMA1->ISR & 0x2000)//TCIF4: transfer complete
+    {
+        DMA1->IFCR = 0x2000;
+        uart_tx_complete();
+    }
+}
+
+uint32_t ds2438_hal_irq_disable(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+}
+
+void ds2438_hal_irq_enable(uint32_t state)
+{
+    __set_PRIMASK(state);//stays disabled if it was called with interrupts off
+}
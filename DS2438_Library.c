@@ -10,10 +10,10 @@
   ******************************************************************************
   */
 
-#include <stm32f10x.h>
-#include <stdio.h>
-
 #include "DS2438_Library.h"
+#include "DS2438_Hal.h"
+
+#include <math.h>
 
 
 
@@ -33,46 +33,23 @@
 */
 #define DS2438_INPUT_VOLTAGE_VAD 1
 // ===========================================================
-//                      SENSE RESISTOR
-// ===========================================================
-
-/**
-*   \brief Value (in Ohm) of sense resistor to be used for current computation.
-*/
-#define DS2438_SENSE_RESISTOR 150
-
-// ===========================================================
-//                      RETURN CODES
+//                      1-WIRE COMMANDS
 // ===========================================================
 
 /**
-*   \brief Device was not found on the 1-Wire interface.
-*/
-#define DS2438_DEV_NOT_FOUND    0
-
-/**
-*   \brief Operation failed
-*/
-#define DS2438_ERROR            0
-
-/**
-*   \brief Bad parameter error.
+*   \brief Command to read ROM.
 */
-#define DS2438_BAD_PARAM        0
+#define DS2438_READ_ROM 0x33
 
 /**
-*   \brief Operation was successful
+*   \brief Command to address one device by its ROM ID.
 */
-#define DS2438_OP_SUCCESS   1
-
-// ===========================================================
-//                      1-WIRE COMMANDS
-// ===========================================================
+#define DS2438_MATCH_ROM 0x55
 
 /**
-*   \brief Command to read ROM.
+*   \brief Command to search the ROM IDs of all devices on the bus.
 */
-#define DS2438_READ_ROM 0x33
+#define DS2438_SEARCH_ROM 0xF0
 
 /**
 *   \brief Command to skip ROM match/search.
@@ -112,497 +89,1924 @@
 */
 #define DS2438_COPY_SCRATCHPAD 0x48
 
+// ===========================================================
+//                      TIMING
+// ===========================================================
+
+/**
+*   \brief Time (in 10us) needed to copy the scratchpad to EEPROM.
+*/
+#define DS2438_EEPROM_WRITE_TIME_10US 1000
+
+/**
+*   \brief Time (in 10us) between two current conversions (36.41 Hz).
+*/
+#define DS2438_CURRENT_CONV_TIME_10US 2800
+
+/**
+*   \brief Time (in 10us) of a temperature or voltage conversion.
+*/
+#define DS2438_CONV_TIME_10US 1000
+
+/**
+*   \brief Time (in 10us) of a reset sequence, see reset_Onewire().
+*/
+#define DS2438_RESET_TIME_10US 99
+
+/**
+*   \brief Time (in 10us) of one write time slot, see OneWire_WriteByte().
+*/
+#define DS2438_SLOT_TIME_10US 8
+
+// ===========================================================
+//                      ICA EXTENSION
+// ===========================================================
+
+/**
+*   \brief Marker byte identifying a valid ICA checkpoint in EEPROM.
+*/
+#define DS2438_ICA_CHECKPOINT_MARKER 0xA5
+
+/**
+*   \brief ICA steps of at least this size between two updates are ambiguous,
+*   the sign of the current decides if the register went up or down.
+*/
+#define DS2438_ICA_AMBIGUOUS_DELTA 64
+
+// ===========================================================
+//                      TIMEBASE
+// ===========================================================
+
+/**
+*   \brief Largest deviation of a drift estimate from the nominal CPU clock, 1/n of it.
+*/
+#define DS2438_TIMEBASE_MAX_RATE_ERROR 16
+
+/**
+*   \brief The timestamp may run ahead of the ETM by up to its resolution of 1 s.
+*/
+#define DS2438_TIMEBASE_MAX_AHEAD_US 1000000
+
+// ===========================================================
+//                      CONFIGURATION CACHE
+// ===========================================================
+
+/**
+*   \brief Bits of the configuration register that can be written (IAD, CA, EE, AD).
+*/
+#define DS2438_CONFIG_WRITABLE 0x0F
+
+/**
+*   \brief Temperature Busy flag of the configuration register.
+*/
+#define DS2438_CONFIG_TB 0x10
+
+/**
+*   \brief A/D Converter Busy flag of the configuration register.
+*/
+#define DS2438_CONFIG_ADB 0x40
+
+// ===========================================================
+//                      UART TX BUFFER
+// ===========================================================
+
+static char uart_tx_buffer[UART_TX_BUFFER_SIZE];
+static volatile uint16_t uart_tx_head = 0;      // next free position, written by the application
+static volatile uint16_t uart_tx_tail = 0;      // first unsent char, written by the DMA interrupt
+static volatile uint16_t uart_tx_dma_len = 0;   // chars in the running DMA transfer, 0 if idle
+static volatile uint32_t uart_tx_dropped = 0;   // chars dropped because the buffer was full
+static uint8_t uart_tx_overflow_mode = UART_OVERFLOW_DROP;
+static uint8_t telemetry_sequence = 0;          // sequence number of the next binary frame
+
+// ===========================================================
+//                      STATISTICS
+// ===========================================================
+
+// Count a bus event for the bus and for the device it addresses
+#define DS2438_COUNT(bus, field) \
+    do { (bus)->stats.field++; if ((bus)->device) (bus)->device->field++; } while (0)
+
+// Count an event of a device and its bus
+#define DS2438_COUNT_DEV(dev, field) \
+    do { (dev)->bus->stats.field++; (dev)->stats.bus.field++; } while (0)
+
+// Add n to a counter of a device and its bus
+#define DS2438_ADD_DEV(dev, field, n) \
+    do { (dev)->bus->stats.field += (n); (dev)->stats.bus.field += (n); } while (0)
+
+// Return the status of a call unless it succeeded
+#define DS2438_TRY(call) \
+    do { uint8_t status_ = (call); if (status_ != DS2438_OP_SUCCESS) return status_; } while (0)
+
+static const char* const stats_api_names[DS2438_API_COUNT] = {
+    "ReadPage", "WritePage", "ReadVoltage", "ReadTemperature"
+};
+
+// ===========================================================
+//                      1-WIRE TRACE
+// ===========================================================
+
+#if DS2438_TRACE_ENABLE
+
+#if (DS2438_TRACE_SIZE & (DS2438_TRACE_SIZE - 1)) != 0
+#error "DS2438_TRACE_SIZE must be a power of 2"
+#endif
+
+static ds2438_trace_entry_t trace_ring[DS2438_TRACE_SIZE];
+static uint16_t trace_head = 0;     // next entry to be written
+static uint16_t trace_count = 0;    // valid entries, at most DS2438_TRACE_SIZE
+
+static void DS2438_TraceAdd(uint8_t type, uint8_t value)
+{
+    ds2438_trace_entry_t* entry = &trace_ring[trace_head];
+    entry->cycles = ds2438_hal_cycles();
+    entry->type = type;
+    entry->value = value;
+    trace_head = (trace_head + 1) & (DS2438_TRACE_SIZE - 1);
+    if (trace_count < DS2438_TRACE_SIZE)
+        trace_count++;
+}
+
+#define DS2438_TRACE(type, value) DS2438_TraceAdd((type), (uint8_t)(value))
+#else
+#define DS2438_TRACE(type, value)
+#endif
+
+// ===========================================================
+//                      ASYNC QUEUE
+// ===========================================================
+
+// request types
+#define DS2438_ASYNC_READ_PAGE 0
+#define DS2438_ASYNC_WRITE_PAGE 1
+#define DS2438_ASYNC_READ_VOLTAGE 2
+#define DS2438_ASYNC_READ_TEMPERATURE 3
+
+// steps of the request being served
+#define DS2438_STEP_START 0         // nothing sent yet
+#define DS2438_STEP_CONVERT 1       // conversion running, check the busy flag at async_next
+#define DS2438_STEP_PROGRAM 2       // EEPROM programmed until async_next
+
+// returned by a step that has to be continued
+#define DS2438_IN_PROGRESS 0xFF
+
+typedef struct
+{
+    ds2438_t* dev;
+    uint8_t type;                   // DS2438_ASYNC_
+    ds2438_callback_t callback;
+    void* context;
+    ds2438_async_result_t result;
+} ds2438_request_t;
+
+static ds2438_request_t async_queue[DS2438_ASYNC_QUEUE_SIZE];
+static volatile uint8_t async_head = 0;     // next free slot
+static volatile uint8_t async_tail = 0;     // request being served
+static volatile uint8_t async_polling = 0;  // 1 while DS2438_Poll() runs
+static uint8_t async_step = DS2438_STEP_START;
+static uint32_t async_started;              // CPU cycle counter at the start of the conversion
+static uint32_t async_next;                 // CPU cycle counter of the next step
+
 // ===========================================================
 //                 FUNCTION BODIES
 // ===========================================================
 
 void wait_10us(int factor){	//wait for 10us multiplied by the value that gets passed as argument
-    int j;
-    for(j = 0; j < 80*factor; j++) {
-    }
+    ds2438_hal_delay_us(10*factor);
 }
 
 void wait_us(int factor){	//wait for 1us multiplied by the value that gets passed as argument
-    int j;
-    for(j = 0; j < 8*factor; j++) {
+    ds2438_hal_delay_us(factor);
+}
+
+// Set size bytes to 0
+static void DS2438_Clear(void* data, uint16_t size)
+{
+    uint8_t* p = (uint8_t*)data;
+    for (uint16_t i = 0; i < size; i++)
+    {
+        p[i] = 0;
     }
 }
 
-//print the content/page data from a page
-void uart_put_page_content(uint8_t* page_data, uint8_t page_number)
+void init_OnewirePort(ds2438_bus_t* bus) {
+    OneWire_InitBus(bus, 0);
+}
+
+void OneWire_InitBus(ds2438_bus_t* bus, uint8_t line)
+{
+    DS2438_Clear(bus, sizeof(*bus));
+    bus->line = line;
+    ds2438_hal_pin_init(line);
+    ds2438_hal_cycles_init();//for the latency statistics
+}
+
+void DS2438_Init(ds2438_t* dev, ds2438_bus_t* bus, const uint8_t* rom, float sense_resistor)
 {
-    char msg[50];
-    sprintf(msg, "Page %d content (MSB to LSB): %d %d %d %d %d %d %d %d", page_number, page_data[0], page_data[1],
-            page_data[2], page_data[3],
-            page_data[4], page_data[5],
-            page_data[6], page_data[7]);
-    uart_put_string_newline(msg);
+    DS2438_Clear(dev, sizeof(*dev));
+    dev->bus = bus;
+    if (rom)//otherwise family code 0: only device on the bus, SKIP ROM
+    {
+        for (uint8_t i = 0; i < DS2438_ROM_SIZE; i++)
+        {
+            dev->rom[i] = rom[i];
+        }
+    }
+    dev->sense_resistor = sense_resistor;
+    dev->calibration.voltage_gain = 1;
+    dev->calibration.current_gain = 1;
+    dev->retry.crc_retries = DS2438_RETRY_CRC_DEFAULT;
+    dev->retry.presence_retries = DS2438_RETRY_PRESENCE_DEFAULT;
+    dev->retry.backoff_min_ms = DS2438_BACKOFF_MIN_MS_DEFAULT;
+    dev->retry.backoff_max_ms = DS2438_BACKOFF_MAX_MS_DEFAULT;
 }
 
-void init_OnewirePort(void) {
-    int temp;
-    RCC->APB2ENR |= 0x4;       // enable clock for GPIOA
+// Mark the bus as held low, leave it alone for DS2438_BUS_RECHECK_MS
+static void OneWire_SetStuck(ds2438_bus_t* bus)
+{
+    DS2438_COUNT(bus, bus_faults);
+    bus->health = DS2438_BUS_STUCK;
+    bus->stuck_since = ds2438_hal_cycles();
+}
 
-//Configure GPIO lines OneWire
-    temp = GPIOA->CRL;
-    temp &= 0xFFFFFFF0;    // Reset PA0 Configuration Bits
-    temp |= 0x7;    // Set PA0 to GP OD mode
-    GPIOA->CRL = temp;
+uint8_t OneWire_Recover(ds2438_bus_t* bus)
+{
+    ds2438_hal_pin_release(bus->line);
+    wait_10us(12);//longer than any time slot, a device sending a 0 bit is done
+    if (!ds2438_hal_pin_read(bus->line))
+    {
+        //reset pulse of twice the normal length, then let the presence pulse pass
+        ds2438_hal_pin_low(bus->line);
+        wait_10us(100);
+        ds2438_hal_pin_release(bus->line);
+        wait_10us(50);
+    }
+    if (!ds2438_hal_pin_read(bus->line))
+    {
+        OneWire_SetStuck(bus);
+        return DS2438_BUS_FAULT;
+    }
+    bus->health = DS2438_BUS_OK;
+    return DS2438_OP_SUCCESS;
 }
 
-int reset_Onewire(void) {
-    Onewire_Out=0; // Drives DQ low
+int reset_Onewire(ds2438_bus_t* bus) {
+    //stuck bus: fail at once until the next recovery attempt; the elapsed time is
+    //compared, an end time would look in the future again 2^31 cycles after it
+    if (bus->health == DS2438_BUS_STUCK)
+    {
+        if (ds2438_hal_cycles() - bus->stuck_since < DS2438_BUS_RECHECK_MS * (ds2438_hal_cycles_per_s() / 1000))
+            return DS2438_BUS_FAULT;
+        bus->health = DS2438_BUS_OK;//the line is checked below
+    }
+    //the line has to be high before the reset pulse
+    if (!ds2438_hal_pin_read(bus->line) && OneWire_Recover(bus) != DS2438_OP_SUCCESS)
+    {
+        DS2438_TRACE(DS2438_TRACE_RESET, DS2438_BUS_FAULT);
+        return DS2438_BUS_FAULT;
+    }
+    ds2438_hal_pin_low(bus->line); // Drives DQ low
     wait_10us(50);//Reset Time Low
-    Onewire_Out=1; // Releases the bus
+    ds2438_hal_pin_release(bus->line); // Releases the bus
     wait_10us(7);// wait Presence Detect High time + 10s to be in Presence Detect High time window
-    int result=Onewire_In; //get slave response
+    int result=ds2438_hal_pin_read(bus->line); //get slave response
     wait_10us(42);//finish Reset Time High
+    DS2438_COUNT(bus, resets);
+    //the presence pulse is over, a low line here would fake one
+    if (!ds2438_hal_pin_read(bus->line))
+    {
+        OneWire_SetStuck(bus);
+        result = DS2438_BUS_FAULT;
+    }
+    else if (result)
+        DS2438_COUNT(bus, presence_failures);
+    DS2438_TRACE(DS2438_TRACE_RESET, result);
     return result; //0 if low pulse from slave detected, 1 if not
 }
 
+// Reset the bus, as return code
+static uint8_t OneWire_Reset(ds2438_bus_t* bus)
+{
+    int result = reset_Onewire(bus);
+    if (result == DS2438_BUS_FAULT)
+        return DS2438_BUS_FAULT;
+    return result ? DS2438_DEV_NOT_FOUND : DS2438_OP_SUCCESS;
+}
+
 //returns 1 if device is ok
-int DS2438_IsDevicePresent(void)
+int DS2438_IsDevicePresent(ds2438_t* dev)
 {
     // check if device is present on the bus
-    return reset_Onewire() == 0;
+    dev->bus->device = &dev->stats.bus;
+    return reset_Onewire(dev->bus) == 0;
+}
+
+// Reset the bus and address the device
+static uint8_t DS2438_Select(ds2438_t* dev)
+{
+    dev->bus->device = &dev->stats.bus;
+    DS2438_TRY(OneWire_Reset(dev->bus));
+    if (dev->rom[0] == 0)//only device on the bus
+    {
+        OneWire_WriteByte(dev->bus, DS2438_SKIP_ROM);
+    }
+    else
+    {
+        OneWire_WriteByte(dev->bus, DS2438_MATCH_ROM);
+        for (uint8_t i = 0; i < DS2438_ROM_SIZE; i++)
+        {
+            OneWire_WriteByte(dev->bus, dev->rom[i]);
+        }
+    }
+    return DS2438_OP_SUCCESS;
 }
 
-uint8_t DS2438_EnableIAD(void)// Enable current measurements and ICA
+// Load the configuration cache from page 0 unless it is valid already
+static uint8_t DS2438_LoadConfig(ds2438_t* dev)
 {
     uint8_t page_data[9];
+    if (dev->config_valid)
+        return DS2438_OP_SUCCESS;
+    return DS2438_ReadPage(dev, 0x00, page_data);
+}
+
+// Write the configuration register and the threshold register of page 0,
+// the other bytes of page 0 are read only
+static uint8_t DS2438_WriteConfig(ds2438_t* dev, uint8_t config, uint8_t threshold)
+{
+    uint8_t page_data[9] = {0};
+    page_data[0] = config;
+    page_data[7] = threshold;
+    return DS2438_WritePage(dev, 0x00, page_data);
+}
+
+// Remember the writable configuration bits and the threshold of page 0
+static void DS2438_CacheConfig(ds2438_t* dev, uint8_t* page_data)
+{
+    dev->config = page_data[0] & DS2438_CONFIG_WRITABLE;
+    dev->threshold = page_data[7];
+    dev->config_valid = 1;
+}
+
+uint8_t DS2438_EnableIAD(ds2438_t* dev)// Enable current measurements and ICA
+{
     //Enable Current A/D Control Bit (Set bit 0 in byte 0 of page 0)
-    if (DS2438_ReadPage(0x00, page_data))//read Page 0 successful?
+    uint8_t result = DS2438_LoadConfig(dev);//configuration known?
+    if (result == DS2438_OP_SUCCESS)
     {
         // set bit 0 - ICA bit
-        page_data[0] |= 0x01;
-        return DS2438_WritePage(0x00, page_data);//write Page 0 successful?
+        return DS2438_WriteConfig(dev, dev->config | 0x01, dev->threshold);//write Page 0 successful?
     }
-    return DS2438_ERROR;
+    return result;
 }
 
-uint8_t DS2438_DisableIAD(void)// Disable current measurements and ICA
+uint8_t DS2438_DisableIAD(ds2438_t* dev)// Disable current measurements and ICA
 {
     // Clear bit 0 in byte 0 of page 0
-    uint8_t page_data[9];
-    if (DS2438_ReadPage(0x00, page_data))//read Page 0 successful?
+    uint8_t result = DS2438_LoadConfig(dev);//configuration known?
+    if (result == DS2438_OP_SUCCESS)
     {
         // Clear bit 0 - ICA bit
-        page_data[0] = page_data[0] & (~0x01);
-        return DS2438_WritePage(0x00, page_data);
+        return DS2438_WriteConfig(dev, dev->config & (~0x01), dev->threshold);
     }
-    return DS2438_ERROR;
+    return result;
 }
 
-uint8_t DS2438_EnableCA(void)
+uint8_t DS2438_EnableCA(ds2438_t* dev)
 {
     // Set bit 1 in byte 0 of page 0 -  - CA bit
-    uint8_t page_data[9];
-    if (DS2438_ReadPage(0x00, page_data))//read Page 0 successful?
+    uint8_t result = DS2438_LoadConfig(dev);//configuration known?
+    if (result == DS2438_OP_SUCCESS)
     {
         // set bit 1 - CA bit
-        page_data[0] = page_data[0] | 0x02;
-        return DS2438_WritePage(0x00, page_data);
+        return DS2438_WriteConfig(dev, dev->config | 0x02, dev->threshold);
     }
-    return DS2438_ERROR;
+    return result;
 
 }
 
-uint8_t DS2438_DisableCA(void)
+uint8_t DS2438_DisableCA(ds2438_t* dev)
 {
     // Clear bit 1 in byte 0 of page 0-  - CA bit
-    uint8_t page_data[9];
-    if (DS2438_ReadPage(0x00, page_data))//read Page 0 successful?
+    uint8_t result = DS2438_LoadConfig(dev);//configuration known?
+    if (result == DS2438_OP_SUCCESS)
     {
         // Clear bit 1  - CA bit
-        page_data[0] = page_data[0] & (~0x02);
-        return DS2438_WritePage(0x00, page_data);//write current Byte 0 with bit 1 cleared
+        return DS2438_WriteConfig(dev, dev->config & (~0x02), dev->threshold);//write current Byte 0 with bit 1 cleared
     }
-    return DS2438_ERROR;
+    return result;
 }
 
 
 // Get value of integrated current accumalator
-uint8_t DS2438_GetICA(uint8_t* ica)
+uint8_t DS2438_GetICA(ds2438_t* dev, uint8_t* ica)
 {
     // Read byte 4 of page 1 - ICA byte
     uint8_t page_data[9];
-    if (DS2438_ReadPage(0x01, page_data))
+    uint8_t result = DS2438_ReadPage(dev, 0x01, page_data);
+    if (result == DS2438_OP_SUCCESS)
     {
         *ica = page_data[4];
-        return DS2438_OP_SUCCESS;
     }
-    return DS2438_ERROR;
+    return result;
 }
 
-uint8_t DS2438_GetCapacity_mAh(float* capacity_mAh)
+uint8_t DS2438_GetCapacity_mAh(ds2438_t* dev, float* capacity_mAh)
 {
     uint8_t ica = 0;
-    if (DS2438_GetICA(&ica))//get ICA byte as int
+    uint8_t result = DS2438_GetICA(dev, &ica);//get ICA byte as int
+    if (result == DS2438_OP_SUCCESS)
     {
         //calculate capacity in mAh
-        *capacity_mAh = ica/(2.048*DS2438_SENSE_RESISTOR);
-        return DS2438_OP_SUCCESS;
+        *capacity_mAh = ica/(2.048*dev->sense_resistor) * dev->calibration.current_gain;
     }
-    return DS2438_ERROR;
+    return result;
 }
 
-// Read one page of data, return page data
-uint8_t DS2438_ReadPage(uint8_t page_number, uint8_t* page_data)
+uint8_t DS2438_GetLifetimeAccumulators(ds2438_t* dev, float nominal_capacity_mAh, ds2438_lifetime_t* lifetime)
 {
-    if (page_number > 0x07)//there are only pages from 0x00 to 0x07
+    // Read byte 4-7 of page 7 - CCA and DCA
+    uint8_t page_data[9];
+    if (nominal_capacity_mAh <= 0)
         return DS2438_BAD_PARAM;
-    else
+    uint8_t result = DS2438_ReadPage(dev, 0x07, page_data);
+    if (result == DS2438_OP_SUCCESS)
     {
-        if (DS2438_IsDevicePresent())// Reset sequence
-        {
-            // Skip ROM command
-            OneWire_WriteByte(DS2438_SKIP_ROM);
-            // Recall memory command
-            OneWire_WriteByte(DS2438_RECALL_MEMORY);
-            OneWire_WriteByte(page_number);//page number from which to recall memory
-            if (DS2438_IsDevicePresent())// Reset sequence
-            {
-                // Skip ROM command
-                OneWire_WriteByte(DS2438_SKIP_ROM);
-                // Read scratchpad command
-                OneWire_WriteByte(DS2438_READ_SCRATCHPAD);
-                //  which scratchpad page number to read from
-                OneWire_WriteByte(page_number);
-                // Read nine bytes
-                for (uint8_t i = 0; i < 9; i++) //eight 8-byte pages, 9th byte contains a cyclic redundancy check (CRC) byte
-                {
-                    page_data[i] = OneWire_ReadByte();
-                }
-                return DS2438_OP_SUCCESS;
-            }
-        }
+        lifetime->cca = page_data[4] | (page_data[5] << 8);
+        lifetime->dca = page_data[6] | (page_data[7] << 8);
+        //one CCA/DCA LSB is 32 ICA LSBs, same conversion as DS2438_GetCapacity_mAh
+        lifetime->charge_mAh = lifetime->cca * 32 / (2.048*dev->sense_resistor) * dev->calibration.current_gain;
+        lifetime->discharge_mAh = lifetime->dca * 32 / (2.048*dev->sense_resistor) * dev->calibration.current_gain;
+        lifetime->throughput_mAh = lifetime->charge_mAh + lifetime->discharge_mAh;
+        //one full cycle = the nominal capacity discharged once
+        lifetime->cycles = lifetime->discharge_mAh / nominal_capacity_mAh;
     }
-    return DS2438_DEV_NOT_FOUND;
+    return result;
 }
 
-// Write one page of data
-uint8_t DS2438_WritePage(uint8_t page_number, uint8_t * page_data)
+// Read a little endian 32-bit value from page data
+static uint32_t DS2438_GetUint32(uint8_t* data)
 {
-    if (page_number > 0x07)//there are only pages 0x00 to 0x07
-        return DS2438_BAD_PARAM;
-    else
-    {
-        // Reset sequence
-        if (DS2438_IsDevicePresent())
-        {
-            // Skip ROM command
-            OneWire_WriteByte(DS2438_SKIP_ROM);
-            // Write scratchpad command
-            OneWire_WriteByte(DS2438_WRITE_SCRATCHPAD);
-            // Write page number followed by page data
-            OneWire_WriteByte(page_number);
-            for (uint8_t i = 0; i < 9; i++)
-            {
-                OneWire_WriteByte(page_data[i]);
-            }
-            if (DS2438_IsDevicePresent())
-            {
-                // Skip ROM command
-                OneWire_WriteByte(DS2438_SKIP_ROM);
-                // Copy scratchpad command
-                OneWire_WriteByte(DS2438_COPY_SCRATCHPAD);
-                // Write page number
-                OneWire_WriteByte(page_number);
-                return DS2438_OP_SUCCESS;
-            }
-        }
-    }
-    return DS2438_DEV_NOT_FOUND;
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+           ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
 }
 
-void OneWire_WriteByte(int data)
+uint8_t DS2438_UpdateICA(ds2438_t* dev)
 {
-    int bit;
-
-    // Loop to write each bit in the byte, LS-bit first
-    for (bit = 0; bit < 8; bit++)
-    {
-        OneWire_WriteBit(data & 0x01);
-        // shift the data byte for the next bit
-        data >>= 1;
-    }
-
-}
+    uint8_t ica;
+    float current;
+    DS2438_TRY(DS2438_GetICA(dev, &ica));
+    DS2438_TRY(DS2438_GetCurrentData(dev, &current));
 
-void OneWire_WriteBit(int bit)
-{
-    if (bit)
+    if (dev->ica_valid)
     {
-        // Write '1' bit
-        Onewire_Out=0; // Drives DQ low
-        wait_10us(1); // Complete the Write 1 Low Time time
-        Onewire_Out=1; // Releases the bus
-        wait_10us(7); // Complete the Time Slot time and Recovery Time
+        //modular difference, -128..127
+        int16_t delta = (int8_t)(ica - dev->ica_last);
+        //a small step is taken as it is, the current may read slightly against it near 0 mA
+        //a step of half the range or more is ambiguous, the current sign tells the direction
+        if (delta >= DS2438_ICA_AMBIGUOUS_DELTA && current < 0)
+            delta -= 256;
+        else if (delta <= -DS2438_ICA_AMBIGUOUS_DELTA && current > 0)
+            delta += 256;
+        dev->ica_extended += delta;
     }
     else
     {
-        // Write '0' bit
-        Onewire_Out=0; // Drives DQ low
-        wait_10us(7); // Complete the Write 0 Low Time and Time Slot time
-        Onewire_Out=1; // Releases the bus
-        wait_10us(1);// Complete the Recovery Time
+        //first sample, start from the raw register value
+        dev->ica_extended = ica;
+        dev->ica_valid = 1;
     }
+    dev->ica_last = ica;
+    return DS2438_OP_SUCCESS;
 }
 
-int OneWire_ReadByte(void)
+uint8_t DS2438_GetExtendedICA(ds2438_t* dev, int32_t* ica_ext)
 {
-    int bit, result=0;
-    for (bit = 0; bit < 8; bit++)
-    {
-        // shift the result to get it ready for the next bit
-        result >>= 1;
-        // if result is one, then set MS bit (first set Bit gets shifted to LSB)
-        if (OneWire_ReadBit())
-            result |= 0x80;
-    }
-    return result;
+    if (!dev->ica_valid)
+        return DS2438_NO_DATA;
+    *ica_ext = dev->ica_extended;
+    return DS2438_OP_SUCCESS;
 }
 
-int OneWire_ReadBit(void)
+uint8_t DS2438_GetAccumulatedCapacity_mAh(ds2438_t* dev, float* capacity_mAh)
 {
-    int result;
-    Onewire_Out=0; // Drives DQ low
-    wait_us(7); // Complete the Read Low Time
-    Onewire_Out=1; // Releases the bus
-    wait_us(10);//get to sampling window
-    result = Onewire_In;// Sample the bit value from the slave
-    wait_10us(6); // Complete the Time Slot time and Recovery Time
-    return result;
+    if (!dev->ica_valid)
+        return DS2438_NO_DATA;
+    //same conversion as DS2438_GetCapacity_mAh
+    *capacity_mAh = dev->ica_extended/(2.048*dev->sense_resistor) * dev->calibration.current_gain;
+    return DS2438_OP_SUCCESS;
 }
 
-uint8_t DS2438_StartVoltageConversion(void)
+uint8_t DS2438_SaveICACheckpoint(ds2438_t* dev)
 {
-    // Reset sequence
-    if (DS2438_IsDevicePresent())
-    {
-        // Write skip rom command
-        OneWire_WriteByte(DS2438_SKIP_ROM);
-        // Write start voltage conversion command
-        OneWire_WriteByte(DS2438_VOLTAGE_CONV);
-        return DS2438_OP_SUCCESS;
-    }
-    return DS2438_DEV_NOT_FOUND;
+    uint8_t page_data[9] = {0};
+    if (!dev->ica_valid)
+        return DS2438_NO_DATA;
+    //extended ICA little endian, followed by the raw ICA and a marker
+    page_data[0] = (uint8_t)(dev->ica_extended);
+    page_data[1] = (uint8_t)(dev->ica_extended >> 8);
+    page_data[2] = (uint8_t)(dev->ica_extended >> 16);
+    page_data[3] = (uint8_t)(dev->ica_extended >> 24);
+    page_data[4] = dev->ica_last;
+    page_data[5] = DS2438_ICA_CHECKPOINT_MARKER;
+    return DS2438_WritePage(dev, DS2438_ICA_CHECKPOINT_PAGE, page_data);
 }
 
-uint8_t DS2438_ReadVoltage(float* voltage)
+uint8_t DS2438_RestoreICACheckpoint(ds2438_t* dev)
 {
-    //start voltage conversion
-    if (DS2438_StartVoltageConversion())
-    {
-        while(DS2438_HasVoltageData());//wait until conversion is complete
-        return DS2438_GetVoltageData(voltage);//get voltage
-    }
-    return DS2438_ERROR;
+    uint8_t page_data[9];
+    DS2438_TRY(DS2438_ReadPage(dev, DS2438_ICA_CHECKPOINT_PAGE, page_data));
+    if (page_data[5] != DS2438_ICA_CHECKPOINT_MARKER)//no checkpoint stored
+        return DS2438_NO_DATA;
+    dev->ica_extended = (int32_t)DS2438_GetUint32(&page_data[0]);
+    dev->ica_last = page_data[4];
+    dev->ica_valid = 1;
+    return DS2438_OP_SUCCESS;
 }
 
-uint8_t DS2438_HasVoltageData(void)
+uint8_t DS2438_GetETM(ds2438_t* dev, uint32_t* seconds)
 {
+    // Read byte 0-3 of page 1 - ETM bytes
     uint8_t page_data[9];
-    if (DS2438_ReadPage(0x00, page_data))
+    uint8_t result = DS2438_ReadPage(dev, 0x01, page_data);
+    if (result == DS2438_OP_SUCCESS)
     {
-        //the DS2438 will output �1� in the ADB = A/D Converter Busy Flag as
-        //long as it is busy making a voltage measurement;
-        //it will return a �0� when the conversion is complete
-        return (page_data[0] & 0x40);
+        *seconds = DS2438_GetUint32(&page_data[0]);
     }
-    return DS2438_DEV_NOT_FOUND;
+    return result;
 }
 
-uint8_t DS2438_GetVoltageData(float* mV_)
+// Set the ETM to seconds, plus the value it holds if relative is 1. Page 1
+// also holds the ICA and the offset register: IAD is off while the page is
+// read and written back, so the ICA cannot move in between and the offset
+// register accepts the write.
+static uint8_t DS2438_WriteETM(ds2438_t* dev, uint32_t seconds, uint8_t relative)
 {
+    uint8_t config_data[9];
     uint8_t page_data[9];
-    if (DS2438_ReadPage(0x00, page_data))
-    {
-        //getting the 2  REGISTER byte:
-        uint8_t volt_lsb = page_data[3];
-        uint8_t volt_msb = page_data[4];
-        //volt_msb only has 2 valid bits, rest is 0
-        //moving the msb by 8 bits so the result is MSB+LSB
-        //divide by 100 because the unit = 10 mV
-        //resulting  is in V
-        *mV_ = (((volt_msb & 0x3) << 8) | (volt_lsb)) / 100.0;
-        return DS2438_OP_SUCCESS;
-    }
-    return DS2438_DEV_NOT_FOUND;
-}
+    uint8_t result;
+    DS2438_TRY(DS2438_ReadPage(dev, 0x00, config_data));
+    if (config_data[0] & 0x01)
+        DS2438_TRY(DS2438_WriteConfig(dev, config_data[0] & ~0x01, config_data[7]));
 
-// Get current data in float format
-uint8_t DS2438_GetCurrentData(float* mA_current)
-{
-    uint8_t page_data[9];
-    if (DS2438_ReadPage(0x00, page_data))
-    {
-        //getting the 2 Current REGISTER byte:
-        uint8_t curr_lsb = page_data[5];
-        uint8_t curr_msb = page_data[6];
-        //curr_msb only has 2 valid bits, rest is sign
-        //moving the msb by 8 bits so the result is MSB+LSB
-        uint16_t data = (((curr_msb & 0x3) << 8) | (curr_lsb));
-        //The sign (S) of the result, indicating charge or discharge,
-        //resides in the most significant bit of the Current Register
-        //discharge? - current negative?
-        if ((curr_msb & ~0x3))
-        {
-            data *= -1;
-        }
-        *mA_current = ((data) / (4.096*DS2438_SENSE_RESISTOR));
-        return DS2438_OP_SUCCESS;
-    }
-    else
+    result = DS2438_ReadPage(dev, 0x01, page_data);
+    if (result == DS2438_OP_SUCCESS)
     {
-        return DS2438_ERROR;
+        if (relative)
+            seconds += DS2438_GetUint32(&page_data[0]);
+        page_data[0] = (uint8_t)(seconds);
+        page_data[1] = (uint8_t)(seconds >> 8);
+        page_data[2] = (uint8_t)(seconds >> 16);
+        page_data[3] = (uint8_t)(seconds >> 24);
+        result = DS2438_WritePage(dev, 0x01, page_data);
     }
-}
 
-uint8_t DS2438_SelectInputSource(uint8_t input_source)
-{
-    // Read page 0
-    uint8_t page_data[9];
-    if (DS2438_ReadPage(0x00, page_data))
+    //switch IAD on again even if the ETM could not be written
+    if (config_data[0] & 0x01)
     {
-        // set bit based on input source in first byte of page 0
-        if (input_source == DS2438_INPUT_VOLTAGE_VDD)
-        {
-            // set bit
-            page_data[0] = page_data[0] | (0x08);
-        }
-        else if (input_source == DS2438_INPUT_VOLTAGE_VAD)
-        {
-            // clear bit
-            page_data[0] = page_data[0] & (0xF7);
-        }
-        else
-        {
-            return DS2438_BAD_PARAM;
-        }
+        uint8_t restored = DS2438_WriteConfig(dev, config_data[0], config_data[7]);
+        if (result == DS2438_OP_SUCCESS)
+            result = restored;
     }
-    // write page 0
-    return DS2438_WritePage(0x00, page_data);
+    return result;
 }
 
-uint8_t DS2438_ReadTemperature(float* temperature)
+uint8_t DS2438_SetETM(ds2438_t* dev, uint32_t seconds)
 {
-    //start temperature conversion
-    if (DS2438_StartTemperatureConversion())
-    {
-        while(DS2438_HasTemperatureData());//wait until conversion is complete
-        return DS2438_GetTemperatureData(temperature);//get voltage
-    }
-    return DS2438_ERROR;
+    return DS2438_WriteETM(dev, seconds, 0);
 }
 
-uint8_t DS2438_StartTemperatureConversion(void)
+uint8_t DS2438_CompensateETM(ds2438_t* dev, int32_t correction)
 {
-    // Reset sequence
-    if (DS2438_IsDevicePresent())
-    {
-        // Skip ROM and issue temperature conversion command
-        OneWire_WriteByte(DS2438_SKIP_ROM);
-        OneWire_WriteByte(DS2438_TEMP_CONV);
-        return DS2438_OP_SUCCESS;
-    }
-    return DS2438_DEV_NOT_FOUND;
+    return DS2438_WriteETM(dev, (uint32_t)correction, 1);
 }
 
-
-uint8_t DS2438_HasTemperatureData(void)
+uint8_t DS2438_GetDisconnectTimestamp(ds2438_t* dev, uint32_t* seconds)
 {
+    // Read byte 0-3 of page 2 - disconnect timestamp
     uint8_t page_data[9];
-    if (DS2438_ReadPage(0x00, page_data))
+    uint8_t result = DS2438_ReadPage(dev, 0x02, page_data);
+    if (result == DS2438_OP_SUCCESS)
     {
-        //the DS2438 will output �1� in TB = Temperature Busy Flag bit as
-        //long as it is busy making a temperature measurement;
-        //it will return a �0� when the conversion is complete
-        return (page_data[0] & (0x01 << 4));
+        *seconds = DS2438_GetUint32(&page_data[0]);
     }
-    return DS2438_DEV_NOT_FOUND;
+    return result;
 }
 
-uint8_t DS2438_GetTemperatureData(float* temperature)
+uint8_t DS2438_GetEndOfChargeTimestamp(ds2438_t* dev, uint32_t* seconds)
 {
+    // Read byte 4-7 of page 2 - end of charge timestamp
+    uint8_t page_data[9];
+    uint8_t result = DS2438_ReadPage(dev, 0x02, page_data);
+    if (result == DS2438_OP_SUCCESS)
+    {
+        *seconds = DS2438_GetUint32(&page_data[4]);
+    }
+    return result;
+}
+
+// Add the CPU cycles since the last call to the 64-bit cycle count
+static void DS2438_UpdateCycles(ds2438_t* dev)
+{
+    uint32_t cyc = ds2438_hal_cycles();
+    uint32_t delta = cyc - dev->tb_cyc_last;//unsigned difference handles the wrap
+    dev->tb_cyc_last = cyc;
+    dev->tb_cycles += delta;
+    dev->tb_drift_cycles += delta;
+}
+
+// Start the timebase and the drift interval at the ETM value etm
+static void DS2438_AnchorTimebase(ds2438_t* dev, uint32_t etm)
+{
+    dev->tb_cyc_last = ds2438_hal_cycles();
+    dev->tb_cycles = 0;
+    dev->tb_drift_cycles = 0;
+    dev->tb_ref_us = (uint64_t)etm * 1000000;
+    dev->tb_drift_etm = etm;
+}
+
+uint8_t DS2438_InitTimebase(ds2438_t* dev)
+{
+    uint32_t etm;
+    ds2438_hal_cycles_init();
+
+    DS2438_TRY(DS2438_GetETM(dev, &etm));
+    DS2438_AnchorTimebase(dev, etm);
+    dev->tb_cycles_per_s = ds2438_hal_cycles_per_s();//nominal rate until the first drift estimate
+    dev->tb_valid = 1;
+    return DS2438_OP_SUCCESS;
+}
+
+uint8_t DS2438_SyncTimebase(ds2438_t* dev)
+{
+    uint32_t etm;
+    if (!dev->tb_valid)
+        return DS2438_InitTimebase(dev);
+    DS2438_TRY(DS2438_GetETM(dev, &etm));
+    DS2438_UpdateCycles(dev);
+
+    //the ETM went back (DS2438_SetETM, DS2438_CompensateETM): start again from it,
+    //the measured rate is still valid
+    int32_t interval = (int32_t)(etm - dev->tb_drift_etm);
+    if (interval < 0)
+    {
+        DS2438_AnchorTimebase(dev, etm);
+        return DS2438_OP_SUCCESS;
+    }
+
+    //whole seconds go into the reference, so tb_cycles * 1000000 cannot overflow
+    //and a new rate only applies to the time since this sync
+    uint64_t seconds = dev->tb_cycles / dev->tb_cycles_per_s;
+    dev->tb_ref_us += seconds * 1000000;
+    dev->tb_cycles -= seconds * dev->tb_cycles_per_s;
+
+    //re-estimate the CPU clock against the ETM; the interval has to be
+    //long enough that the 1 s resolution of the ETM does not matter
+    if (interval >= DS2438_TIMEBASE_MIN_DRIFT_INTERVAL)
+    {
+        uint32_t rate = (uint32_t)(dev->tb_drift_cycles / (uint32_t)interval);
+        uint32_t nominal = ds2438_hal_cycles_per_s();
+        //a rate far from the nominal one means the ETM jumped forward, keep the old one
+        if (rate > nominal - nominal / DS2438_TIMEBASE_MAX_RATE_ERROR &&
+            rate < nominal + nominal / DS2438_TIMEBASE_MAX_RATE_ERROR)
+            dev->tb_cycles_per_s = rate;
+        dev->tb_drift_etm = etm;
+        dev->tb_drift_cycles = 0;
+    }
+
+    //the ETM has only whole seconds: move the reference forward when the ETM is ahead,
+    //back only when the estimate is ahead by more than that
+    uint64_t etm_us = (uint64_t)etm * 1000000;
+    uint64_t now_us = DS2438_GetTimestamp_us(dev);
+    if (etm_us > now_us || now_us - etm_us > DS2438_TIMEBASE_MAX_AHEAD_US)
+    {
+        dev->tb_ref_us = etm_us;
+        dev->tb_cycles = 0;
+    }
+    return DS2438_OP_SUCCESS;
+}
+
+uint64_t DS2438_GetTimestamp_us(ds2438_t* dev)
+{
+    if (!dev->tb_valid)
+        return 0;
+    DS2438_UpdateCycles(dev);
+    return dev->tb_ref_us + (dev->tb_cycles * 1000000) / dev->tb_cycles_per_s;
+}
+
+uint8_t DS2438_ReadSnapshot(ds2438_t* dev, ds2438_snapshot_t* snapshot)
+{
+    DS2438_TRY(DS2438_ReadTemperature(dev, &snapshot->temperature));
+    snapshot->temperature_us = DS2438_GetTimestamp_us(dev);
+    DS2438_TRY(DS2438_ReadVoltage(dev, &snapshot->voltage));
+    snapshot->voltage_us = DS2438_GetTimestamp_us(dev);
+    DS2438_TRY(DS2438_GetCurrentData(dev, &snapshot->current));
+    snapshot->current_us = DS2438_GetTimestamp_us(dev);
+    DS2438_TRY(DS2438_GetICA(dev, &snapshot->ica));
+    snapshot->ica_us = DS2438_GetTimestamp_us(dev);
+    return DS2438_OP_SUCCESS;
+}
+
+// Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1), LSB first
+static uint8_t DS2438_Crc8(uint8_t* data, uint8_t length)
+{
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        uint8_t byte = data[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            uint8_t mix = (crc ^ byte) & 0x01;
+            crc >>= 1;
+            if (mix)
+                crc ^= 0x8C;
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+// Add the time since start_cycles to the latency histogram of an API
+static void DS2438_RecordLatency(ds2438_t* dev, uint8_t api, uint32_t start_cycles)
+{
+    uint32_t us = (ds2438_hal_cycles() - start_cycles) / (ds2438_hal_cycles_per_s() / 1000000);
+    ds2438_latency_t* latency = &dev->stats.latency[api];
+    uint8_t bucket = 0;
+    while (bucket < DS2438_LATENCY_BUCKETS - 1 && (us >> (bucket + 1)))
+        bucket++;
+    latency->calls++;
+    latency->buckets[bucket]++;
+    if (us > latency->max_us)
+        latency->max_us = us;
+}
+
+// One bus transaction, repeated by DS2438_Transact()
+typedef uint8_t (*ds2438_transaction_t)(ds2438_t* dev, uint8_t arg, uint8_t* data);
+
+// Recall and read one page, check the CRC
+static uint8_t DS2438_ReadPageTransaction(ds2438_t* dev, uint8_t page_number, uint8_t* page_data)
+{
+    if (page_number > 0x07)//there are only pages from 0x00 to 0x07
+        return DS2438_BAD_PARAM;
+    DS2438_TRY(DS2438_Select(dev));// Reset sequence and ROM command
+    // Recall memory command
+    OneWire_WriteByte(dev->bus, DS2438_RECALL_MEMORY);
+    OneWire_WriteByte(dev->bus, page_number);//page number from which to recall memory
+    DS2438_TRY(DS2438_Select(dev));// Reset sequence and ROM command
+    // Read scratchpad command
+    OneWire_WriteByte(dev->bus, DS2438_READ_SCRATCHPAD);
+    //  which scratchpad page number to read from
+    OneWire_WriteByte(dev->bus, page_number);
     // Read nine bytes
+    for (uint8_t i = 0; i < 9; i++) //eight 8-byte pages, 9th byte contains a cyclic redundancy check (CRC) byte
+    {
+        page_data[i] = OneWire_ReadByte(dev->bus);
+    }
+    if (DS2438_Crc8(page_data, 8) != page_data[8])
+    {
+        DS2438_COUNT(dev->bus, crc_errors);
+        return DS2438_CRC_ERROR;
+    }
+    if (page_number == 0x00)
+        DS2438_CacheConfig(dev, page_data);
+    return DS2438_OP_SUCCESS;
+}
+
+// Write the scratchpad and copy it to the page
+static uint8_t DS2438_WritePageTransaction(ds2438_t* dev, uint8_t page_number, uint8_t * page_data)
+{
+    if (page_number > 0x07)//there are only pages 0x00 to 0x07
+        return DS2438_BAD_PARAM;
+    // Reset sequence and ROM command
+    DS2438_TRY(DS2438_Select(dev));
+    // Write scratchpad command
+    OneWire_WriteByte(dev->bus, DS2438_WRITE_SCRATCHPAD);
+    // Write page number followed by page data
+    OneWire_WriteByte(dev->bus, page_number);
+    for (uint8_t i = 0; i < 9; i++)
+    {
+        OneWire_WriteByte(dev->bus, page_data[i]);
+    }
+    DS2438_TRY(DS2438_Select(dev));
+    // Copy scratchpad command
+    OneWire_WriteByte(dev->bus, DS2438_COPY_SCRATCHPAD);
+    // Write page number
+    OneWire_WriteByte(dev->bus, page_number);
+    if (page_number == 0x00)
+        DS2438_CacheConfig(dev, page_data);
+    return DS2438_OP_SUCCESS;
+}
+
+// Address the device and send a function command without data
+static uint8_t DS2438_CommandTransaction(ds2438_t* dev, uint8_t command, uint8_t* unused)
+{
+    (void)unused;
+    // Reset sequence and ROM command
+    DS2438_TRY(DS2438_Select(dev));
+    OneWire_WriteByte(dev->bus, command);
+    return DS2438_OP_SUCCESS;
+}
+
+// Run a transaction with the retry policy of the device
+static uint8_t DS2438_Transact(ds2438_t* dev, ds2438_transaction_t transaction, uint8_t arg, uint8_t* data)
+{
+    uint8_t crc_retries = dev->retry.crc_retries;
+    uint8_t presence_retries = dev->retry.presence_retries;
+    uint32_t start;
+    uint8_t result;
+
+    //absent device: fail without bus traffic until the pause is over,
+    //the first call after it ends the pause for good
+    if (dev->backoff_active)
+    {
+        if (ds2438_hal_cycles() - dev->backoff_start < dev->backoff_ms * (ds2438_hal_cycles_per_s() / 1000))
+        {
+            DS2438_COUNT_DEV(dev, skipped);
+            return DS2438_DEV_NOT_FOUND;
+        }
+        dev->backoff_active = 0;
+    }
+    start = ds2438_hal_cycles();
+    while (1)
+    {
+        result = transaction(dev, arg, data);
+        //CRC errors and missing presence pulses are transient, repeat at once
+        if (result == DS2438_CRC_ERROR && crc_retries)
+            crc_retries--;
+        else if (result == DS2438_DEV_NOT_FOUND && presence_retries)
+            presence_retries--;
+        else
+            break;
+        DS2438_COUNT_DEV(dev, retries);
+    }
+    DS2438_ADD_DEV(dev, active_us, (ds2438_hal_cycles() - start) / (ds2438_hal_cycles_per_s() / 1000000));
+    if (result == DS2438_BAD_PARAM)
+        return result;
+    if (result != DS2438_OP_SUCCESS)
+        DS2438_COUNT_DEV(dev, failures);
+    if (result == DS2438_DEV_NOT_FOUND && dev->retry.backoff_min_ms)
+    {
+        //start the pause or double it
+        uint32_t pause = dev->backoff_ms ? 2 * (uint32_t)dev->backoff_ms : dev->retry.backoff_min_ms;
+        if (pause > dev->retry.backoff_max_ms)
+            pause = dev->retry.backoff_max_ms;
+        dev->backoff_ms = (uint16_t)pause;
+        dev->backoff_start = ds2438_hal_cycles();
+        dev->backoff_active = 1;
+    }
+    else if (result != DS2438_BUS_FAULT)
+    {
+        dev->backoff_ms = 0;//device answered
+    }
+    return result;
+}
+
+// Wait with the core asleep, count the time for the device and its bus
+static void DS2438_Sleep(ds2438_t* dev, uint32_t us)
+{
+    uint32_t slept = ds2438_hal_sleep_us(us);
+    DS2438_ADD_DEV(dev, sleep_us, slept);
+}
+
+// Read page 0 until the busy flag is cleared, at most DS2438_CONVERSION_TIMEOUT_MS.
+// Called right after the conversion command.
+static uint8_t DS2438_WaitConversion(ds2438_t* dev, uint8_t busy_flag)
+{
+    uint32_t start = ds2438_hal_cycles();
+    uint32_t timeout = DS2438_CONVERSION_TIMEOUT_MS * (ds2438_hal_cycles_per_s() / 1000);
+    //the device samples the flag at Recall Memory: reset, ROM command, recall command and page number
+    uint32_t lead_10us = DS2438_RESET_TIME_10US +
+                         8 * DS2438_SLOT_TIME_10US * (dev->rom[0] ? 3 + DS2438_ROM_SIZE : 3);
     uint8_t page_data[9];
-    if (DS2438_ReadPage(0x00, page_data))
-    {
-        //getting the 2 temperature REGISTER byte:
-        uint8_t temp_lsb = page_data[1];
-        uint8_t temp_msb = page_data[2];
-        //temperature positive?
-        if(!(temp_msb & 0x80)) {
-            //msb are whole numbers
-            *temperature = temp_msb;
-            //there is a 0.03125 LSb; bit the 3 LSBs are 0
-            *temperature += ((temp_lsb >> 3) * 0.03125);
+    //sleep until the first read sees the predicted end of the conversion
+    if (lead_10us < DS2438_CONV_TIME_10US)
+        DS2438_Sleep(dev, (DS2438_CONV_TIME_10US - lead_10us) * 10);
+    while (1)
+    {
+        //a read started after the timeout gets the last word
+        uint8_t expired = ds2438_hal_cycles() - start > timeout;
+        DS2438_TRY(DS2438_ReadPage(dev, 0x00, page_data));
+        if (!(page_data[0] & busy_flag))
+            return DS2438_OP_SUCCESS;
+        if (expired)
+        {
+            DS2438_COUNT_DEV(dev, timeouts);
+            return DS2438_TIMEOUT;
+        }
+    }
+}
+
+// Read one page of data, return page data
+uint8_t DS2438_ReadPage(ds2438_t* dev, uint8_t page_number, uint8_t* page_data)
+{
+    uint32_t start = ds2438_hal_cycles();
+    uint8_t result = DS2438_Transact(dev, DS2438_ReadPageTransaction, page_number, page_data);
+    DS2438_RecordLatency(dev, DS2438_API_READ_PAGE, start);
+    return result;
+}
+
+// Write one page of data
+// Write a page and return while the EEPROM is still being programmed
+static uint8_t DS2438_WritePageNoWait(ds2438_t* dev, uint8_t page_number, uint8_t * page_data)
+{
+    uint32_t start = ds2438_hal_cycles();
+    uint8_t result = DS2438_Transact(dev, DS2438_WritePageTransaction, page_number, page_data);
+    DS2438_RecordLatency(dev, DS2438_API_WRITE_PAGE, start);
+    return result;
+}
+
+uint8_t DS2438_WritePage(ds2438_t* dev, uint8_t page_number, uint8_t * page_data)
+{
+    uint8_t result = DS2438_WritePageNoWait(dev, page_number, page_data);
+    //the device ignores the bus until the copy to EEPROM is done
+    if (result == DS2438_OP_SUCCESS)
+        DS2438_Sleep(dev, DS2438_EEPROM_WRITE_TIME_10US * 10);
+    return result;
+}
+
+void OneWire_WriteByte(ds2438_bus_t* bus, int data)
+{
+    int bit;
+
+    DS2438_TRACE(DS2438_TRACE_WRITE, data);
+    // Loop to write each bit in the byte, LS-bit first
+    for (bit = 0; bit < 8; bit++)
+    {
+        OneWire_WriteBit(bus, data & 0x01);
+        // shift the data byte for the next bit
+        data >>= 1;
+    }
+    DS2438_COUNT(bus, bytes_written);
+
+}
+
+void OneWire_WriteBit(ds2438_bus_t* bus, int bit)
+{
+    DS2438_COUNT(bus, slots_written);
+    if (bit)
+    {
+        // Write '1' bit
+        ds2438_hal_pin_low(bus->line); // Drives DQ low
+        wait_10us(1); // Complete the Write 1 Low Time time
+        ds2438_hal_pin_release(bus->line); // Releases the bus
+        wait_10us(7); // Complete the Time Slot time and Recovery Time
+    }
+    else
+    {
+        // Write '0' bit
+        ds2438_hal_pin_low(bus->line); // Drives DQ low
+        wait_10us(7); // Complete the Write 0 Low Time and Time Slot time
+        ds2438_hal_pin_release(bus->line); // Releases the bus
+        wait_10us(1);// Complete the Recovery Time
+    }
+}
+
+int OneWire_ReadByte(ds2438_bus_t* bus)
+{
+    int bit, result=0;
+    for (bit = 0; bit < 8; bit++)
+    {
+        // shift the result to get it ready for the next bit
+        result >>= 1;
+        // if result is one, then set MS bit (first set Bit gets shifted to LSB)
+        if (OneWire_ReadBit(bus))
+            result |= 0x80;
+    }
+    DS2438_COUNT(bus, bytes_read);
+    DS2438_TRACE(DS2438_TRACE_READ, result);
+    return result;
+}
+
+int OneWire_ReadBit(ds2438_bus_t* bus)
+{
+    int result;
+    DS2438_COUNT(bus, slots_read);
+    ds2438_hal_pin_low(bus->line); // Drives DQ low
+    wait_us(7); // Complete the Read Low Time
+    ds2438_hal_pin_release(bus->line); // Releases the bus
+    wait_us(10);//get to sampling window
+    result = ds2438_hal_pin_read(bus->line);// Sample the bit value from the slave
+    wait_10us(6); // Complete the Time Slot time and Recovery Time
+    return result;
+}
+
+uint8_t OneWire_ReadRom(ds2438_bus_t* bus, uint8_t* rom)
+{
+    bus->device = 0;//not a transfer of a known device
+    DS2438_TRY(OneWire_Reset(bus));
+    //only works with a single device, all would answer at once
+    OneWire_WriteByte(bus, DS2438_READ_ROM);
+    for (uint8_t i = 0; i < DS2438_ROM_SIZE; i++)
+    {
+        rom[i] = OneWire_ReadByte(bus);
+    }
+    if (DS2438_Crc8(rom, DS2438_ROM_SIZE - 1) != rom[DS2438_ROM_SIZE - 1])
+    {
+        DS2438_COUNT(bus, crc_errors);
+        return DS2438_CRC_ERROR;
+    }
+    return DS2438_OP_SUCCESS;
+}
+
+void OneWire_SearchReset(ds2438_bus_t* bus)
+{
+    bus->search_last_discrepancy = 0;
+    bus->search_done = 0;
+}
+
+uint8_t OneWire_SearchNext(ds2438_bus_t* bus, uint8_t* rom)
+{
+    uint8_t last_zero = 0;//last bit where both values were seen and 0 was taken
+    bus->device = 0;
+    if (bus->search_done)
+        return DS2438_DEV_NOT_FOUND;
+    uint8_t result = OneWire_Reset(bus);
+    if (result != DS2438_OP_SUCCESS)
+    {
+        OneWire_SearchReset(bus);
+        return result;
+    }
+    OneWire_WriteByte(bus, DS2438_SEARCH_ROM);
+    for (uint8_t bit = 1; bit <= 64; bit++)
+    {
+        uint8_t* byte = &bus->search_rom[(bit - 1) >> 3];
+        uint8_t mask = 1 << ((bit - 1) & 0x07);
+        //every device sends its ROM bit, then the complement (wired AND)
+        int id_bit = OneWire_ReadBit(bus);
+        int cmp_bit = OneWire_ReadBit(bus);
+        int direction;
+        if (id_bit && cmp_bit)//no device left
+        {
+            OneWire_SearchReset(bus);
+            return DS2438_DEV_NOT_FOUND;
         }
-        //temperature negative?
+        if (id_bit != cmp_bit)//all devices agree
+            direction = id_bit;
         else
         {
-            //msb are whole numbers
-            *temperature = temp_msb;
-            //there is a 0.03125 LSb; bit the 3 LSBs are 0
-            *temperature += ((temp_lsb >> 3) * 0.03125);
-            *temperature *= -1;
+            //devices with 0 and 1: repeat the path of the last search before
+            //the last discrepancy, take 1 at it and 0 after it
+            if (bit < bus->search_last_discrepancy)
+                direction = (*byte & mask) != 0;
+            else
+                direction = (bit == bus->search_last_discrepancy);
+            if (!direction)
+                last_zero = bit;
         }
+        if (direction)
+            *byte |= mask;
+        else
+            *byte &= ~mask;
+        //devices with the other bit value leave the search
+        OneWire_WriteBit(bus, direction);
+    }
+    bus->search_last_discrepancy = last_zero;
+    bus->search_done = (last_zero == 0);
+    if (DS2438_Crc8(bus->search_rom, DS2438_ROM_SIZE - 1) != bus->search_rom[DS2438_ROM_SIZE - 1])
+    {
+        DS2438_COUNT(bus, crc_errors);
+        OneWire_SearchReset(bus);
+        return DS2438_CRC_ERROR;
+    }
+    for (uint8_t i = 0; i < DS2438_ROM_SIZE; i++)
+    {
+        rom[i] = bus->search_rom[i];
+    }
+    return DS2438_OP_SUCCESS;
+}
+
+uint8_t DS2438_StartVoltageConversion(ds2438_t* dev)
+{
+    // Write start voltage conversion command
+    return DS2438_Transact(dev, DS2438_CommandTransaction, DS2438_VOLTAGE_CONV, 0);
+}
+
+uint8_t DS2438_ReadVoltage(ds2438_t* dev, float* voltage)
+{
+    uint32_t start = ds2438_hal_cycles();
+    //start voltage conversion
+    uint8_t result = DS2438_StartVoltageConversion(dev);
+    if (result == DS2438_OP_SUCCESS)
+        result = DS2438_WaitConversion(dev, DS2438_CONFIG_ADB);//wait until conversion is complete
+    if (result == DS2438_OP_SUCCESS)
+        result = DS2438_GetVoltageData(dev, voltage);//get voltage
+    DS2438_RecordLatency(dev, DS2438_API_READ_VOLTAGE, start);
+    return result;
+}
+
+uint8_t DS2438_HasVoltageData(ds2438_t* dev, uint8_t* busy)
+{
+    uint8_t page_data[9];
+    DS2438_TRY(DS2438_ReadPage(dev, 0x00, page_data));
+    //the DS2438 will output �1� in the ADB = A/D Converter Busy Flag as
+    //long as it is busy making a voltage measurement;
+    //it will return a �0� when the conversion is complete
+    *busy = (page_data[0] & DS2438_CONFIG_ADB) != 0;
+    return DS2438_OP_SUCCESS;
+}
+
+// Decode the voltage register from page 0 data
+static float DS2438_DecodeVoltage(ds2438_t* dev, const uint8_t* page_data)
+{
+    //getting the 2  REGISTER byte:
+    uint8_t volt_lsb = page_data[3];
+    uint8_t volt_msb = page_data[4];
+    //volt_msb only has 2 valid bits, rest is 0
+    //moving the msb by 8 bits so the result is MSB+LSB
+    //divide by 100 because the unit = 10 mV
+    //resulting  is in V
+    return (((volt_msb & 0x3) << 8) | (volt_lsb)) / 100.0 * dev->calibration.voltage_gain;
+}
+
+uint8_t DS2438_GetVoltageData(ds2438_t* dev, float* mV_)
+{
+    uint8_t page_data[9];
+    uint8_t result = DS2438_ReadPage(dev, 0x00, page_data);
+    if (result == DS2438_OP_SUCCESS)
+        *mV_ = DS2438_DecodeVoltage(dev, page_data);
+    return result;
+}
+
+// Decode the current register from page 0 data
+static int16_t DS2438_DecodeCurrentRaw(const uint8_t* page_data)
+{
+    //getting the 2 Current REGISTER byte:
+    uint8_t curr_lsb = page_data[5];
+    uint8_t curr_msb = page_data[6];
+    //the current register is a two's complement value, the upper
+    //6 bits of curr_msb are the sign extension of the 10 data bits.
+    //A negative value means discharge
+    return (int16_t)((curr_msb << 8) | curr_lsb);
+}
+
+// Get raw content of the current register
+uint8_t DS2438_GetCurrentRaw(ds2438_t* dev, int16_t* raw_current)
+{
+    uint8_t page_data[9];
+    uint8_t result = DS2438_ReadPage(dev, 0x00, page_data);
+    if (result == DS2438_OP_SUCCESS)
+    {
+        *raw_current = DS2438_DecodeCurrentRaw(page_data);
+    }
+    return result;
+}
+
+// Get current data in float format
+float DS2438_DecodeCurrent(ds2438_t* dev, const uint8_t* page_data)
+{
+    int16_t data = DS2438_DecodeCurrentRaw(page_data);
+    //apply the same threshold the DS2438 uses for the accumulators,
+    //TH2/TH1 in byte 7 select +-2, +-4 or +-8 LSB
+    uint8_t threshold = (page_data[7] >> 6) & 0x03;
+    if (threshold != DS2438_THRESHOLD_NONE)
+    {
+        int16_t limit = 1 << threshold;
+        if (data > -limit && data < limit)
+            data = 0;
+    }
+    return ((data) / (4.096*dev->sense_resistor)) * dev->calibration.current_gain;
+}
+
+uint8_t DS2438_GetCurrentData(ds2438_t* dev, float* mA_current)
+{
+    uint8_t page_data[9];
+    uint8_t result = DS2438_ReadPage(dev, 0x00, page_data);
+    if (result == DS2438_OP_SUCCESS)
+        *mA_current = DS2438_DecodeCurrent(dev, page_data);
+    return result;
+}
+
+uint8_t DS2438_GetCurrentThreshold(ds2438_t* dev, uint8_t* threshold)
+{
+    // Read byte 7 of page 0 - threshold register
+    uint8_t page_data[9];
+    uint8_t result = DS2438_ReadPage(dev, 0x00, page_data);
+    if (result == DS2438_OP_SUCCESS)
+    {
+        *threshold = (page_data[7] >> 6) & 0x03;
+    }
+    return result;
+}
+
+uint8_t DS2438_SetCurrentThreshold(ds2438_t* dev, uint8_t threshold)
+{
+    if (threshold > DS2438_THRESHOLD_8LSB)
+        return DS2438_BAD_PARAM;
+    uint8_t result = DS2438_LoadConfig(dev);
+    if (result == DS2438_OP_SUCCESS)
+    {
+        // set bit 7 and 6 - TH2 and TH1
+        return DS2438_WriteConfig(dev, dev->config, (dev->threshold & 0x3F) | (threshold << 6));
+    }
+    return result;
+}
+
+// Write the offset register in page 1, IAD has to be off while doing so;
+// the value it held is stored in old_offset unless that is 0
+static uint8_t DS2438_WriteOffsetRegister(ds2438_t* dev, int16_t offset, int16_t* old_offset)
+{
+    uint8_t config_data[9];
+    uint8_t page_data[9];
+    DS2438_TRY(DS2438_ReadPage(dev, 0x00, config_data));
+    //the offset register can only be written while IAD = 0
+    config_data[0] &= ~0x01;
+    DS2438_TRY(DS2438_WritePage(dev, 0x00, config_data));
+
+    DS2438_TRY(DS2438_ReadPage(dev, 0x01, page_data));
+    if (old_offset)
+        *old_offset = (int16_t)((page_data[6] << 8) | page_data[5]) >> 3;
+    //the offset register holds the value shifted left by 3 bits,
+    //bits 0-2 of the LSB are unused
+    uint16_t reg = (uint16_t)offset << 3;
+    page_data[5] = (uint8_t)reg;
+    page_data[6] = (uint8_t)(reg >> 8);
+    return DS2438_WritePage(dev, 0x01, page_data);
+}
+
+uint8_t DS2438_GetCurrentOffset(ds2438_t* dev, int16_t* offset)
+{
+    uint8_t page_data[9];
+    uint8_t result = DS2438_ReadPage(dev, 0x01, page_data);
+    if (result == DS2438_OP_SUCCESS)
+    {
+        //arithmetic shift keeps the sign of the two's complement value
+        *offset = (int16_t)((page_data[6] << 8) | page_data[5]) >> 3;
+    }
+    return result;
+}
+
+uint8_t DS2438_SetCurrentOffset(ds2438_t* dev, int16_t offset)
+{
+    uint8_t config_data[9];
+    //remember the configuration to restore IAD afterwards
+    DS2438_TRY(DS2438_ReadPage(dev, 0x00, config_data));
+    DS2438_TRY(DS2438_WriteOffsetRegister(dev, offset, 0));
+    return DS2438_WritePage(dev, 0x00, config_data);
+}
+
+uint8_t DS2438_CalibrateCurrentOffset(ds2438_t* dev, uint8_t samples)
+{
+    uint8_t config_data[9];
+    int32_t sum = 0;
+    int16_t raw = 0;
+    int16_t old_offset = INT16_MIN;//not read yet, the register has 13 bits
+
+    if (samples == 0)
+        return DS2438_BAD_PARAM;
+    DS2438_TRY(DS2438_ReadPage(dev, 0x00, config_data));
+    //clear the old offset, otherwise it would be measured as well
+    uint8_t result = DS2438_WriteOffsetRegister(dev, 0, &old_offset);
+    if (result == DS2438_OP_SUCCESS)
+        result = DS2438_EnableIAD(dev);
+
+    for (uint8_t i = 0; i < samples && result == DS2438_OP_SUCCESS; i++)
+    {
+        //wait for a new current conversion (36.41 Hz)
+        DS2438_Sleep(dev, DS2438_CURRENT_CONV_TIME_10US * 10);
+        result = DS2438_GetCurrentRaw(dev, &raw);
+        sum += raw;
+    }
+
+    if (result == DS2438_OP_SUCCESS)
+    {
+        //the offset register is added to every measurement,
+        //so the two's complement of the average cancels the offset
+        int16_t average = (int16_t)((sum >= 0 ? sum + samples / 2 : sum - samples / 2) / samples);
+        result = DS2438_WriteOffsetRegister(dev, -average, 0);
+    }
+    if (result != DS2438_OP_SUCCESS && old_offset != INT16_MIN)
+    {
+        //calibration failed, put the old offset back
+        DS2438_WriteOffsetRegister(dev, old_offset, 0);
+    }
+    //restore the original configuration (IAD, CA, AD)
+    uint8_t restored = DS2438_WritePage(dev, 0x00, config_data);
+    return result != DS2438_OP_SUCCESS ? result : restored;
+}
+
+uint8_t DS2438_SelectInputSource(ds2438_t* dev, uint8_t input_source)
+{
+    uint8_t config;
+    // configuration of page 0
+    DS2438_TRY(DS2438_LoadConfig(dev));
+    // set bit based on input source in first byte of page 0
+    if (input_source == DS2438_INPUT_VOLTAGE_VDD)
+    {
+        // set bit
+        config = dev->config | (0x08);
+    }
+    else if (input_source == DS2438_INPUT_VOLTAGE_VAD)
+    {
+        // clear bit
+        config = dev->config & (0xF7);
+    }
+    else
+    {
+        return DS2438_BAD_PARAM;
+    }
+    // write page 0
+    return DS2438_WriteConfig(dev, config, dev->threshold);
+}
+
+uint8_t DS2438_ReadTemperature(ds2438_t* dev, float* temperature)
+{
+    uint32_t start = ds2438_hal_cycles();
+    //start temperature conversion
+    uint8_t result = DS2438_StartTemperatureConversion(dev);
+    if (result == DS2438_OP_SUCCESS)
+        result = DS2438_WaitConversion(dev, DS2438_CONFIG_TB);//wait until conversion is complete
+    if (result == DS2438_OP_SUCCESS)
+        result = DS2438_GetTemperatureData(dev, temperature);//get temperature
+    DS2438_RecordLatency(dev, DS2438_API_READ_TEMPERATURE, start);
+    return result;
+}
+
+uint8_t DS2438_StartTemperatureConversion(ds2438_t* dev)
+{
+    // Issue temperature conversion command
+    return DS2438_Transact(dev, DS2438_CommandTransaction, DS2438_TEMP_CONV, 0);
+}
+
+
+uint8_t DS2438_HasTemperatureData(ds2438_t* dev, uint8_t* busy)
+{
+    uint8_t page_data[9];
+    DS2438_TRY(DS2438_ReadPage(dev, 0x00, page_data));
+    //the DS2438 will output �1� in TB = Temperature Busy Flag bit as
+    //long as it is busy making a temperature measurement;
+    //it will return a �0� when the conversion is complete
+    *busy = (page_data[0] & DS2438_CONFIG_TB) != 0;
+    return DS2438_OP_SUCCESS;
+}
+
+// Decode the temperature register from page 0 data
+static float DS2438_DecodeTemperature(ds2438_t* dev, const uint8_t* page_data)
+{
+    //getting the 2 temperature REGISTER byte:
+    uint8_t temp_lsb = page_data[1];
+    uint8_t temp_msb = page_data[2];
+    //the temperature register is a two's complement value, the 3 LSBs
+    //are 0, so one LSB after shifting is 0.03125 C
+    int16_t data = (int16_t)((temp_msb << 8) | temp_lsb) >> 3;
+    return data * 0.03125 + dev->calibration.temperature_offset;
+}
+
+uint8_t DS2438_GetTemperatureData(ds2438_t* dev, float* temperature)
+{
+    // Read nine bytes
+    uint8_t page_data[9];
+    uint8_t result = DS2438_ReadPage(dev, 0x00, page_data);
+    if (result == DS2438_OP_SUCCESS)
+        *temperature = DS2438_DecodeTemperature(dev, page_data);
+    return result;
+}
+
+// Put a request into the async queue
+static uint8_t DS2438_Enqueue(ds2438_t* dev, uint8_t type, uint8_t page_number, const uint8_t* page_data,
+                              ds2438_callback_t callback, void* context)
+{
+    uint8_t result = DS2438_BUSY;
+    //requests may come from the main loop and from interrupts
+    uint32_t irq_state = ds2438_hal_irq_disable();
+    uint8_t next = (async_head + 1) % DS2438_ASYNC_QUEUE_SIZE;
+    if (next != async_tail)//queue not full
+    {
+        ds2438_request_t* request = &async_queue[async_head];
+        request->dev = dev;
+        request->type = type;
+        request->callback = callback;
+        request->context = context;
+        request->result.page_number = page_number;
+        request->result.value = 0;
+        for (uint8_t i = 0; i < 9; i++)
+        {
+            request->result.page_data[i] = page_data ? page_data[i] : 0;
+        }
+        async_head = next;
+        result = DS2438_OP_SUCCESS;
+    }
+    ds2438_hal_irq_enable(irq_state);
+    return result;
+}
+
+uint8_t DS2438_ReadPageAsync(ds2438_t* dev, uint8_t page_number, ds2438_callback_t callback, void* context)
+{
+    if (page_number > 0x07)//there are only pages from 0x00 to 0x07
+        return DS2438_BAD_PARAM;
+    return DS2438_Enqueue(dev, DS2438_ASYNC_READ_PAGE, page_number, 0, callback, context);
+}
+
+uint8_t DS2438_WritePageAsync(ds2438_t* dev, uint8_t page_number, const uint8_t* page_data, ds2438_callback_t callback, void* context)
+{
+    if (page_number > 0x07)//there are only pages 0x00 to 0x07
+        return DS2438_BAD_PARAM;
+    return DS2438_Enqueue(dev, DS2438_ASYNC_WRITE_PAGE, page_number, page_data, callback, context);
+}
+
+uint8_t DS2438_ReadVoltageAsync(ds2438_t* dev, ds2438_callback_t callback, void* context)
+{
+    return DS2438_Enqueue(dev, DS2438_ASYNC_READ_VOLTAGE, 0x00, 0, callback, context);
+}
+
+uint8_t DS2438_ReadTemperatureAsync(ds2438_t* dev, ds2438_callback_t callback, void* context)
+{
+    return DS2438_Enqueue(dev, DS2438_ASYNC_READ_TEMPERATURE, 0x00, 0, callback, context);
+}
+
+// Continue the request being served after a pause of us microseconds
+static uint8_t DS2438_AsyncWait(uint8_t step, uint32_t us)
+{
+    async_step = step;
+    async_next = ds2438_hal_cycles() + us * (ds2438_hal_cycles_per_s() / 1000000);
+    return DS2438_IN_PROGRESS;
+}
+
+// Advance the request being served by at most one transaction
+static uint8_t DS2438_AsyncStep(ds2438_request_t* request)
+{
+    ds2438_t* dev = request->dev;
+    ds2438_async_result_t* result = &request->result;
+
+    if (async_step != DS2438_STEP_START && (int32_t)(ds2438_hal_cycles() - async_next) < 0)
+        return DS2438_IN_PROGRESS;//still waiting, the bus is free
+    switch (request->type)
+    {
+    case DS2438_ASYNC_READ_PAGE:
+        return DS2438_ReadPage(dev, result->page_number, result->page_data);
+    case DS2438_ASYNC_WRITE_PAGE:
+        if (async_step == DS2438_STEP_PROGRAM)
+            return DS2438_OP_SUCCESS;
+        DS2438_TRY(DS2438_WritePageNoWait(dev, result->page_number, result->page_data));
+        return DS2438_AsyncWait(DS2438_STEP_PROGRAM, DS2438_EEPROM_WRITE_TIME_10US * 10);
+    default:
+    {
+        uint8_t voltage = request->type == DS2438_ASYNC_READ_VOLTAGE;
+        if (async_step == DS2438_STEP_START)
+        {
+            DS2438_TRY(voltage ? DS2438_StartVoltageConversion(dev) : DS2438_StartTemperatureConversion(dev));
+            async_started = ds2438_hal_cycles();
+            return DS2438_AsyncWait(DS2438_STEP_CONVERT, DS2438_ASYNC_POLL_MS * 1000);
+        }
+        //a read started after the timeout gets the last word
+        uint8_t expired = ds2438_hal_cycles() - async_started > DS2438_CONVERSION_TIMEOUT_MS * (ds2438_hal_cycles_per_s() / 1000);
+        DS2438_TRY(DS2438_ReadPage(dev, 0x00, result->page_data));
+        if (result->page_data[0] & (voltage ? DS2438_CONFIG_ADB : DS2438_CONFIG_TB))
+        {
+            if (!expired)
+                return DS2438_AsyncWait(DS2438_STEP_CONVERT, DS2438_ASYNC_POLL_MS * 1000);
+            DS2438_COUNT_DEV(dev, timeouts);
+            return DS2438_TIMEOUT;
+        }
+        //page 0 holds the result already
+        result->value = voltage ? DS2438_DecodeVoltage(dev, result->page_data) : DS2438_DecodeTemperature(dev, result->page_data);
         return DS2438_OP_SUCCESS;
     }
-        return DS2438_ERROR;
+    }
 }
 
+uint8_t DS2438_Poll(void)
+{
+    //a Poll from an interrupt must not disturb the running one
+    if (!async_polling)
+    {
+        async_polling = 1;
+        if (async_tail != async_head)
+        {
+            uint8_t status = DS2438_AsyncStep(&async_queue[async_tail]);
+            if (status != DS2438_IN_PROGRESS)
+            {
+                //free the slot first, so the callback can queue the next request
+                ds2438_request_t request = async_queue[async_tail];
+                async_step = DS2438_STEP_START;
+                async_tail = (async_tail + 1) % DS2438_ASYNC_QUEUE_SIZE;
+                if (request.callback)
+                    request.callback(request.dev, status, &request.result, request.context);
+            }
+        }
+        async_polling = 0;
+    }
+    return (async_head + DS2438_ASYNC_QUEUE_SIZE - async_tail) % DS2438_ASYNC_QUEUE_SIZE;
+}
 
 
 
 
 
-void uart1_init(void)
+int32_t uart1_init(uint32_t baudrate)
 {
-    RCC->APB2ENR |= 0x4; //GPIOA mit einem Takt versorgen
+    ds2438_hal_cycles_init();//for the transmit timeouts
+    return ds2438_hal_uart_init(baudrate);
+}
 
-    GPIOA->CRH &= 0xFFFFFF0F;     // reset  PA.9 configuration-bits
-    GPIOA->CRH |= 0xB0;           //Tx (PA9) - alt. out push-pull
+// 1 once UART_TX_TIMEOUT_MS passed since start_cycles
+static uint8_t uart_timed_out(uint32_t start_cycles)
+{
+    return ds2438_hal_cycles() - start_cycles > UART_TX_TIMEOUT_MS * (ds2438_hal_cycles_per_s() / 1000);
+}
 
-    GPIOA->CRH &= 0xFFFFF0FF;     //reset PA.10 configuration-bits
-    GPIOA->CRH |= 0x400;          //Rx (PA10) - floating
+// Start a transfer of the contiguous part of the ring buffer, must be
+// called with interrupts disabled or from uart_tx_complete()
+static void uart_start_dma(void)
+{
+    if (uart_tx_dma_len || uart_tx_head == uart_tx_tail)//busy or nothing to send
+        return;
+    //send up to the end of the buffer, the rest follows in the next transfer
+    if (uart_tx_head > uart_tx_tail)
+        uart_tx_dma_len = uart_tx_head - uart_tx_tail;
+    else
+        uart_tx_dma_len = UART_TX_BUFFER_SIZE - uart_tx_tail;
+    ds2438_hal_uart_start_tx(&uart_tx_buffer[uart_tx_tail], uart_tx_dma_len);
+}
 
-    RCC->APB2ENR |= 0x4000;       //USART1 mit einem Takt versrogen
+void uart_tx_complete(void)
+{
+    //release the sent bytes and continue with the rest
+    uart_tx_tail = (uart_tx_tail + uart_tx_dma_len) % UART_TX_BUFFER_SIZE;
+    uart_tx_dma_len = 0;
+    uart_start_dma();
+}
 
-    USART1->CR1 &= ~0x1000;       // M: Word length:0 --> Start bit, 8 Data bits, n Stop bit
-    USART1->CR1 &= ~0x0400;       // PCE (Parity control enable):0 --> No Parity
+void uart_set_overflow_mode(uint8_t mode)
+{
+    uart_tx_overflow_mode = mode;
+}
 
-    USART1->CR2 &= ~0x3000;       // STOP:00 --> 1 Stop bit
+uint32_t uart_get_dropped_bytes(void)
+{
+    return uart_tx_dropped;
+}
 
-    USART1->BRR  = 0x1D4C;        // set Baudrate to 9600 Baud (SysClk 72Mhz)
+void uart_flush(void)
+{
+    uint32_t start = ds2438_hal_cycles();
+    while (uart_tx_head != uart_tx_tail && !uart_timed_out(start)); //warten, bis der Puffer leer ist
+    while (!ds2438_hal_uart_tx_idle() && !uart_timed_out(start)); //warten, bis das letzte Zeichen gesendet wurde
+}
 
-    USART1->CR1 |= 0x0C;          // enable  Receiver and Transmitter
-    USART1->CR1 |= 0x2000;        // Set USART Enable Bit
+// Put one char into the ring buffer without starting the DMA
+static void uart_enqueue_char(char zeichen)
+{
+    uint16_t next = (uart_tx_head + 1) % UART_TX_BUFFER_SIZE;
+    if (next == uart_tx_tail)//buffer full?
+    {
+        if (uart_tx_overflow_mode == UART_OVERFLOW_DROP)
+        {
+            uart_tx_dropped++;
+            return;
+        }
+        //make sure the buffer is being drained, then wait for space
+        uint32_t irq_state = ds2438_hal_irq_disable();
+        uart_start_dma();
+        ds2438_hal_irq_enable(irq_state);
+        uint32_t start = ds2438_hal_cycles();
+        while (next == uart_tx_tail)
+        {
+            if (uart_timed_out(start))//transmitter stalled
+            {
+                uart_tx_dropped++;
+                return;
+            }
+        }
+    }
+    uart_tx_buffer[uart_tx_head] = zeichen;
+    uart_tx_head = next;
 }
 
+// Start sending what has been put into the buffer
+static void uart_kick(void)
+{
+    uint32_t irq_state = ds2438_hal_irq_disable();
+    uart_start_dma();
+    ds2438_hal_irq_enable(irq_state);
+}
 
+// Put a string into the buffer without starting the DMA
+static void uart_enqueue_string(char *string)
+{
+    while (*string)  {
+        uart_enqueue_char (*string++);
+    }
+}
 
+// Put an unsigned number with at least min_digits digits (leading zeros) into the buffer
+static void uart_enqueue_uint(uint64_t value, uint8_t min_digits)
+{
+    char digits[20];//2^64 has 20 decimal digits
+    uint8_t count = 0;
+    do
+    {
+        digits[count++] = '0' + (char)(value % 10);
+        value /= 10;
+    } while (value || count < min_digits);
+    while (count)
+    {
+        uart_enqueue_char(digits[--count]);
+    }
+}
 
+// Put a fixed point number into the buffer
+static void uart_enqueue_fixed(int64_t value, uint8_t decimals)
+{
+    uint64_t magnitude, scale = 1;
+    for (uint8_t i = 0; i < decimals; i++)
+    {
+        scale *= 10;
+    }
+    if (value < 0)
+    {
+        uart_enqueue_char('-');
+        magnitude = -(uint64_t)value;
+    }
+    else
+    {
+        magnitude = value;
+    }
+    uart_enqueue_uint(magnitude / scale, 1);
+    if (decimals)
+    {
+        uart_enqueue_char('.');
+        uart_enqueue_uint(magnitude % scale, decimals);
+    }
+}
 
 void uart_put_char(char zeichen)
 {
-    while (!(USART1->SR & 0x80)); //warten, bis die letzten Daten gesendet wurden
-    USART1->DR = zeichen;				//Daten in Senderegister schreiben
+    uart_enqueue_char(zeichen);
+    uart_kick();
 }
 
 void uart_put_string(char *string)
 {
-    while (*string)  {
-        uart_put_char (*string++);
-    }
+    uart_enqueue_string(string);
+    uart_kick();
 }
 
 void uart_put_string_newline(char *string)
 {
-    while (*string)  {
-        uart_put_char (*string++);
+    uart_enqueue_string(string);
+    uart_enqueue_char ('\r');
+    uart_enqueue_char ('\n');
+    uart_kick();
+}
+
+void uart_put_int(int32_t value)
+{
+    uart_enqueue_fixed(value, 0);
+    uart_kick();
+}
+
+void uart_put_fixed(int32_t value, uint8_t decimals)
+{
+    if (decimals > UART_MAX_DECIMALS)
+        decimals = UART_MAX_DECIMALS;
+    uart_enqueue_fixed(value, decimals);
+    uart_kick();
+}
+
+void uart_put_float(float value, uint8_t decimals)
+{
+    uint32_t scale = 1;
+    if (decimals > UART_MAX_DECIMALS)
+        decimals = UART_MAX_DECIMALS;
+    for (uint8_t i = 0; i < decimals; i++)
+    {
+        scale *= 10;
+    }
+    if (!isfinite(value))
+    {
+        uart_enqueue_string(isnan(value) ? "nan" : value < 0 ? "-inf" : "inf");
+        uart_kick();
+        return;
+    }
+    //the scaled value has to fit into int64_t
+    float limit = 9.2e18f / (float)scale;
+    if (value > limit)
+        value = limit;
+    else if (value < -limit)
+        value = -limit;
+    //single precision only (no FPU on the CM3): the integer part is exact,
+    //the fraction is scaled with one multiplication, 10^9 is exact as float
+    int64_t integer = (int64_t)value;
+    float fraction = (value - (float)integer) * (float)scale;
+    //round half away from zero, like printf
+    fraction += (fraction < 0) ? -0.5f : 0.5f;
+    uart_enqueue_fixed(integer * scale + (int32_t)fraction, decimals);
+    uart_kick();
+}
+
+void uart_put_hex8(uint8_t value)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    uart_enqueue_char(hex[value >> 4]);
+    uart_enqueue_char(hex[value & 0x0F]);
+    uart_kick();
+}
+
+//print the content/page data from a page
+void uart_put_page_content(uint8_t* page_data, uint8_t page_number)
+{
+    uart_enqueue_string("Page ");
+    uart_enqueue_uint(page_number, 1);
+    uart_enqueue_string(" content (MSB to LSB):");
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        uart_enqueue_char(' ');
+        uart_enqueue_uint(page_data[i], 1);
+    }
+    uart_enqueue_char('\r');
+    uart_enqueue_char('\n');
+    uart_kick();
+}
+
+// CRC-16/CCITT-FALSE (polynomial 0x1021, init 0xFFFF) of the frame payload
+static uint16_t telemetry_crc16(uint8_t* data, uint8_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Append the CRC, COBS encode the payload and put it into the buffer followed by 0x00
+static void uart_put_frame(uint8_t* payload, uint8_t length)
+{
+    uint16_t crc = telemetry_crc16(payload, length);
+    payload[length++] = (uint8_t)crc;
+    payload[length++] = (uint8_t)(crc >> 8);
+
+    //COBS: every 0x00 is replaced by the distance to the next 0x00,
+    //the payload is shorter than 254 bytes, so there is one block only
+    uint8_t start = 0;
+    for (uint8_t i = 0; i <= length; i++)
+    {
+        if (i == length || payload[i] == 0)
+        {
+            uart_enqueue_char((char)(i - start + 1));
+            for (uint8_t j = start; j < i; j++)
+            {
+                uart_enqueue_char((char)payload[j]);
+            }
+            start = i + 1;
+        }
+    }
+    uart_enqueue_char(0);//frame delimiter
+    uart_kick();
+}
+
+// Write little endian values into the frame payload
+static uint8_t telemetry_put(uint8_t* payload, uint8_t pos, uint64_t value, uint8_t size)
+{
+    for (uint8_t i = 0; i < size; i++)
+    {
+        payload[pos++] = (uint8_t)(value >> (8 * i));
+    }
+    return pos;
+}
+
+// Start a new payload with record type and sequence number
+static uint8_t telemetry_begin(uint8_t* payload, uint8_t type)
+{
+    payload[0] = type;
+    payload[1] = telemetry_sequence++;
+    return 2;
+}
+
+void uart_put_frame_snapshot(ds2438_snapshot_t* snapshot)
+{
+    uint8_t payload[TELEMETRY_SNAPSHOT_SIZE + 2];
+    uint8_t pos = telemetry_begin(payload, TELEMETRY_RECORD_SNAPSHOT);
+    //fixed point instead of float: 0.01 C, 10 mV, 1 uA
+    pos = telemetry_put(payload, pos, snapshot->temperature_us, 8);
+    pos = telemetry_put(payload, pos, (uint16_t)(int16_t)(snapshot->temperature * 100), 2);
+    pos = telemetry_put(payload, pos, (uint32_t)(snapshot->voltage_us - snapshot->temperature_us), 4);
+    pos = telemetry_put(payload, pos, (uint16_t)(snapshot->voltage * 100 + 0.5f), 2);
+    pos = telemetry_put(payload, pos, (uint32_t)(snapshot->current_us - snapshot->temperature_us), 4);
+    pos = telemetry_put(payload, pos, (uint32_t)(int32_t)(snapshot->current * 1000), 4);
+    pos = telemetry_put(payload, pos, (uint32_t)(snapshot->ica_us - snapshot->temperature_us), 4);
+    pos = telemetry_put(payload, pos, snapshot->ica, 1);
+    uart_put_frame(payload, pos);
+}
+
+void uart_put_frame_page(uint8_t* page_data, uint8_t page_number)
+{
+    uint8_t payload[TELEMETRY_PAGE_SIZE + 2];
+    uint8_t pos = telemetry_begin(payload, TELEMETRY_RECORD_PAGE);
+    payload[pos++] = page_number;
+    for (uint8_t i = 0; i < 9; i++)
+    {
+        payload[pos++] = page_data[i];
+    }
+    uart_put_frame(payload, pos);
+}
+
+void uart_put_frame_event(uint64_t timestamp_us, uint8_t code, uint32_t value)
+{
+    uint8_t payload[TELEMETRY_EVENT_SIZE + 2];
+    uint8_t pos = telemetry_begin(payload, TELEMETRY_RECORD_EVENT);
+    pos = telemetry_put(payload, pos, timestamp_us, 8);
+    payload[pos++] = code;
+    pos = telemetry_put(payload, pos, value, 4);
+    uart_put_frame(payload, pos);
+}
+
+void DS2438_GetStats(ds2438_t* dev, ds2438_stats_t* snapshot)
+{
+    *snapshot = dev->stats;
+}
+
+void DS2438_ResetStats(ds2438_t* dev)
+{
+    DS2438_Clear(&dev->stats, sizeof(dev->stats));
+}
+
+void DS2438_DumpStats(ds2438_t* dev)
+{
+    uart_enqueue_string("bus rst=");
+    uart_enqueue_uint(dev->stats.bus.resets, 1);
+    uart_enqueue_string(" nopres=");
+    uart_enqueue_uint(dev->stats.bus.presence_failures, 1);
+    uart_enqueue_string(" wr=");
+    uart_enqueue_uint(dev->stats.bus.bytes_written, 1);
+    uart_enqueue_string(" rd=");
+    uart_enqueue_uint(dev->stats.bus.bytes_read, 1);
+    uart_enqueue_string(" wslot=");
+    uart_enqueue_uint(dev->stats.bus.slots_written, 1);
+    uart_enqueue_string(" rslot=");
+    uart_enqueue_uint(dev->stats.bus.slots_read, 1);
+    uart_enqueue_string(" crc=");
+    uart_enqueue_uint(dev->stats.bus.crc_errors, 1);
+    uart_enqueue_string(" retry=");
+    uart_enqueue_uint(dev->stats.bus.retries, 1);
+    uart_enqueue_string(" fail=");
+    uart_enqueue_uint(dev->stats.bus.failures, 1);
+    uart_enqueue_string(" skip=");
+    uart_enqueue_uint(dev->stats.bus.skipped, 1);
+    uart_enqueue_string(" fault=");
+    uart_enqueue_uint(dev->stats.bus.bus_faults, 1);
+    uart_enqueue_string(" tmo=");
+    uart_enqueue_uint(dev->stats.bus.timeouts, 1);
+    uart_enqueue_string(" active=");
+    uart_enqueue_uint(dev->stats.bus.active_us / 1000, 1);
+    uart_enqueue_string(" sleep=");
+    uart_enqueue_uint(dev->stats.bus.sleep_us / 1000, 1);
+    uart_enqueue_string("\r\n");
+    for (uint8_t api = 0; api < DS2438_API_COUNT; api++)
+    {
+        ds2438_latency_t* latency = &dev->stats.latency[api];
+        uart_enqueue_string((char*)stats_api_names[api]);
+        uart_enqueue_string(" n=");
+        uart_enqueue_uint(latency->calls, 1);
+        uart_enqueue_string(" max=");
+        uart_enqueue_uint(latency->max_us, 1);
+        for (uint8_t bucket = 0; bucket < DS2438_LATENCY_BUCKETS; bucket++)
+        {
+            if (latency->buckets[bucket])
+            {
+                uart_enqueue_char(' ');
+                uart_enqueue_uint(bucket, 1);
+                uart_enqueue_char(':');
+                uart_enqueue_uint(latency->buckets[bucket], 1);
+            }
+        }
+        uart_enqueue_string("\r\n");
+    }
+    uart_kick();
+}
+
+void DS2438_TraceClear(void)
+{
+#if DS2438_TRACE_ENABLE
+    trace_count = 0;
+#endif
+}
+
+void DS2438_TraceDump(void)
+{
+#if DS2438_TRACE_ENABLE
+    uint8_t payload[3 + TELEMETRY_TRACE_MAX_ENTRIES * 6 + 2];//+2 for the CRC
+    uint16_t index = (trace_head - trace_count) & (DS2438_TRACE_SIZE - 1);
+    uint16_t left = trace_count;
+    while (left)
+    {
+        uint8_t count = left > TELEMETRY_TRACE_MAX_ENTRIES ? TELEMETRY_TRACE_MAX_ENTRIES : (uint8_t)left;
+        uint8_t pos = telemetry_begin(payload, TELEMETRY_RECORD_TRACE);
+        payload[pos++] = count;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            ds2438_trace_entry_t* entry = &trace_ring[index];
+            pos = telemetry_put(payload, pos, entry->cycles, 4);
+            payload[pos++] = entry->type;
+            payload[pos++] = entry->value;
+            index = (index + 1) & (DS2438_TRACE_SIZE - 1);
+        }
+        uart_put_frame(payload, pos);
+        left -= count;
     }
-    uart_put_char ('\r');
-    uart_put_char ('\n');
+#endif
 }
@@ -12,15 +12,12 @@
 
 #ifndef DS2438_H
 #define DS2438_H
-/*----------------------------- Define Pins for Onewire--------------*/
-#define GPIOA_IDR GPIOA_BASE + 2*sizeof(uint32_t)    // Calc peripheral address GPIOA IDR
-#define GPIOA_ODR GPIOA_BASE + 3*sizeof(uint32_t)   // Calc peripheral address GPIOA ODR
 
-// Calc Bit Band Adress from peripheral address: a = peripheral address b = Bit number
-#define BITBAND_PERI(a, b) ((PERIPH_BB_BASE + (a-PERIPH_BASE)*32 + (b*4)))
+#include <stdint.h>
 
-#define Onewire_Out  *((volatile unsigned long *)(BITBAND_PERI(GPIOA_ODR,0)))  // PA0; OneWire Leitung Out
-#define Onewire_In  *((volatile unsigned long *)(BITBAND_PERI(GPIOA_IDR,0)))  // PA0; OneWire Leitung In
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 // ===========================================================
 //                      VOLTAGE A/D INPUT SELECTION
@@ -36,30 +33,568 @@
 */
 #define DS2438_INPUT_VOLTAGE_VAD 1
 
+// ===========================================================
+//                      RETURN CODES
+// ===========================================================
+
+/**
+*   \brief Operation was successful
+*
+*   The functions returning uint8_t return one of these codes, except
+*   for the DS2438_Has...Data() functions.
+*
+*   API change: earlier versions returned 1 for success and 0 for a failure.
+*   Success is 0 now and 1 is not used, so a caller that still compares
+*   with 1 sees every call fail instead of taking an error for success.
+*   Compare with #DS2438_OP_SUCCESS, not with a number.
+*/
+#define DS2438_OP_SUCCESS       0
+
+/**
+*   \brief Device was not found on the 1-Wire interface (no presence pulse).
+*/
+#define DS2438_DEV_NOT_FOUND    2
+
+/**
+*   \brief Bad parameter error.
+*/
+#define DS2438_BAD_PARAM        3
+
+/**
+*   \brief Data read from the device had a wrong CRC.
+*/
+#define DS2438_CRC_ERROR        4
+
+/**
+*   \brief The value is not available (yet), e.g. no checkpoint stored.
+*/
+#define DS2438_NO_DATA          5
+
+/**
+*   \brief A wait did not end in time, e.g. a conversion that never completed.
+*/
+#define DS2438_TIMEOUT          6
+
+/**
+*   \brief The bus is held low (short to ground or a hung device).
+*
+*   Every function that accesses the bus can return this code. The bus
+*   is marked #DS2438_BUS_STUCK and further calls fail at once until the
+*   next recovery attempt, see #DS2438_BUS_RECHECK_MS.
+*/
+#define DS2438_BUS_FAULT        7
+
+/**
+*   \brief The request queue of the asynchronous functions is full.
+*/
+#define DS2438_BUSY             8
+
+/**
+*   \brief The RTOS could not create a queue or a thread or take a
+*   message, see DS2438_Rtos.h.
+*/
+#define DS2438_NO_RESOURCES     9
+
+// ===========================================================
+//                      RETRY POLICY
+// ===========================================================
+
+/**
+*   \brief Default immediate repeats of a transaction after a CRC error.
+*/
+#define DS2438_RETRY_CRC_DEFAULT 2
+
+/**
+*   \brief Default immediate repeats of a transaction after a missing presence pulse.
+*/
+#define DS2438_RETRY_PRESENCE_DEFAULT 1
+
+/**
+*   \brief Default pause (in ms) after a device was found absent.
+*
+*   Transactions fail with #DS2438_DEV_NOT_FOUND without bus access
+*   during the pause. It doubles with every failed attempt up to
+*   #DS2438_BACKOFF_MAX_MS_DEFAULT and ends with the first success.
+*/
+#define DS2438_BACKOFF_MIN_MS_DEFAULT 100
+
+/**
+*   \brief Default longest pause (in ms) for an absent device.
+*   Must be below 2^32 CPU cycles (59 s at 72 MHz), the pause is measured
+*   as elapsed cycles since its start.
+*/
+#define DS2438_BACKOFF_MAX_MS_DEFAULT 10000
+
+// ===========================================================
+//                      BUS HEALTH
+// ===========================================================
+
+/**
+*   \brief Longest wait (in ms) for a voltage or temperature conversion.
+*   Both take at most 10 ms.
+*/
+#define DS2438_CONVERSION_TIMEOUT_MS 20
+
+/**
+*   \brief Time (in ms) a stuck bus is left alone before the next
+*   recovery attempt.
+*/
+#define DS2438_BUS_RECHECK_MS 1000
+
+/**
+*   \brief Bus health: the line was high at the last reset.
+*/
+#define DS2438_BUS_OK 0
+
+/**
+*   \brief Bus health: the line was held low and could not be released.
+*/
+#define DS2438_BUS_STUCK 1
+
+// ===========================================================
+//                      ASYNC REQUESTS
+// ===========================================================
+
+/**
+*   \brief Slots of the request queue of the asynchronous functions,
+*   one of them stays free.
+*/
+#define DS2438_ASYNC_QUEUE_SIZE 8
+
+/**
+*   \brief Interval (in ms) at which DS2438_Poll() checks the busy flag
+*   of a running conversion.
+*/
+#define DS2438_ASYNC_POLL_MS 2
+
+// ===========================================================
+//                      SENSE RESISTOR
+// ===========================================================
+
+/**
+*   \brief Value (in Ohm) of the sense resistor on the reference board,
+*   passed to DS2438_Init() by the example program.
+*/
+#define DS2438_SENSE_RESISTOR 150
+
+// ===========================================================
+//                      ROM ID
+// ===========================================================
+
+/**
+*   \brief Size of the ROM ID: family code, 48-bit serial number, CRC8.
+*/
+#define DS2438_ROM_SIZE 8
+
+/**
+*   \brief Family code of the DS2438 (first ROM byte).
+*/
+#define DS2438_FAMILY_CODE 0x26
+
+// ===========================================================
+//                      CURRENT THRESHOLD
+// ===========================================================
+
+/**
+*   \brief No current threshold, every current is accumulated.
+*/
+#define DS2438_THRESHOLD_NONE 0
+
+/**
+*   \brief Currents below +-2 LSB are not accumulated.
+*/
+#define DS2438_THRESHOLD_2LSB 1
+
+/**
+*   \brief Currents below +-4 LSB are not accumulated.
+*/
+#define DS2438_THRESHOLD_4LSB 2
+
+/**
+*   \brief Currents below +-8 LSB are not accumulated.
+*/
+#define DS2438_THRESHOLD_8LSB 3
+
+// ===========================================================
+//                      ICA CHECKPOINT
+// ===========================================================
+
+/**
+*   \brief User EEPROM page used to store the extended ICA checkpoint.
+*/
+#define DS2438_ICA_CHECKPOINT_PAGE 3
+
+// ===========================================================
+//                      TIMEBASE
+// ===========================================================
+
+/**
+*   \brief Minimum ETM interval (in s) between two syncs used for drift estimation.
+*/
+#define DS2438_TIMEBASE_MIN_DRIFT_INTERVAL 60
+
+// ===========================================================
+//                      UART
+// ===========================================================
+
+/**
+*   \brief Baudrate used by the example program.
+*/
+#define UART_BAUDRATE_DEFAULT 921600
+
+/**
+*   \brief Size of the UART transmit ring buffer in bytes.
+*/
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 512
+#endif
+
+/**
+*   \brief Maximum number of decimals for uart_put_fixed() and uart_put_float().
+*/
+#define UART_MAX_DECIMALS 9
+
+/**
+*   \brief Drop chars that do not fit into the full transmit buffer.
+*/
+#define UART_OVERFLOW_DROP 0
+
+/**
+*   \brief Wait until there is space in the transmit buffer, at most
+*   #UART_TX_TIMEOUT_MS.
+*/
+#define UART_OVERFLOW_BLOCK 1
+
+/**
+*   \brief Longest wait (in ms) for space in the transmit buffer or for
+*   uart_flush(). Bytes that do not fit in time are dropped.
+*/
+#define UART_TX_TIMEOUT_MS 50
+
+// ===========================================================
+//                      BINARY TELEMETRY
+// ===========================================================
+// Frame: COBS(payload, CRC-16/CCITT-FALSE little endian) followed by 0x00.
+// Payload: record type (1 byte), sequence number (1 byte), record fields
+// (little endian). host/ds2438_telemetry.hpp decodes these frames.
+
+/**
+*   \brief Snapshot record: u64 time_us, i16 temperature (0.01 C),
+*   u32 dt_us, u16 voltage (10 mV), u32 dt_us, i32 current (uA), u32 dt_us, u8 ICA.
+*/
+#define TELEMETRY_RECORD_SNAPSHOT 0x01
+
+/**
+*   \brief Page record: u8 page number, 9 page bytes (including CRC byte).
+*/
+#define TELEMETRY_RECORD_PAGE 0x02
+
+/**
+*   \brief Event record: u64 time_us, u8 event code, u32 value.
+*/
+#define TELEMETRY_RECORD_EVENT 0x03
+
+/**
+*   \brief Trace record: u8 count, count * (u32 cycles, u8 trace type, u8 value),
+*   oldest entry first, see DS2438_TraceDump().
+*/
+#define TELEMETRY_RECORD_TRACE 0x04
+
+/**
+*   \brief Payload sizes (without CRC) of the records.
+*/
+#define TELEMETRY_SNAPSHOT_SIZE 31
+#define TELEMETRY_PAGE_SIZE 12
+#define TELEMETRY_EVENT_SIZE 15
+
+/**
+*   \brief Maximum number of trace entries in one trace record.
+*/
+#define TELEMETRY_TRACE_MAX_ENTRIES 40
+
+/**
+*   \brief Event codes, the meaning of value is given in brackets.
+*/
+#define TELEMETRY_EVENT_DEV_NOT_FOUND 0x01      // (0)
+#define TELEMETRY_EVENT_READ_ERROR 0x02         // (page number)
+#define TELEMETRY_EVENT_DISCONNECT 0x03         // (disconnect timestamp in s)
+#define TELEMETRY_EVENT_END_OF_CHARGE 0x04      // (end of charge timestamp in s)
+
+// ===========================================================
+//                      STATISTICS
+// ===========================================================
+
+/**
+*   \brief Number of log2 latency buckets per API.
+*   Bucket i counts calls that took 2^i to 2^(i+1)-1 us (bucket 0 also 0 us),
+*   the last bucket everything above.
+*/
+#define DS2438_LATENCY_BUCKETS 20
+
+/**
+*   \brief APIs with a latency histogram, index into ds2438_stats_t.latency.
+*/
+#define DS2438_API_READ_PAGE 0
+#define DS2438_API_WRITE_PAGE 1
+#define DS2438_API_READ_VOLTAGE 2
+#define DS2438_API_READ_TEMPERATURE 3
+#define DS2438_API_COUNT 4
+
+// ===========================================================
+//                      1-WIRE TRACE
+// ===========================================================
+
+/**
+*   \brief 1 records every reset and byte on the bus into a RAM ring.
+*   With 0 (default) the trace code is not compiled in.
+*/
+#ifndef DS2438_TRACE_ENABLE
+#define DS2438_TRACE_ENABLE 0
+#endif
+
+/**
+*   \brief Number of trace entries (6 bytes each), must be a power of 2.
+*/
+#ifndef DS2438_TRACE_SIZE
+#define DS2438_TRACE_SIZE 256
+#endif
+
+/**
+*   \brief Trace entry types, the meaning of value is given in brackets.
+*   The first byte written after a reset is the ROM command, the
+*   second one the function command.
+*/
+#define DS2438_TRACE_RESET 0x01     // (0 presence pulse, 1 none, DS2438_BUS_FAULT line held low)
+#define DS2438_TRACE_WRITE 0x02     // (byte written)
+#define DS2438_TRACE_READ 0x03      // (byte read)
+
+/*----------------------------- Types ---------------------------------------*/
+
+/**
+*   \brief One set of measurements, each tagged with the time it was taken.
+*
+*   Timestamps are in us on the DS2438 ETM time scale, see DS2438_GetTimestamp_us().
+*/
+typedef struct
+{
+    float temperature;          // temperature in C
+    uint64_t temperature_us;    // time of the temperature reading
+    float voltage;              // voltage in V
+    uint64_t voltage_us;        // time of the voltage reading
+    float current;              // current in mA
+    uint64_t current_us;        // time of the current reading
+    uint8_t ica;                // raw ICA register
+    uint64_t ica_us;            // time of the ICA reading
+} ds2438_snapshot_t;
+
+/**
+*   \brief Lifetime charge/discharge accumulators and derived values.
+*/
+typedef struct
+{
+    uint16_t cca;               // raw charging current accumulator
+    uint16_t dca;               // raw discharging current accumulator
+    float charge_mAh;           // total charge put into the battery
+    float discharge_mAh;        // total charge taken out of the battery
+    float throughput_mAh;       // charge + discharge
+    float cycles;               // equivalent full cycles (discharge / nominal capacity)
+} ds2438_lifetime_t;
+
+/**
+*   \brief 1-Wire bus counters.
+*/
+typedef struct
+{
+    uint32_t resets;            // reset pulses
+    uint32_t presence_failures; // resets without presence pulse
+    uint32_t bytes_written;
+    uint32_t bytes_read;
+    uint32_t slots_written;     // write time slots (bits)
+    uint32_t slots_read;        // read time slots (bits)
+    uint32_t crc_errors;        // pages read with a wrong CRC
+    uint32_t retries;           // transactions repeated after a CRC error or missing presence
+    uint32_t failures;          // transactions failed after all repeats
+    uint32_t skipped;           // transactions not started because the device was absent
+    uint32_t bus_faults;        // resets that found the line held low
+    uint32_t timeouts;          // conversions that did not complete in time
+    uint32_t active_us;         // time in transactions, the core runs the time slots
+    uint32_t sleep_us;          // time asleep waiting for conversions and EEPROM writes
+} ds2438_bus_stats_t;
+
+/**
+*   \brief Latency histogram of one API.
+*/
+typedef struct
+{
+    uint32_t calls;
+    uint32_t max_us;            // slowest call
+    uint32_t buckets[DS2438_LATENCY_BUCKETS];
+} ds2438_latency_t;
+
+/**
+*   \brief Bus counters and latency histograms since the last DS2438_ResetStats().
+*/
+typedef struct
+{
+    ds2438_bus_stats_t bus;
+    ds2438_latency_t latency[DS2438_API_COUNT];  // indexed by DS2438_API_
+} ds2438_stats_t;
+
+/**
+*   \brief One 1-Wire trace entry.
+*/
+typedef struct
+{
+    uint32_t cycles;            // CPU cycle counter at the end of the operation
+    uint8_t type;               // DS2438_TRACE_
+    uint8_t value;
+} ds2438_trace_entry_t;
+
+/**
+*   \brief One 1-Wire bus, set up by init_OnewirePort().
+*
+*   The pin is the one of DS2438_Hal.h. The counters cover the transfers of
+*   all devices on the bus.
+*/
+typedef struct
+{
+    ds2438_bus_stats_t stats;           // counters of all transfers
+    ds2438_bus_stats_t* device;         // counters of the device addressed last, or 0
+    uint8_t search_rom[DS2438_ROM_SIZE];// ROM ID found by the last search step
+    uint8_t search_last_discrepancy;    // bit where the next search takes the 1 branch
+    uint8_t search_done;                // 1 once the last device was found
+    uint8_t line;                       // 1-Wire line of the HAL, see ds2438_hal_pin_init()
+    uint8_t health;                     // DS2438_BUS_OK or DS2438_BUS_STUCK
+    uint32_t stuck_since;               // CPU cycle counter when the bus was marked stuck
+    void* owner;                        // server of DS2438_Rtos.h that serves the bus, or 0
+} ds2438_bus_t;
+
+/**
+*   \brief Corrections applied to the decoded values.
+*/
+typedef struct
+{
+    float voltage_gain;         // voltage multiplied by this
+    float current_gain;         // current and capacities multiplied by this
+    float temperature_offset;   // added to the temperature in C
+} ds2438_calibration_t;
+
+/**
+*   \brief How transactions (one page read or written, one conversion
+*   started) are repeated.
+*
+*   Bad parameters are never repeated, CRC errors and missing presence
+*   pulses are repeated at once, then the device counts as absent and is
+*   left alone for a pause that grows while it stays absent.
+*/
+typedef struct
+{
+    uint8_t crc_retries;        // immediate repeats after a CRC error
+    uint8_t presence_retries;   // immediate repeats after a missing presence pulse
+    uint16_t backoff_min_ms;    // first pause for an absent device, 0 = no pause
+    uint16_t backoff_max_ms;    // longest pause
+} ds2438_retry_t;
+
+/**
+*   \brief Handle of one DS2438, set up by DS2438_Init().
+*
+*   Holds everything the driver keeps per device. calibration, retry and
+*   sense_resistor may be changed at any time, the other members are
+*   maintained by the driver.
+*/
+typedef struct
+{
+    ds2438_bus_t* bus;
+    uint8_t rom[DS2438_ROM_SIZE];       // addressed with MATCH ROM, family code 0: SKIP ROM
+    float sense_resistor;               // Ohm
+    ds2438_calibration_t calibration;
+    ds2438_retry_t retry;
+
+    uint16_t backoff_ms;                // last pause, 0 while the device answers
+    uint8_t backoff_active;             // 1 until the first call after the pause
+    uint32_t backoff_start;             // CPU cycle counter at the start of the pause
+    uint8_t config;                     // cached IAD, CA, EE and AD bits of page 0 byte 0
+    uint8_t threshold;                  // cached threshold register (page 0 byte 7)
+    uint8_t config_valid;               // 1 once config and threshold were read or written
+
+    int32_t ica_extended;               // software-extended ICA
+    uint8_t ica_last;                   // raw ICA at the last update
+    uint8_t ica_valid;                  // 1 once ica_last holds a real sample
+
+    uint8_t tb_valid;                   // 1 once DS2438_InitTimebase succeeded
+    uint64_t tb_ref_us;                 // ETM time of the last sync in us
+    uint64_t tb_cycles;                 // CPU cycles since the last sync
+    uint32_t tb_cyc_last;               // cycle counter at the last update
+    uint32_t tb_cycles_per_s;           // measured CPU cycles per ETM second
+    uint32_t tb_drift_etm;              // ETM at the start of the drift interval
+    uint64_t tb_drift_cycles;           // CPU cycles since the start of the drift interval
+
+    ds2438_stats_t stats;               // transfers addressing this device
+} ds2438_t;
+
+/**
+*   \brief Data of a completed asynchronous request.
+*/
+typedef struct
+{
+    uint8_t page_number;        // page read or written, 0 for conversions
+    uint8_t page_data[9];       // page read or written, page 0 after a conversion
+    float value;                // voltage in V or temperature in C after a conversion
+} ds2438_async_result_t;
+
+/**
+*   \brief Called by DS2438_Poll() when an asynchronous request is done.
+*
+*   \param status #DS2438_OP_SUCCESS or the error code of the request.
+*   \param result the data, only valid during the call.
+*   \param context the pointer passed with the request.
+*/
+typedef void (*ds2438_callback_t)(ds2438_t* dev, uint8_t status, const ds2438_async_result_t* result, void* context);
+
 
 /*---------------------------Prototypes ---------------------------------------*/
+/*  All DS2438_ functions except the trace functions take the handle of the
+    device as first parameter, the OneWire_ functions the bus. */
     // ===========================================================
     //                 INITIALIZATION FUNCTIONS
     // ===========================================================
+
+    /**
+    *   \brief Sets up the handle of one DS2438.
+    *
+    *   No bus access. Several handles can share a bus.
+    *   \param dev the handle to be set up.
+    *   \param bus the bus the device is connected to.
+    *   \param rom ROM ID of the device (see OneWire_SearchNext()), or 0 if
+    *   it is the only device on the bus.
+    *   \param sense_resistor value of the sense resistor in Ohm.
+    */
+void DS2438_Init(ds2438_t* dev, ds2438_bus_t* bus, const uint8_t* rom, float sense_resistor);
     
     /**
-    *   \brief Initializes the DS2438.
-    *   This function resets the Onewire and checks if
-    *   the DS2438 is present on the 1-Wire bus.
-    *   \retval 0 if low pulse from slave detected
-    *   \retval 1 if no low pulse from slave detected
+    *   \brief Sends a reset pulse and samples the presence pulse.
+    *
+    *   The line has to be high before the reset pulse and after the
+    *   presence pulse, otherwise OneWire_Recover() is tried. While the bus
+    *   is stuck no reset pulse is sent until #DS2438_BUS_RECHECK_MS passed.
+    *   The result is the level of the line in the presence window, not a
+    *   return code; the DS2438_ functions turn it into one.
+    *   \retval 0 if a device answered with a presence pulse
+    *   \retval 1 if no device answered
+    *   \retval #DS2438_BUS_FAULT if the line is held low
     */
-int reset_Onewire(void);
+int reset_Onewire(ds2438_bus_t* bus);
 
     /**
     *   \brief Check that the DS2438 is present on the bus.
     *
     *   This function checks that the DS2438 is present
-    *   on the 1-Wire bus.
+    *   on the 1-Wire bus. With several devices on the bus
+    *   any of them answers.
     *   \retval 1 if device is present on the bus.
     *   \retval 0 if device is not present on the bus.
     */
-int DS2438_IsDevicePresent(void);
+int DS2438_IsDevicePresent(ds2438_t* dev);
 
     // ===========================================================
     //                  VOLTAGE CONVERSION FUNCTIONS
@@ -73,18 +608,20 @@ int DS2438_IsDevicePresent(void);
     *   \retval #DS2438_OP_SUCCESS if device is present on the bus.
     *   \retval #DS2438_DEV_NOT_FOUND if device is not present on the bus.
     */
-uint8_t DS2438_StartVoltageConversion(void);
+uint8_t DS2438_StartVoltageConversion(ds2438_t* dev);
 
     /**
     *   \brief Check if voltage conversion completed.
     *
     *   This function checks if a voltage conversion has been completed
     *   by reading the appropriate bit in the Status/Configuration register.
-    *   \retval 1 as long as it is busy making a voltage measurement
-    *   \retval #DS2438_DEV_NOT_FOUND if device is not present on the bus.
-    *   \retval 0 when the conversion is complete
+    *   DS2438_ReadVoltage() waits with a timeout instead.
+    *   \param busy set to 1 as long as it is busy making a voltage measurement,
+    *   0 when the conversion is complete; unchanged if page 0 could not be read.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
-uint8_t DS2438_HasVoltageData(void);
+uint8_t DS2438_HasVoltageData(ds2438_t* dev, uint8_t* busy);
 
     /**
     *   \brief Get voltage data.
@@ -94,7 +631,7 @@ uint8_t DS2438_HasVoltageData(void);
     *   \retval #DS2438_OP_SUCCESS if device is present on the bus.
     *   \retval #DS2438_DEV_NOT_FOUND if device is not present on the bus.
     */
-uint8_t DS2438_GetVoltageData(float* mV_voltage);
+uint8_t DS2438_GetVoltageData(ds2438_t* dev, float* mV_voltage);
 
     /**
     *   \brief Read voltage data.
@@ -105,9 +642,11 @@ uint8_t DS2438_GetVoltageData(float* mV_voltage);
     *   \param voltage pointer to variable where voltage data (in mV) will be stored.
     *   \retval #DS2438_OP_SUCCESS if device is present on the bus.
     *   \retval #DS2438_DEV_NOT_FOUND if device is not present on the bus.
-    *   \retval #DS2438_ERROR if operation had an error
+    *   \retval #DS2438_CRC_ERROR if the data was corrupted
+    *   \retval #DS2438_TIMEOUT if the conversion did not complete within
+    *   #DS2438_CONVERSION_TIMEOUT_MS
     */
-uint8_t DS2438_ReadVoltage(float* voltage);
+uint8_t DS2438_ReadVoltage(ds2438_t* dev, float* voltage);
 
     /**
     *   \brief Select input source for A/D conversion.
@@ -120,7 +659,7 @@ uint8_t DS2438_ReadVoltage(float* voltage);
     *   \retval #DS2438_DEV_NOT_FOUND if device is not present on the bus.
     *   \retval #DS2438_BAD_PARAM if parameter is wrong
     */
-uint8_t DS2438_SelectInputSource(uint8_t input_source);
+uint8_t DS2438_SelectInputSource(ds2438_t* dev, uint8_t input_source);
 
     // ===========================================================
     //                  TEMPERATURE CONVERSION FUNCTIONS
@@ -133,18 +672,20 @@ uint8_t DS2438_SelectInputSource(uint8_t input_source);
     *   \retval #DS2438_OP_SUCCESS operation finished successfully
     *   \retval #DS2438_DEV_NOT_FOUND if device is not present on the bus.
     */
-uint8_t DS2438_StartTemperatureConversion(void);
+uint8_t DS2438_StartTemperatureConversion(ds2438_t* dev);
 
     /**
     *   \brief Check if temperature conversion is complete. 
     *
     *   This function checks if temperature conversion is complete
     *   by reading the appropriate bit in the Status/Configuration register.
-    *   \retval 1 as long as it is busy making a temperature measurement
-    *   \retval #DS2438_DEV_NOT_FOUND if device is not present on the bus.
-    *   \retval 0 when the conversion is complete
+    *   DS2438_ReadTemperature() waits with a timeout instead.
+    *   \param busy set to 1 as long as it is busy making a temperature measurement,
+    *   0 when the conversion is complete; unchanged if page 0 could not be read.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
-uint8_t DS2438_HasTemperatureData(void);
+uint8_t DS2438_HasTemperatureData(ds2438_t* dev, uint8_t* busy);
 
     /**
     *   \brief Get temperature data in float format.
@@ -154,9 +695,9 @@ uint8_t DS2438_HasTemperatureData(void);
     *   completion of the conversion, that must be started prior to calling this function.
     *   \param temperature pointer to variable where voltage data will be stored.
     *   \retval #DS2438_OP_SUCCESS if operation finished successfully
-    *   \retval #DS2438_ERROR if operation failed.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
     */
-uint8_t DS2438_GetTemperatureData(float* temperature);
+uint8_t DS2438_GetTemperatureData(ds2438_t* dev, float* temperature);
 
     /**
     *   \brief Read temperature data in float format.
@@ -165,10 +706,12 @@ uint8_t DS2438_GetTemperatureData(float* temperature);
     *   wait until new temperature data are available, and gets the temperature data from 
     *   the DS2438 in float format.
     *   \param temperature pointer to variable where voltage data will be stored.
-    *   \retval #DS2438_ERROR if operation failed.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_TIMEOUT if the conversion did not complete within
+    *   #DS2438_CONVERSION_TIMEOUT_MS
     *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
-uint8_t DS2438_ReadTemperature(float* temperature);
+uint8_t DS2438_ReadTemperature(ds2438_t* dev, float* temperature);
 
     // ===========================================================
     //              CURRENT AND ACCUMULATORS FUNCTIONS
@@ -182,12 +725,97 @@ uint8_t DS2438_ReadTemperature(float* temperature);
     *   means that current is flowing out of the battery. In order to correctly
     *   convert the current value from raw to float format, the true value of
     *   the sense resistor must be set in the #DS2348_SENSE_RESISTOR macro.
+    *   Currents below the threshold set with DS2438_SetCurrentThreshold()
+    *   are reported as 0, the same way the DS2438 ignores them in the accumulators.
     *   \param current pointer to variable where voltage data will be stored.
-    *   \retval #DS2438_ERROR if operation failed.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
     *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
 		
-uint8_t DS2438_GetCurrentData(float* mA_current);
+uint8_t DS2438_GetCurrentData(ds2438_t* dev, float* mA_current);
+
+    /**
+    *   \brief Decode the current (in mA) from page 0 data.
+    *
+    *   Same as DS2438_GetCurrentData() without bus access, e.g. for the
+    *   page 0 of an asynchronous conversion result.
+    *   \param page_data the 9 bytes of page 0.
+    */
+float DS2438_DecodeCurrent(ds2438_t* dev, const uint8_t* page_data);
+
+    /**
+    *   \brief Read raw content of the current register.
+    *
+    *   The current register is a two's complement value with 10 data bits.
+    *   The offset register is already applied by the DS2438.
+    *   \param raw_current pointer to variable where the raw value will be stored.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_GetCurrentRaw(ds2438_t* dev, int16_t* raw_current);
+
+    /**
+    *   \brief Read the current offset register.
+    *
+    *   \param offset pointer to variable where the offset (in current register LSBs) will be stored.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_GetCurrentOffset(ds2438_t* dev, int16_t* offset);
+
+    /**
+    *   \brief Write the current offset register.
+    *
+    *   The DS2438 adds this value to every current measurement before it is
+    *   stored in the current register and integrated into the ICA.
+    *   IAD is switched off while writing and restored afterwards.
+    *   \param offset the offset in current register LSBs.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_SetCurrentOffset(ds2438_t* dev, int16_t offset);
+
+    /**
+    *   \brief Calibrate the current offset.
+    *
+    *   Measures the current while no current flows through the sense resistor
+    *   (shorted shunt or idle load), averages the readings and writes the
+    *   two's complement of the average into the offset register. Afterwards
+    *   the DS2438 cancels the offset itself, in the current register and in the ICA.
+    *   Blocks for about 28 ms per sample. If a step fails, the previous offset
+    *   and configuration are written back and the error of that step is returned.
+    *   \param samples number of current conversions to average (1 to 255).
+    *   \retval #DS2438_BAD_PARAM if samples is 0
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_CalibrateCurrentOffset(ds2438_t* dev, uint8_t samples);
+
+    /**
+    *   \brief Read the current threshold.
+    *
+    *   \param threshold pointer to variable where the threshold will be stored:
+    *       - #DS2438_THRESHOLD_NONE, #DS2438_THRESHOLD_2LSB,
+    *         #DS2438_THRESHOLD_4LSB or #DS2438_THRESHOLD_8LSB
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_GetCurrentThreshold(ds2438_t* dev, uint8_t* threshold);
+
+    /**
+    *   \brief Set the current threshold.
+    *
+    *   Currents below the threshold (page 0, byte 7) are not integrated
+    *   into ICA, CCA and DCA by the DS2438, so idle noise does not drift the
+    *   accumulators.
+    *   \param threshold one of:
+    *       - #DS2438_THRESHOLD_NONE, #DS2438_THRESHOLD_2LSB,
+    *         #DS2438_THRESHOLD_4LSB or #DS2438_THRESHOLD_8LSB
+    *   \retval #DS2438_BAD_PARAM if parameter is wrong
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_SetCurrentThreshold(ds2438_t* dev, uint8_t threshold);
     /**
     *   \brief Read content of ICA register.
     *
@@ -195,11 +823,11 @@ uint8_t DS2438_GetCurrentData(float* mA_current);
     *   which is a 8-bit value representing the integration of the
     *   voltage across sense resistor over time..
     *   \param ica pointer to variable where voltage data will be stored.
-    *   \retval #DS2438_ERROR if operation failed.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
     *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
 		
-uint8_t DS2438_GetICA(uint8_t* ica);
+uint8_t DS2438_GetICA(ds2438_t* dev, uint8_t* ica);
     /**
     *   \brief Get remaining capacity of the battery in mAh.
     *
@@ -207,11 +835,84 @@ uint8_t DS2438_GetICA(uint8_t* ica);
     *   remaining capacity according to the formula:
     *   \f$capacity = \dfrac{ICA}{2048\dotR_{sense}} \f$.
     *   \param capacity_mAh pointer to variable where voltage data will be stored in mAh.
-    *   \retval #DS2438_ERROR if operation failed.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
     *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
 		
-uint8_t DS2438_GetCapacity_mAh(float* capacity_mAh);
+uint8_t DS2438_GetCapacity_mAh(ds2438_t* dev, float* capacity_mAh);
+    /**
+    *   \brief Sample the ICA register and extend it to 32 bit.
+    *
+    *   The 8-bit ICA register wraps around under heavy load. This function
+    *   reads ICA and the current register, computes the change since the
+    *   last sample and adds it to a 32-bit accumulator kept in RAM. Changes
+    *   below 64 counts are taken as they are, for larger ones the sign of the
+    *   current decides if the register went up or down.
+    *   It must be called at least once per 191 ICA counts, i.e. at least every
+    *   191/(2048*Rsense*I) hours for a current I in A.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_UpdateICA(ds2438_t* dev);
+
+    /**
+    *   \brief Get the software-extended ICA value.
+    *
+    *   Returns the 32-bit accumulator maintained by DS2438_UpdateICA()
+    *   without accessing the bus.
+    *   \param ica_ext pointer to variable where the extended ICA will be stored.
+    *   \retval #DS2438_NO_DATA if DS2438_UpdateICA() was never called successfully
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_GetExtendedICA(ds2438_t* dev, int32_t* ica_ext);
+
+    /**
+    *   \brief Get the capacity in mAh from the extended ICA.
+    *
+    *   Same conversion as DS2438_GetCapacity_mAh(), but based on the
+    *   32-bit accumulator in RAM, so no bus access is needed.
+    *   \param capacity_mAh pointer to variable where capacity will be stored in mAh.
+    *   \retval #DS2438_NO_DATA if DS2438_UpdateICA() was never called successfully
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_GetAccumulatedCapacity_mAh(ds2438_t* dev, float* capacity_mAh);
+
+    /**
+    *   \brief Store the extended ICA in EEPROM.
+    *
+    *   Writes the 32-bit accumulator and the last raw ICA value to
+    *   page #DS2438_ICA_CHECKPOINT_PAGE, so it survives an MCU reset.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_SaveICACheckpoint(ds2438_t* dev);
+
+    /**
+    *   \brief Restore the extended ICA from EEPROM.
+    *
+    *   Reads the checkpoint written by DS2438_SaveICACheckpoint() and
+    *   continues accumulating from there. Counts the ICA register made
+    *   since the checkpoint are added on the next DS2438_UpdateICA().
+    *   \retval #DS2438_NO_DATA if no valid checkpoint was found.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if reading failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_RestoreICACheckpoint(ds2438_t* dev);
+
+    /**
+    *   \brief Read the lifetime charge and discharge accumulators.
+    *
+    *   Reads CCA and DCA (page 7, bytes 4-7) in a single page read and
+    *   converts them to mAh. CA has to be enabled with DS2438_EnableCA().
+    *   The cycle count is the discharged charge divided by the nominal capacity.
+    *   \param nominal_capacity_mAh nominal capacity of the battery in mAh.
+    *   \param lifetime pointer to the structure where the results will be stored.
+    *   \retval #DS2438_BAD_PARAM if nominal_capacity_mAh is not positive
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_GetLifetimeAccumulators(ds2438_t* dev, float nominal_capacity_mAh, ds2438_lifetime_t* lifetime);
+
     // ===========================================================
     //                  CONFIGURATION FUNCTIONS
     // ===========================================================
@@ -222,21 +923,21 @@ uint8_t DS2438_GetCapacity_mAh(float* capacity_mAh);
     *   If IAD is enabled, current measurements will be taken at a rate
     *   of 36.41 Hz, and the results of the conversion can be retrieved
     *   using the DS2438_GetCurrentData().
-    *   \retval #DS2438_ERROR if operation failed.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
     *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
 		
-uint8_t DS2438_EnableIAD(void);
+uint8_t DS2438_EnableIAD(ds2438_t* dev);
     /**
     *   \brief Disable current measurements and ICA.
     *
     *   DIsable current conversion and ICA. No current conversion
     *   will be performed by the DS2438.
-    *   \retval #DS2438_ERROR if operation failed.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
     *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
 		
-uint8_t DS2438_DisableIAD(void);
+uint8_t DS2438_DisableIAD(ds2438_t* dev);
     /**
     *   \brief Enable current accumulator.
     *
@@ -244,21 +945,127 @@ uint8_t DS2438_DisableIAD(void);
     *   current accumulator are used. These registers store the total
     *   charging/discharging current the battery has encountered in
     *   its lifetime.
-    *   \retval #DS2438_ERROR if operation failed.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
     *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
 		
-uint8_t DS2438_EnableCA(void);
+uint8_t DS2438_EnableCA(ds2438_t* dev);
     /**
     *   \brief Disable current measurements and ICA.
     *
     *   Disable current conversion and ICA. No current conversion
     *   will be performed by the DS2438.
-    *   \retval #DS2438_ERROR if operation failed.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
     *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
 		
-uint8_t DS2438_DisableCA(void);
+uint8_t DS2438_DisableCA(ds2438_t* dev);
+
+    // ===========================================================
+    //                  ELAPSED TIME METER FUNCTIONS
+    // ===========================================================
+
+    /**
+    *   \brief Read the Elapsed Time Meter.
+    *
+    *   The ETM (page 1, bytes 0-3) counts seconds while the DS2438 is powered.
+    *   \param seconds pointer to variable where the ETM value will be stored.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_GetETM(ds2438_t* dev, uint32_t* seconds);
+
+    /**
+    *   \brief Set the Elapsed Time Meter.
+    *
+    *   Page 1 also holds the ICA and the offset register. If IAD is on, it
+    *   is switched off while the page is rewritten and on again afterwards,
+    *   so both are written back as the device holds them; the ICA does not
+    *   count while the page is rewritten (about 65 ms).
+    *   \param seconds new ETM value in seconds.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_SetETM(ds2438_t* dev, uint32_t seconds);
+
+    /**
+    *   \brief Correct the Elapsed Time Meter by a number of seconds.
+    *
+    *   Adds correction to the current ETM value, e.g. to compensate
+    *   the drift of the DS2438 oscillator against a reference clock.
+    *   Page 1 is read once, IAD is handled as in DS2438_SetETM().
+    *   \param correction seconds to add (may be negative).
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_CompensateETM(ds2438_t* dev, int32_t correction);
+
+    /**
+    *   \brief Read the disconnect timestamp.
+    *
+    *   ETM value latched by the DS2438 when the battery was disconnected (page 2, bytes 0-3).
+    *   \param seconds pointer to variable where the timestamp will be stored.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_GetDisconnectTimestamp(ds2438_t* dev, uint32_t* seconds);
+
+    /**
+    *   \brief Read the end-of-charge timestamp.
+    *
+    *   ETM value latched by the DS2438 at the end of charge (page 2, bytes 4-7).
+    *   \param seconds pointer to variable where the timestamp will be stored.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_GetEndOfChargeTimestamp(ds2438_t* dev, uint32_t* seconds);
+
+    /**
+    *   \brief Initialise the timebase.
+    *
+    *   Enables the DWT cycle counter and aligns it with the ETM, so
+    *   DS2438_GetTimestamp_us() returns times on the ETM scale.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_InitTimebase(ds2438_t* dev);
+
+    /**
+    *   \brief Re-align the timebase with the ETM.
+    *
+    *   If at least #DS2438_TIMEBASE_MIN_DRIFT_INTERVAL seconds passed since the
+    *   last sync, the MCU clock rate is re-estimated against the ETM, which
+    *   removes the drift between both clocks. If the ETM went back, e.g. after
+    *   DS2438_SetETM(), or the time is more than 1 s ahead of it, the timebase
+    *   starts again from the ETM; timestamps returned afterwards can then be
+    *   earlier than ones returned before, by up to the time the ETM was set
+    *   back or 1 s. Must be called at least once every 2^32 CPU
+    *   cycles (59 s at 72 MHz) if DS2438_GetTimestamp_us() is not called in
+    *   between.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_SyncTimebase(ds2438_t* dev);
+
+    /**
+    *   \brief Get the current time in us without bus access.
+    *
+    *   Time on the ETM scale, interpolated with the DWT cycle counter
+    *   and corrected by the drift estimated in DS2438_SyncTimebase().
+    *   \return time in us, 0 if the timebase is not initialised.
+    */
+uint64_t DS2438_GetTimestamp_us(ds2438_t* dev);
+
+    /**
+    *   \brief Read temperature, voltage, current and ICA.
+    *
+    *   Every value is tagged with the time it was read, see DS2438_GetTimestamp_us().
+    *   \param snapshot pointer to the structure where the results will be stored.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t DS2438_ReadSnapshot(ds2438_t* dev, ds2438_snapshot_t* snapshot);
+
     // ===========================================================
     //                  LOW LEVEL FUNCTIONS
     // ===========================================================
@@ -269,26 +1076,95 @@ uint8_t DS2438_DisableCA(void);
     *   This function reads one page of data and return the read samples
     *   in the array passed in as parameter. This function issues a
     *   recall memory command, followed by a read scratchpage command
-    *   and the page to be read.
+    *   and the page to be read. The CRC byte (page_data[8]) is checked,
+    *   a wrong CRC fails the read.
     *   \param page_number the page to be read.
     *   \param page_data pointer to array where data will be stored.
-    *   \retval #DS2438_ERROR if operation failed.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
     *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
-uint8_t DS2438_ReadPage(uint8_t page_number, uint8_t* page_data);
+uint8_t DS2438_ReadPage(ds2438_t* dev, uint8_t page_number, uint8_t* page_data);
 
     /**
     *   \brief Write one page of data.
     *
     *   This function writes one page of data to the DS2438. This can be
     *   used to either configure bits in the registers or to write user bytes
-    *   to the device in its EEPROM.
+    *   to the device in its EEPROM. After the copy it sleeps for the
+    *   programming time of the EEPROM (10 ms), the device does not answer
+    *   before.
     *   \param page_number the page number to be written.
     *   \param page_data the data to be written to the page.
-    *   \retval #DS2438_ERROR if operation failed.
+    *   \retval #DS2438_DEV_NOT_FOUND or #DS2438_CRC_ERROR if operation failed.
     *   \retval #DS2438_OP_SUCCESS if operation finished successfully
     */
-uint8_t DS2438_WritePage(uint8_t page_number, uint8_t * page_data);
+uint8_t DS2438_WritePage(ds2438_t* dev, uint8_t page_number, uint8_t * page_data);
+
+    // ===========================================================
+    //                  ASYNC FUNCTIONS
+    // ===========================================================
+
+/*  The ...Async functions put a request into a queue and return at once.
+    DS2438_Poll() carries them out one after the other and calls the
+    callback of each. While a conversion runs or the EEPROM is programmed
+    DS2438_Poll() returns without touching the bus, so the time is free for
+    the application. Do not call the blocking functions for a bus while
+    DS2438_Poll() can run on it from an interrupt. */
+
+    /**
+    *   \brief Queue the read of one page, see DS2438_ReadPage().
+    *   \param page_number the page to be read.
+    *   \param callback called with the page data.
+    *   \param context passed to the callback.
+    *   \retval #DS2438_OP_SUCCESS if the request was queued
+    *   \retval #DS2438_BAD_PARAM if the page number is invalid
+    *   \retval #DS2438_BUSY if the queue is full
+    */
+uint8_t DS2438_ReadPageAsync(ds2438_t* dev, uint8_t page_number, ds2438_callback_t callback, void* context);
+
+    /**
+    *   \brief Queue the write of one page, see DS2438_WritePage().
+    *
+    *   The request is done after the EEPROM programming time.
+    *   \param page_number the page number to be written.
+    *   \param page_data the 9 bytes to be written, copied into the request.
+    *   \param callback called when done, may be 0.
+    *   \param context passed to the callback.
+    *   \retval #DS2438_OP_SUCCESS if the request was queued
+    *   \retval #DS2438_BAD_PARAM if the page number is invalid
+    *   \retval #DS2438_BUSY if the queue is full
+    */
+uint8_t DS2438_WritePageAsync(ds2438_t* dev, uint8_t page_number, const uint8_t* page_data, ds2438_callback_t callback, void* context);
+
+    /**
+    *   \brief Queue a voltage conversion, see DS2438_ReadVoltage().
+    *   \param callback called with the voltage (in V) in result->value.
+    *   \param context passed to the callback.
+    *   \retval #DS2438_OP_SUCCESS if the request was queued
+    *   \retval #DS2438_BUSY if the queue is full
+    */
+uint8_t DS2438_ReadVoltageAsync(ds2438_t* dev, ds2438_callback_t callback, void* context);
+
+    /**
+    *   \brief Queue a temperature conversion, see DS2438_ReadTemperature().
+    *   \param callback called with the temperature (in C) in result->value.
+    *   \param context passed to the callback.
+    *   \retval #DS2438_OP_SUCCESS if the request was queued
+    *   \retval #DS2438_BUSY if the queue is full
+    */
+uint8_t DS2438_ReadTemperatureAsync(ds2438_t* dev, ds2438_callback_t callback, void* context);
+
+    /**
+    *   \brief Advance the queued requests.
+    *
+    *   Does at most one transaction (one page read or write, one
+    *   conversion start) and calls the callback of a finished request.
+    *   Call it from the main loop or a timer interrupt; a call that
+    *   interrupts a running DS2438_Poll() returns at once. The callbacks may
+    *   queue new requests.
+    *   \return number of requests still queued, 0 when idle
+    */
+uint8_t DS2438_Poll(void);
 
     // ===========================================================
     //                  ONE WIRE FUNCTIONS
@@ -301,7 +1177,7 @@ uint8_t DS2438_WritePage(uint8_t page_number, uint8_t * page_data);
     *   interface.
     *   \param data the byte to be written.
     */		
-void OneWire_WriteByte(int data);
+void OneWire_WriteByte(ds2438_bus_t* bus, int data);
 
     /**
     *   \brief Write a bit on 1-Wire interface.
@@ -310,7 +1186,7 @@ void OneWire_WriteByte(int data);
     *   interface.
     *   \param bit the bit to be written.
     */
-void OneWire_WriteBit(int bit);
+void OneWire_WriteBit(ds2438_bus_t* bus, int bit);
 
     /**
     *   \brief Read a byte on 1-Wire interface.
@@ -320,7 +1196,7 @@ void OneWire_WriteBit(int bit);
     *   \param none
     *   \return the byte that was read.
     */
-int OneWire_ReadByte(void);
+int OneWire_ReadByte(ds2438_bus_t* bus);
 
     /**
     *   \brief Read a bit on 1-Wire interface.
@@ -330,13 +1206,61 @@ int OneWire_ReadByte(void);
     *   \param none
     *   \return the bit that was read.
     */
-int OneWire_ReadBit(void);
+int OneWire_ReadBit(ds2438_bus_t* bus);
+
+    /**
+    *   \brief Read the ROM ID of the only device on the bus.
+    *   \param rom pointer to #DS2438_ROM_SIZE bytes for the ROM ID.
+    *   \retval #DS2438_DEV_NOT_FOUND if no device answered.
+    *   \retval #DS2438_CRC_ERROR if the CRC is wrong (e.g. several devices).
+    *   \retval #DS2438_OP_SUCCESS if operation finished successfully
+    */
+uint8_t OneWire_ReadRom(ds2438_bus_t* bus, uint8_t* rom);
+
+    /**
+    *   \brief Restart the ROM search with the first device.
+    */
+void OneWire_SearchReset(ds2438_bus_t* bus);
+
+    /**
+    *   \brief Find the next device on the bus.
+    *
+    *   SEARCH ROM, one device per call in ascending ROM order. Call
+    *   OneWire_SearchReset() first.
+    *   \param rom pointer to #DS2438_ROM_SIZE bytes for the ROM ID.
+    *   \retval #DS2438_DEV_NOT_FOUND if there are no more devices.
+    *   \retval #DS2438_CRC_ERROR if the CRC of the found ROM ID is wrong.
+    *   \retval #DS2438_OP_SUCCESS if a device was found
+    */
+uint8_t OneWire_SearchNext(ds2438_bus_t* bus, uint8_t* rom);
+
+    /**
+    *   \brief Tries to free a bus that is held low.
+    *
+    *   Releases the line and waits longer than any time slot, so a device
+    *   still sending a 0 bit can finish. If the line stays low, a long
+    *   reset pulse resets all devices. Sets the health of the bus.
+    *   \retval #DS2438_OP_SUCCESS if the line is high again
+    *   \retval #DS2438_BUS_FAULT if it is still held low
+    */
+uint8_t OneWire_Recover(ds2438_bus_t* bus);
 
     /**
     *   \brief Initialises the Onewire Port PA0 on the CM3
-    *   \param bit the bit to be written.
+    *   \param bus the bus structure to be set up, counters cleared.
+    */
+void init_OnewirePort(ds2438_bus_t* bus);
+
+    /**
+    *   \brief Sets up a bus on a 1-Wire line of the HAL.
+    *
+    *   Every bus needs its own line; two bus structures on the same line
+    *   would send at the same time. On the CM3 line n is pin PAn.
+    *   \param bus the bus structure to be set up, counters cleared.
+    *   \param line line number passed to the ds2438_hal_pin_ functions,
+    *   init_OnewirePort() uses line 0.
     */
-void init_OnewirePort(void);
+void OneWire_InitBus(ds2438_bus_t* bus, uint8_t line);
 
     // ===========================================================
     //                  WAIT FUNCTIONS
@@ -354,14 +1278,87 @@ void wait_10us(int mal);
 */
 void wait_us(int mal);
 
+    // ===========================================================
+    //                  STATISTICS FUNCTIONS
+    // ===========================================================
+
+    /**
+    *   \brief Copies the bus counters and latency histograms of the device
+    *
+    *   Only transfers addressing this device are counted, the totals
+    *   of the bus are in ds2438_bus_t.stats.
+    *   \param stats pointer to the snapshot to be filled
+    */
+void DS2438_GetStats(ds2438_t* dev, ds2438_stats_t* stats);
+
+    /**
+    *   \brief Clears the bus counters and latency histograms of the device
+    */
+void DS2438_ResetStats(ds2438_t* dev);
+
+    /**
+    *   \brief Sends the statistics as compact text over UART
+    *
+    *   One line with the bus counters, one line per API with calls, slowest
+    *   call and the non-empty buckets as bucket:count, e.g.
+    *   "ReadPage n=20 max=11364 13:20".
+    */
+void DS2438_DumpStats(ds2438_t* dev);
+
+    // ===========================================================
+    //                  TRACE FUNCTIONS
+    // ===========================================================
+
+    /**
+    *   \brief Clears the 1-Wire trace
+    */
+void DS2438_TraceClear(void);
+
+    /**
+    *   \brief Sends the 1-Wire trace as binary frames over UART
+    *
+    *   The recorded entries (at most #DS2438_TRACE_SIZE, oldest first) are
+    *   sent as #TELEMETRY_RECORD_TRACE frames of up to
+    *   #TELEMETRY_TRACE_MAX_ENTRIES entries. The trace is not cleared.
+    *   Does nothing if #DS2438_TRACE_ENABLE is 0.
+    */
+void DS2438_TraceDump(void);
+
     // ===========================================================
     //                  UART FUNCTIONS
     // ===========================================================
 
     /**
-    *   \brief initialises the UART1 interface with 9600 Baud
+    *   \brief initialises the UART1 interface
+    *
+    *   The baudrate register is computed from SystemCoreClock and the APB2
+    *   prescaler, so any clock configuration works. Baudrates from PCLK2/65535
+    *   up to PCLK2/16 (1099 Baud to 4.5 MBaud at 72 MHz) are possible.
+    *   Sending is done by DMA1 channel 4 from a ring buffer of
+    *   #UART_TX_BUFFER_SIZE bytes, the uart_put functions return immediately.
+    *   \param baudrate the baudrate, e.g. #UART_BAUDRATE_DEFAULT
+    *   \return error of the real baudrate in ppm (positive if too fast),
+    *   #DS2438_HAL_UART_BAD_BAUDRATE if the baudrate is 0 or out of range;
+    *   the UART is not initialised then.
+    */
+int32_t uart1_init(uint32_t baudrate);
+
+    /**
+    *   \brief Select what happens if the transmit buffer is full
+    *   \param mode #UART_OVERFLOW_DROP (default) or #UART_OVERFLOW_BLOCK
+    */
+void uart_set_overflow_mode(uint8_t mode);
+
+    /**
+    *   \brief Number of chars dropped because the transmit buffer was full
+    */
+uint32_t uart_get_dropped_bytes(void);
+
+    /**
+    *   \brief Waits until all buffered chars have been sent, at most
+    *   #UART_TX_TIMEOUT_MS
     */
-void uart1_init(void);
+void uart_flush(void);
 
     /**
     *   \brief Sends a char over UART
@@ -390,4 +1387,64 @@ void uart_put_page_content(uint8_t* page_data, uint8_t page_number);
 */
 void uart_put_string_newline(char *string);
 
+    /**
+    *   \brief Sends a decimal number over UART
+    *   \param value the number to be sent.
+    */
+void uart_put_int(int32_t value);
+
+    /**
+    *   \brief Sends a fixed point number over UART
+    *
+    *   E.g. value 12345 with 3 decimals is sent as "12.345".
+    *   \param value the number in units of 10^-decimals.
+    *   \param decimals number of decimals (at most #UART_MAX_DECIMALS).
+    */
+void uart_put_fixed(int32_t value, uint8_t decimals);
+
+    /**
+    *   \brief Sends a float over UART without printf
+    *
+    *   The value is rounded half away from zero to the given decimals and sent
+    *   as fixed point number, like sprintf("%.*f") does. Digits beyond the
+    *   precision of float may differ from it. NaN and infinity are sent as
+    *   "nan", "inf" and "-inf", values beyond 9.2e18 / 10^decimals as that
+    *   limit.
+    *   \param value the number to be sent.
+    *   \param decimals number of decimals (at most #UART_MAX_DECIMALS).
+    */
+void uart_put_float(float value, uint8_t decimals);
+
+    /**
+    *   \brief Sends a byte as two hex digits over UART
+    *   \param value the byte to be sent.
+    */
+void uart_put_hex8(uint8_t value);
+
+    /**
+    *   \brief Sends a snapshot as binary frame over UART
+    *   \param snapshot pointer to the snapshot to be sent.
+    */
+void uart_put_frame_snapshot(ds2438_snapshot_t* snapshot);
+
+    /**
+    *   \brief Sends one page of data as binary frame over UART
+    *   \param page_data pointer to the 9 bytes of page data.
+    *   \param page_number the page to be send.
+    */
+void uart_put_frame_page(uint8_t* page_data, uint8_t page_number);
+
+    /**
+    *   \brief Sends an event as binary frame over UART
+    *
+    *   \param timestamp_us time of the event, e.g. DS2438_GetTimestamp_us().
+    *   \param code one of the TELEMETRY_EVENT_ codes.
+    *   \param value event specific value.
+    */
+void uart_put_frame_event(uint64_t timestamp_us, uint8_t code, uint32_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
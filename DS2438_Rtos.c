@@ -0,0 +1,295 @@
+/**
+  ******************************************************************************
+  * @file    DS2438_Rtos.c
+  * @brief   Bus server thread for the DS2438 Libary
+  ******************************************************************************
+ */
+
+#include "DS2438_Rtos.h"
+#include "DS2438_Rtos_Port.h"
+
+// request types
+#define DS2438_RTOS_OP_READ_PAGE 0
+#define DS2438_RTOS_OP_WRITE_PAGE 1
+#define DS2438_RTOS_OP_READ_VOLTAGE 2
+#define DS2438_RTOS_OP_READ_TEMPERATURE 3
+
+// result of a blocking request, on the stack of the waiting thread
+typedef struct
+{
+    uint8_t status;
+    ds2438_async_result_t result;
+} ds2438_server_reply_t;
+
+// ===========================================================
+//                 FUNCTION BODIES
+// ===========================================================
+
+static void DS2438_ServerClear(void* data, uint16_t size)
+{
+    uint8_t* p = (uint8_t*)data;
+    for (uint16_t i = 0; i < size; i++)
+    {
+        p[i] = 0;
+    }
+}
+
+static uint8_t DS2438_ServerExecute(ds2438_server_request_t* request, ds2438_async_result_t* result)
+{
+    DS2438_ServerClear(result, sizeof(*result));
+    result->page_number = request->page_number;
+    switch (request->op)
+    {
+    case DS2438_RTOS_OP_READ_PAGE:
+        return DS2438_ReadPage(request->dev, request->page_number, result->page_data);
+    case DS2438_RTOS_OP_WRITE_PAGE:
+        for (uint8_t i = 0; i < 9; i++)
+        {
+            result->page_data[i] = request->page_data[i];
+        }
+        return DS2438_WritePage(request->dev, request->page_number, request->page_data);
+    case DS2438_RTOS_OP_READ_VOLTAGE:
+        return DS2438_ReadVoltage(request->dev, &result->value);
+    case DS2438_RTOS_OP_READ_TEMPERATURE:
+        return DS2438_ReadTemperature(request->dev, &result->value);
+    }
+    return DS2438_BAD_PARAM;
+}
+
+// The request must not be touched after this: the waiting thread may
+// return and reuse its stack as soon as it is signalled.
+static void DS2438_ServerComplete(const ds2438_server_request_t* request, uint8_t status, const ds2438_async_result_t* result)
+{
+    if (request->waiter)
+    {
+        ds2438_server_reply_t* reply = (ds2438_server_reply_t*)request->reply;
+        reply->status = status;
+        reply->result = *result;
+        ds2438_os_signal(request->waiter);
+    }
+    else if (request->callback)
+    {
+        request->callback(request->dev, status, result, request->context);
+    }
+}
+
+// Two requests that give the same result when served back to back
+static uint8_t DS2438_ServerSameRead(const ds2438_server_request_t* a, const ds2438_server_request_t* b)
+{
+    return a->dev == b->dev && a->op == b->op && a->op != DS2438_RTOS_OP_WRITE_PAGE &&
+           (a->op != DS2438_RTOS_OP_READ_PAGE || a->page_number == b->page_number);
+}
+
+static void DS2438_ServerThread(void* argument)
+{
+    ds2438_server_t* server = (ds2438_server_t*)argument;
+    ds2438_server_request_t batch[DS2438_RTOS_QUEUE_SIZE];
+
+    for (;;)
+    {
+        uint8_t count = 0;
+        if (ds2438_os_queue_get(server->queue, &batch[0], DS2438_OS_WAIT_FOREVER) != 0)
+        {
+            continue;
+        }
+        count = 1;
+        // take what queued up while the last batch was served
+        while (count < DS2438_RTOS_QUEUE_SIZE && ds2438_os_queue_get(server->queue, &batch[count], 0) == 0)
+        {
+            count++;
+        }
+        server->requests += count;
+
+        for (uint8_t i = 0; i < count; i++)
+        {
+            ds2438_async_result_t result;
+            uint8_t status;
+            if (batch[i].dev == 0)
+            {
+                continue;   // merged into an earlier one
+            }
+            status = DS2438_ServerExecute(&batch[i], &result);
+            server->executed++;
+
+            // later identical reads of the device, up to the next other request for it
+            for (uint8_t j = i + 1; j < count; j++)
+            {
+                if (batch[j].dev != batch[i].dev)
+                {
+                    continue;
+                }
+                if (!DS2438_ServerSameRead(&batch[i], &batch[j]))
+                {
+                    break;
+                }
+                DS2438_ServerComplete(&batch[j], status, &result);
+                batch[j].dev = 0;
+                server->merged++;
+            }
+            DS2438_ServerComplete(&batch[i], status, &result);
+        }
+    }
+}
+
+uint8_t DS2438_ServerStart(ds2438_server_t* server, ds2438_bus_t* bus, int32_t priority)
+{
+    if (bus->owner)
+    {
+        return DS2438_BUSY;     // two servers would interleave on the bus
+    }
+    DS2438_ServerClear(server, sizeof(*server));
+    server->bus = bus;
+    server->queue = ds2438_os_queue_new(DS2438_RTOS_QUEUE_SIZE, sizeof(ds2438_server_request_t));
+    if (server->queue == 0)
+    {
+        return DS2438_NO_RESOURCES;
+    }
+    server->thread = ds2438_os_thread_new(DS2438_ServerThread, server, DS2438_RTOS_STACK_SIZE, priority);
+    if (server->thread == 0)
+    {
+        return DS2438_NO_RESOURCES;
+    }
+    bus->owner = server;
+    return DS2438_OP_SUCCESS;
+}
+
+// Queue the request and wait for the server to fill reply
+static uint8_t DS2438_ServerCall(ds2438_server_t* server, ds2438_server_request_t* request, ds2438_server_reply_t* reply)
+{
+    void* self = ds2438_os_thread_self();
+    if (self == server->thread)
+    {
+        return DS2438_BUSY;     // the server would wait for itself
+    }
+    if (request->dev->bus != server->bus)
+    {
+        return DS2438_BAD_PARAM;
+    }
+    request->waiter = self;
+    request->reply = reply;
+    if (ds2438_os_queue_put(server->queue, request, DS2438_OS_WAIT_FOREVER) != 0)
+    {
+        return DS2438_NO_RESOURCES;
+    }
+    // every bus access is bounded (see DS2438_CONVERSION_TIMEOUT_MS), so the reply comes
+    ds2438_os_wait_signal(DS2438_OS_WAIT_FOREVER);
+    return reply->status;
+}
+
+static uint8_t DS2438_ServerSubmit(ds2438_server_t* server, ds2438_server_request_t* request)
+{
+    if (request->dev->bus != server->bus)
+    {
+        return DS2438_BAD_PARAM;
+    }
+    if (ds2438_os_queue_put(server->queue, request, 0) != 0)
+    {
+        return DS2438_BUSY;
+    }
+    return DS2438_OP_SUCCESS;
+}
+
+static void DS2438_ServerRequest(ds2438_server_request_t* request, ds2438_t* dev, uint8_t op, uint8_t page_number)
+{
+    DS2438_ServerClear(request, sizeof(*request));
+    request->dev = dev;
+    request->op = op;
+    request->page_number = page_number;
+}
+
+uint8_t DS2438_ServerReadPage(ds2438_server_t* server, ds2438_t* dev, uint8_t page_number, uint8_t* page_data)
+{
+    ds2438_server_request_t request;
+    ds2438_server_reply_t reply;
+    uint8_t status;
+    DS2438_ServerRequest(&request, dev, DS2438_RTOS_OP_READ_PAGE, page_number);
+    status = DS2438_ServerCall(server, &request, &reply);
+    if (status == DS2438_OP_SUCCESS)
+    {
+        for (uint8_t i = 0; i < 9; i++)
+        {
+            page_data[i] = reply.result.page_data[i];
+        }
+    }
+    return status;
+}
+
+uint8_t DS2438_ServerWritePage(ds2438_server_t* server, ds2438_t* dev, uint8_t page_number, const uint8_t* page_data)
+{
+    ds2438_server_request_t request;
+    ds2438_server_reply_t reply;
+    DS2438_ServerRequest(&request, dev, DS2438_RTOS_OP_WRITE_PAGE, page_number);
+    for (uint8_t i = 0; i < 9; i++)
+    {
+        request.page_data[i] = page_data[i];
+    }
+    return DS2438_ServerCall(server, &request, &reply);
+}
+
+uint8_t DS2438_ServerReadVoltage(ds2438_server_t* server, ds2438_t* dev, float* voltage)
+{
+    ds2438_server_request_t request;
+    ds2438_server_reply_t reply;
+    uint8_t status;
+    DS2438_ServerRequest(&request, dev, DS2438_RTOS_OP_READ_VOLTAGE, 0);
+    status = DS2438_ServerCall(server, &request, &reply);
+    if (status == DS2438_OP_SUCCESS)
+    {
+        *voltage = reply.result.value;
+    }
+    return status;
+}
+
+uint8_t DS2438_ServerReadTemperature(ds2438_server_t* server, ds2438_t* dev, float* temperature)
+{
+    ds2438_server_request_t request;
+    ds2438_server_reply_t reply;
+    uint8_t status;
+    DS2438_ServerRequest(&request, dev, DS2438_RTOS_OP_READ_TEMPERATURE, 0);
+    status = DS2438_ServerCall(server, &request, &reply);
+    if (status == DS2438_OP_SUCCESS)
+    {
+        *temperature = reply.result.value;
+    }
+    return status;
+}
+
+uint8_t DS2438_ServerReadPageAsync(ds2438_server_t* server, ds2438_t* dev, uint8_t page_number, ds2438_callback_t callback, void* context)
+{
+    ds2438_server_request_t request;
+    DS2438_ServerRequest(&request, dev, DS2438_RTOS_OP_READ_PAGE, page_number);
+    request.callback = callback;
+    request.context = context;
+    return DS2438_ServerSubmit(server, &request);
+}
+
+uint8_t DS2438_ServerWritePageAsync(ds2438_server_t* server, ds2438_t* dev, uint8_t page_number, const uint8_t* page_data, ds2438_callback_t callback, void* context)
+{
+    ds2438_server_request_t request;
+    DS2438_ServerRequest(&request, dev, DS2438_RTOS_OP_WRITE_PAGE, page_number);
+    for (uint8_t i = 0; i < 9; i++)
+    {
+        request.page_data[i] = page_data[i];
+    }
+    request.callback = callback;
+    request.context = context;
+    return DS2438_ServerSubmit(server, &request);
+}
+
+uint8_t DS2438_ServerReadVoltageAsync(ds2438_server_t* server, ds2438_t* dev, ds2438_callback_t callback, void* context)
+{
+    ds2438_server_request_t request;
+    DS2438_ServerRequest(&request, dev, DS2438_RTOS_OP_READ_VOLTAGE, 0);
+    request.callback = callback;
+    request.context = context;
+    return DS2438_ServerSubmit(server, &request);
+}
+
+uint8_t DS2438_ServerReadTemperatureAsync(ds2438_server_t* server, ds2438_t* dev, ds2438_callback_t callback, void* context)
+{
+    ds2438_server_request_t request;
+    DS2438_ServerRequest(&request, dev, DS2438_RTOS_OP_READ_TEMPERATURE, 0);
+    request.callback = callback;
+    request.context = context;
+    return DS2438_ServerSubmit(server, &request);
+}
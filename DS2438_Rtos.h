@@ -0,0 +1,165 @@
+/**
+  ******************************************************************************
+  * @file    DS2438_Rtos.h
+  * @brief   Bus server thread for using the DS2438 Libary from several threads
+  ******************************************************************************
+  * Every DS2438_ function does several reset-delimited transactions, so two
+  * threads calling them on one bus can interleave (e.g. between Recall
+  * Memory and Read Scratchpad of a page read). The server thread owns the
+  * bus: other threads send it requests through a message queue and either
+  * wait for the result or get a callback. Identical reads that are queued
+  * at the same time are served with one bus access.
+  *
+  * The OS functions are in DS2438_Rtos_Port.h: DS2438_Rtos_CMSIS.c for
+  * CMSIS-RTOS2, host/ds2438_rtos_posix.cpp for Linux.
+  ******************************************************************************
+ */
+
+#ifndef DS2438_RTOS_H
+#define DS2438_RTOS_H
+
+#include "DS2438_Library.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ===========================================================
+//                      CONFIGURATION
+// ===========================================================
+
+/**
+*   \brief Messages in the request queue of a server. Also the number of
+*   requests the server takes at once and merges.
+*/
+#ifndef DS2438_RTOS_QUEUE_SIZE
+#define DS2438_RTOS_QUEUE_SIZE 8
+#endif
+
+/**
+*   \brief Stack of the server thread in bytes (holds one batch of requests).
+*/
+#ifndef DS2438_RTOS_STACK_SIZE
+#define DS2438_RTOS_STACK_SIZE 1536
+#endif
+
+/**
+*   \brief Suggested priority of the server thread, osPriorityAboveNormal
+*   of CMSIS-RTOS2.
+*/
+#ifndef DS2438_RTOS_PRIORITY
+#define DS2438_RTOS_PRIORITY 32
+#endif
+
+/**
+*   \brief One request to the server, copied into the queue.
+*/
+typedef struct
+{
+    ds2438_t* dev;
+    uint8_t op;                         // DS2438_RTOS_OP_, private
+    uint8_t page_number;
+    uint8_t page_data[9];               // data of a page write
+    ds2438_callback_t callback;         // asynchronous request
+    void* context;
+    void* waiter;                       // blocking request: thread waiting for the result
+    void* reply;                        // blocking request: where the result goes
+} ds2438_server_request_t;
+
+/**
+*   \brief Server thread of one bus.
+*/
+typedef struct
+{
+    ds2438_bus_t* bus;                  // the bus served, see DS2438_ServerStart()
+    void* queue;
+    void* thread;
+    volatile uint32_t requests;         // requests taken from the queue
+    volatile uint32_t executed;         // requests served with a bus access
+    volatile uint32_t merged;           // requests answered with the result of an identical one
+} ds2438_server_t;
+
+/*---------------------------Prototypes ---------------------------------------*/
+/*  A server serves one ds2438_bus_t, i.e. one line of the HAL, and a bus
+    has at most one server: start one for every bus and send all requests
+    for the devices on that bus through it; nothing else may call the
+    DS2438_ and OneWire_ functions for the bus afterwards. Requests for a
+    device on another bus fail with #DS2438_BAD_PARAM. Callbacks run in the
+    server thread.
+    They may queue asynchronous requests but must not call the blocking
+    server functions. */
+    // ===========================================================
+    //                  SERVER
+    // ===========================================================
+
+    /**
+    *   \brief Creates the request queue and starts the server thread of a bus.
+    *   \param server the server to be started.
+    *   \param bus the bus it serves, set up by OneWire_InitBus().
+    *   \param priority priority of the thread in units of the RTOS, e.g.
+    *   #DS2438_RTOS_PRIORITY.
+    *   \retval #DS2438_OP_SUCCESS if the thread runs
+    *   \retval #DS2438_BUSY if another server serves the bus already
+    *   \retval #DS2438_NO_RESOURCES if the queue or the thread could not be created
+    */
+uint8_t DS2438_ServerStart(ds2438_server_t* server, ds2438_bus_t* bus, int32_t priority);
+
+    // ===========================================================
+    //                  BLOCKING REQUESTS
+    // ===========================================================
+/*  The calling thread waits until the server is done. They fail with
+    #DS2438_BUSY when called from the server thread (i.e. a callback) and
+    with #DS2438_NO_RESOURCES if the request could not be queued. */
+
+    /**
+    *   \brief DS2438_ReadPage() through the server.
+    */
+uint8_t DS2438_ServerReadPage(ds2438_server_t* server, ds2438_t* dev, uint8_t page_number, uint8_t* page_data);
+
+    /**
+    *   \brief DS2438_WritePage() through the server.
+    */
+uint8_t DS2438_ServerWritePage(ds2438_server_t* server, ds2438_t* dev, uint8_t page_number, const uint8_t* page_data);
+
+    /**
+    *   \brief DS2438_ReadVoltage() through the server.
+    */
+uint8_t DS2438_ServerReadVoltage(ds2438_server_t* server, ds2438_t* dev, float* voltage);
+
+    /**
+    *   \brief DS2438_ReadTemperature() through the server.
+    */
+uint8_t DS2438_ServerReadTemperature(ds2438_server_t* server, ds2438_t* dev, float* temperature);
+
+    // ===========================================================
+    //                  ASYNCHRONOUS REQUESTS
+    // ===========================================================
+/*  They return at once, the callback gets the result like the one of
+    DS2438_ReadPageAsync(); after a conversion only result->value is set.
+    They return #DS2438_BUSY if the request queue is full. */
+
+    /**
+    *   \brief Queue DS2438_ReadPage() at the server.
+    */
+uint8_t DS2438_ServerReadPageAsync(ds2438_server_t* server, ds2438_t* dev, uint8_t page_number, ds2438_callback_t callback, void* context);
+
+    /**
+    *   \brief Queue DS2438_WritePage() at the server, callback may be 0.
+    */
+uint8_t DS2438_ServerWritePageAsync(ds2438_server_t* server, ds2438_t* dev, uint8_t page_number, const uint8_t* page_data, ds2438_callback_t callback, void* context);
+
+    /**
+    *   \brief Queue DS2438_ReadVoltage() at the server.
+    */
+uint8_t DS2438_ServerReadVoltageAsync(ds2438_server_t* server, ds2438_t* dev, ds2438_callback_t callback, void* context);
+
+    /**
+    *   \brief Queue DS2438_ReadTemperature() at the server.
+    */
+uint8_t DS2438_ServerReadTemperatureAsync(ds2438_server_t* server, ds2438_t* dev, ds2438_callback_t callback, void* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
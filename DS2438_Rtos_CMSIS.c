@@ -0,0 +1,71 @@
+/**
+  ******************************************************************************
+  * @file    DS2438_Rtos_CMSIS.c
+  * @brief   CMSIS-RTOS2 implementation of DS2438_Rtos_Port.h
+  ******************************************************************************
+  * Threads and message queues of the RTOS, the wake-up signal is one
+  * thread flag, so the application can use the other flags.
+  ******************************************************************************
+ */
+
+#include <cmsis_os2.h>
+
+#include "DS2438_Rtos_Port.h"
+
+// thread flag used by ds2438_os_signal()
+#define DS2438_OS_SIGNAL_FLAG 0x00010000u
+
+// ===========================================================
+//                 FUNCTION BODIES
+// ===========================================================
+
+static uint32_t ds2438_os_ticks(uint32_t timeout_ms)
+{
+    uint32_t ticks;
+    if (timeout_ms == DS2438_OS_WAIT_FOREVER)
+    {
+        return osWaitForever;
+    }
+    ticks = (uint32_t)(((uint64_t)timeout_ms * osKernelGetTickFreq() + 999) / 1000);
+    return (timeout_ms != 0 && ticks == 0) ? 1 : ticks;
+}
+
+void* ds2438_os_thread_new(void (*entry)(void*), void* argument, uint32_t stack_size, int32_t priority)
+{
+    osThreadAttr_t attr = {0};
+    attr.name = "ds2438";
+    attr.stack_size = stack_size;
+    attr.priority = (osPriority_t)priority;
+    return osThreadNew(entry, argument, &attr);
+}
+
+void* ds2438_os_thread_self(void)
+{
+    return osThreadGetId();
+}
+
+void ds2438_os_signal(void* thread)
+{
+    osThreadFlagsSet((osThreadId_t)thread, DS2438_OS_SIGNAL_FLAG);
+}
+
+int ds2438_os_wait_signal(uint32_t timeout_ms)
+{
+    uint32_t flags = osThreadFlagsWait(DS2438_OS_SIGNAL_FLAG, osFlagsWaitAny, ds2438_os_ticks(timeout_ms));
+    return (flags & osFlagsError) ? 1 : 0;
+}
+
+void* ds2438_os_queue_new(uint32_t count, uint32_t size)
+{
+    return osMessageQueueNew(count, size, 0);
+}
+
+int ds2438_os_queue_put(void* queue, const void* message, uint32_t timeout_ms)
+{
+    return osMessageQueuePut((osMessageQueueId_t)queue, message, 0, ds2438_os_ticks(timeout_ms)) == osOK ? 0 : 1;
+}
+
+int ds2438_os_queue_get(void* queue, void* message, uint32_t timeout_ms)
+{
+    return osMessageQueueGet((osMessageQueueId_t)queue, message, 0, ds2438_os_ticks(timeout_ms)) == osOK ? 0 : 1;
+}
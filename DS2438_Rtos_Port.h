@@ -0,0 +1,81 @@
+/**
+  ******************************************************************************
+  * @file    DS2438_Rtos_Port.h
+  * @brief   Operating system layer of the DS2438 bus server
+  ******************************************************************************
+  * Everything DS2438_Rtos.c needs from the RTOS: a thread, a message queue
+  * and a wake-up signal per thread. DS2438_Rtos_CMSIS.c implements it with
+  * CMSIS-RTOS2, host/ds2438_rtos_posix.cpp with C++ threads on Linux.
+  ******************************************************************************
+ */
+
+#ifndef DS2438_RTOS_PORT_H
+#define DS2438_RTOS_PORT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+*   \brief Timeout that never ends.
+*/
+#define DS2438_OS_WAIT_FOREVER 0xFFFFFFFFu
+
+/*---------------------------Prototypes ---------------------------------------*/
+    // ===========================================================
+    //                  THREADS
+    // ===========================================================
+
+    /**
+    *   \brief Starts a thread.
+    *   \param priority priority in the units of the RTOS.
+    *   \return the thread, 0 if it could not be created.
+    */
+void* ds2438_os_thread_new(void (*entry)(void*), void* argument, uint32_t stack_size, int32_t priority);
+
+    /**
+    *   \brief The calling thread.
+    */
+void* ds2438_os_thread_self(void);
+
+    /**
+    *   \brief Wakes a thread waiting in ds2438_os_wait_signal(). A signal
+    *   sent before the wait is not lost.
+    */
+void ds2438_os_signal(void* thread);
+
+    /**
+    *   \brief Waits for a signal to the calling thread.
+    *   \retval 0 if signalled, 1 on timeout.
+    */
+int ds2438_os_wait_signal(uint32_t timeout_ms);
+
+    // ===========================================================
+    //                  MESSAGE QUEUE
+    // ===========================================================
+
+    /**
+    *   \brief Creates a queue of count messages of size bytes.
+    *   \return the queue, 0 if it could not be created.
+    */
+void* ds2438_os_queue_new(uint32_t count, uint32_t size);
+
+    /**
+    *   \brief Appends a message, waits at most timeout_ms for space.
+    *   \retval 0 if done, 1 if the queue stayed full.
+    */
+int ds2438_os_queue_put(void* queue, const void* message, uint32_t timeout_ms);
+
+    /**
+    *   \brief Takes the oldest message, waits at most timeout_ms for one.
+    *   \retval 0 if done, 1 if the queue stayed empty.
+    */
+int ds2438_os_queue_get(void* queue, void* message, uint32_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,358 @@
+/**
+  ******************************************************************************
+  * @file    DS2438_Script.hpp
+  * @brief   Compile-time 1-Wire command scripts for the DS2438 Libary (C++17)
+  ******************************************************************************
+  * The transactions of DS2438_ReadPage(), DS2438_WritePage() and the
+  * conversion functions are fixed byte sequences. Here they are built once
+  * by the compiler: a Script is a constexpr array of steps (reset, ROM
+  * command, written bytes, read lengths, CRC checks) that ends up in flash,
+  * check() validates it at compile time and run() executes it with the
+  * OneWire_ functions of the library, without building anything at runtime.
+  *
+  * Usage:
+  *     uint8_t page[9];
+  *     ds2438::script::run<ds2438::script::read_page<3>>(&dev, page);
+  *
+  *     constexpr auto my_script = ds2438::script::begin().reset().select()
+  *                                    .write(ds2438::script::CONVERT_T);
+  *     ds2438::script::run<my_script>(&dev);
+  *
+  * run() makes one attempt, without the retries and the backoff of the
+  * library functions.
+  ******************************************************************************
+  */
+
+#ifndef DS2438_SCRIPT_HPP
+#define DS2438_SCRIPT_HPP
+
+#include "DS2438_Library.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ds2438::script {
+
+// ===========================================================
+//                      COMMANDS
+// ===========================================================
+
+inline constexpr uint8_t SKIP_ROM = 0xCC;
+inline constexpr uint8_t MATCH_ROM = 0x55;
+inline constexpr uint8_t CONVERT_T = 0x44;
+inline constexpr uint8_t CONVERT_V = 0xB4;
+inline constexpr uint8_t RECALL_MEMORY = 0xB8;
+inline constexpr uint8_t READ_SCRATCHPAD = 0xBE;
+inline constexpr uint8_t WRITE_SCRATCHPAD = 0x4E;
+inline constexpr uint8_t COPY_SCRATCHPAD = 0x48;
+
+// Function commands followed by a page number
+constexpr bool takes_page(uint8_t command)
+{
+    return command == RECALL_MEMORY || command == READ_SCRATCHPAD || command == WRITE_SCRATCHPAD ||
+           command == COPY_SCRATCHPAD;
+}
+
+constexpr bool known_command(uint8_t command)
+{
+    return takes_page(command) || command == CONVERT_T || command == CONVERT_V;
+}
+
+// ===========================================================
+//                      SCRIPT
+// ===========================================================
+
+enum class Op : uint8_t
+{
+    Reset,      // reset pulse, fails without presence pulse
+    Select,     // SKIP ROM, or MATCH ROM with the ROM ID of the device
+    Write,      // write arg
+    WriteData,  // write the next arg bytes of the data buffer
+    Read,       // read arg bytes into the data buffer
+    Crc         // the last arg bytes of the buffer end with their CRC8
+};
+
+struct Step
+{
+    Op op;
+    uint8_t arg;
+};
+
+/**
+*   \brief A sequence of N steps, built with the member functions.
+*/
+template <std::size_t N>
+struct Script
+{
+    Step steps[N == 0 ? 1 : N];
+    uint16_t data_size;     // bytes of the data buffer written or read
+    bool writes_config;     // writes page 0, the configuration cache of the handle gets stale
+
+    static constexpr std::size_t size = N;
+
+    constexpr Script<N + 1> then(Op op, uint8_t arg = 0) const
+    {
+        Script<N + 1> next{};
+        for (std::size_t i = 0; i < N; i++)
+            next.steps[i] = steps[i];
+        next.steps[N] = Step{op, arg};
+        next.data_size = static_cast<uint16_t>(data_size + (op == Op::WriteData || op == Op::Read ? arg : 0));
+        next.writes_config = writes_config ||
+                             (op == Op::Write && arg == 0 && N > 0 && steps[N - 1].op == Op::Write &&
+                              (steps[N - 1].arg == WRITE_SCRATCHPAD || steps[N - 1].arg == COPY_SCRATCHPAD));
+        return next;
+    }
+
+    constexpr auto reset() const { return then(Op::Reset); }
+    constexpr auto select() const { return then(Op::Select); }
+    constexpr auto write(uint8_t byte) const { return then(Op::Write, byte); }
+    constexpr auto write_data(uint8_t count) const { return then(Op::WriteData, count); }
+    constexpr auto read(uint8_t count) const { return then(Op::Read, count); }
+    constexpr auto crc(uint8_t count) const { return then(Op::Crc, count); }
+};
+
+constexpr Script<0> begin()
+{
+    return Script<0>{};
+}
+
+// ===========================================================
+//                      VALIDATION
+// ===========================================================
+
+enum class Error : uint8_t
+{
+    None,
+    Empty,
+    NoReset,            // does not start with a reset, or ROM command without reset
+    NoSelect,           // reset not followed by a ROM command
+    NoCommand,          // ROM command not followed by a function command
+    UnknownCommand,     // not a DS2438 function command
+    BadPage,            // page command without page number 0..7
+    CrcRange,           // CRC over less than 2 bytes or bytes not read in this transaction
+    TooLong             // data buffer over 255 bytes
+};
+
+/**
+*   \brief Checks the rules of a DS2438 transaction for every step:
+*   reset, ROM command, function command, page number where needed, then
+*   data. Meant for static_assert.
+*/
+template <std::size_t N>
+constexpr Error check(const Script<N>& script)
+{
+    enum class Expect { Reset, Select, Command, Page, Any };
+    Expect expect = Expect::Reset;
+    std::size_t read = 0;       // bytes read in the current transaction
+    if (N == 0)
+        return Error::Empty;
+    if (script.data_size > 255)
+        return Error::TooLong;
+    for (std::size_t i = 0; i < N; i++)
+    {
+        const Step& step = script.steps[i];
+        switch (expect)
+        {
+        case Expect::Reset:
+            if (step.op != Op::Reset)
+                return Error::NoReset;
+            break;
+        case Expect::Select:
+            if (step.op != Op::Select)
+                return Error::NoSelect;
+            break;
+        case Expect::Command:
+            if (step.op != Op::Write)
+                return Error::NoCommand;
+            if (!known_command(step.arg))
+                return Error::UnknownCommand;
+            break;
+        case Expect::Page:
+            if (step.op != Op::Write || step.arg > 7)
+                return Error::BadPage;
+            break;
+        case Expect::Any:
+            if (step.op == Op::Select)
+                return Error::NoReset;
+            break;
+        }
+        switch (step.op)
+        {
+        case Op::Reset: expect = Expect::Select; read = 0; break;
+        case Op::Select: expect = Expect::Command; break;
+        case Op::Write:
+            expect = expect == Expect::Command && takes_page(step.arg) ? Expect::Page : Expect::Any;
+            break;
+        case Op::WriteData: break;
+        case Op::Read: read += step.arg; break;
+        case Op::Crc:
+            if (step.arg < 2 || step.arg > read)
+                return Error::CrcRange;
+            break;
+        }
+    }
+    if (expect == Expect::Page)
+        return Error::BadPage;
+    return expect == Expect::Select || expect == Expect::Command ? Error::NoCommand : Error::None;
+}
+
+// ===========================================================
+//                      SCRIPTS OF THE LIBRARY
+// ===========================================================
+
+/**
+*   \brief DS2438_ReadPage(): 9 bytes out, page data and CRC.
+*/
+template <uint8_t Page>
+inline constexpr auto read_page = begin().reset().select().write(RECALL_MEMORY).write(Page)
+                                      .reset().select().write(READ_SCRATCHPAD).write(Page).read(9).crc(9);
+
+/**
+*   \brief DS2438_WritePage(): 9 bytes in.
+*/
+template <uint8_t Page>
+inline constexpr auto write_page = begin().reset().select().write(WRITE_SCRATCHPAD).write(Page).write_data(9)
+                                       .reset().select().write(COPY_SCRATCHPAD).write(Page);
+
+/**
+*   \brief DS2438_StartVoltageConversion().
+*/
+inline constexpr auto convert_voltage = begin().reset().select().write(CONVERT_V);
+
+/**
+*   \brief DS2438_StartTemperatureConversion().
+*/
+inline constexpr auto convert_temperature = begin().reset().select().write(CONVERT_T);
+
+static_assert(check(read_page<0>) == Error::None && check(read_page<7>) == Error::None);
+static_assert(check(write_page<0>) == Error::None && write_page<0>.writes_config && !write_page<1>.writes_config);
+static_assert(check(convert_voltage) == Error::None && check(convert_temperature) == Error::None);
+static_assert(check(begin().reset().select().write(READ_SCRATCHPAD).write(8)) == Error::BadPage);
+static_assert(check(begin().reset().write(CONVERT_T)) == Error::NoSelect);
+static_assert(check(begin().reset().select().write(RECALL_MEMORY).write(0).read(9).crc(9).reset().select()
+                        .write(READ_SCRATCHPAD).write(0).crc(9)) == Error::CrcRange);
+
+// ===========================================================
+//                      EXECUTOR
+// ===========================================================
+
+namespace detail {
+
+// Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1), LSB first, table in flash
+struct Crc8Table
+{
+    uint8_t value[256];
+};
+
+constexpr Crc8Table make_crc8_table()
+{
+    Crc8Table table{};
+    for (int i = 0; i < 256; i++)
+    {
+        uint8_t crc = static_cast<uint8_t>(i);
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? static_cast<uint8_t>((crc >> 1) ^ 0x8C) : static_cast<uint8_t>(crc >> 1);
+        table.value[i] = crc;
+    }
+    return table;
+}
+
+inline constexpr Crc8Table crc8_table = make_crc8_table();
+
+constexpr uint8_t crc8(const uint8_t* data, std::size_t length)
+{
+    uint8_t crc = 0;
+    for (std::size_t i = 0; i < length; i++)
+        crc = crc8_table.value[crc ^ data[i]];
+    return crc;
+}
+
+inline uint8_t execute(ds2438_t* dev, const Step* steps, std::size_t count, uint8_t* data)
+{
+    ds2438_bus_t* bus = dev->bus;
+    std::size_t pos = 0;
+    bus->device = &dev->stats.bus;
+    for (const Step* step = steps; step != steps + count; step++)
+    {
+        switch (step->op)
+        {
+        case Op::Reset:
+        {
+            int presence = reset_Onewire(bus);
+            if (presence == DS2438_BUS_FAULT)
+                return DS2438_BUS_FAULT;
+            if (presence)
+                return DS2438_DEV_NOT_FOUND;
+            break;
+        }
+        case Op::Select:
+            if (dev->rom[0] == 0)
+            {
+                OneWire_WriteByte(bus, SKIP_ROM);
+            }
+            else
+            {
+                OneWire_WriteByte(bus, MATCH_ROM);
+                for (uint8_t i = 0; i < DS2438_ROM_SIZE; i++)
+                    OneWire_WriteByte(bus, dev->rom[i]);
+            }
+            break;
+        case Op::Write:
+            OneWire_WriteByte(bus, step->arg);
+            break;
+        case Op::WriteData:
+            for (uint8_t i = 0; i < step->arg; i++)
+                OneWire_WriteByte(bus, data[pos++]);
+            break;
+        case Op::Read:
+            for (uint8_t i = 0; i < step->arg; i++)
+                data[pos++] = static_cast<uint8_t>(OneWire_ReadByte(bus));
+            break;
+        case Op::Crc:
+            if (crc8(data + pos - step->arg, step->arg - 1) != data[pos - 1])
+            {
+                bus->stats.crc_errors++;
+                dev->stats.bus.crc_errors++;
+                return DS2438_CRC_ERROR;
+            }
+            break;
+        }
+    }
+    return DS2438_OP_SUCCESS;
+}
+
+} // namespace detail
+
+/**
+*   \brief Runs the script S on the device.
+*
+*   \param data buffer for the WriteData and Read steps, checked at
+*   compile time to be large enough.
+*   \retval #DS2438_OP_SUCCESS if all steps were done
+*   \retval #DS2438_DEV_NOT_FOUND, #DS2438_BUS_FAULT or #DS2438_CRC_ERROR
+*   at the first step that failed
+*/
+template <const auto& S, std::size_t D>
+uint8_t run(ds2438_t* dev, uint8_t (&data)[D])
+{
+    static_assert(check(S) == Error::None, "invalid 1-Wire script");
+    static_assert(D >= S.data_size, "data buffer smaller than the script needs");
+    if constexpr (S.writes_config)
+        dev->config_valid = 0;  //the library reads page 0 again
+    return detail::execute(dev, S.steps, S.size, data);
+}
+
+/**
+*   \brief Runs the script S, which needs no data buffer, on the device.
+*/
+template <const auto& S>
+uint8_t run(ds2438_t* dev)
+{
+    static_assert(check(S) == Error::None, "invalid 1-Wire script");
+    static_assert(S.data_size == 0, "script needs a data buffer");
+    return detail::execute(dev, S.steps, S.size, nullptr);
+}
+
+} // namespace ds2438::script
+
+#endif
@@ -0,0 +1,363 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_api_bench.cpp
+  * @brief   Bus cost of every public DS2438 API, measured on the simulator
+  ******************************************************************************
+  * Build:
+  *     gcc -std=c99 -O2 -c ../DS2438_Library.c -o DS2438_Library.o
+  *     g++ -std=c++17 -O2 ds2438_sim.cpp ds2438_hal_sim.cpp ds2438_api_bench.cpp DS2438_Library.o -o ds2438_api_bench
+  *
+  * Usage:
+  *     ds2438_api_bench [-n calls] [-o out.json] [-d] [-b baseline.json]
+  *
+  *   -n  calls per API (default 20)
+  *   -o  write the results as JSON (default stdout)
+  *   -d  only the deterministic bus fields, for baselines
+  *   -b  compare the bus fields with a stored baseline, exit code 1 if
+  *       any API got more expensive
+  *
+  * Per API: resets, time slots and bus time per call and the worst case
+  * bus time of all calls. These come from the simulator's virtual time
+  * and are exact and repeatable. The CPU time of the driver itself can't be
+  * measured off target; host_ns is the host time per call (driver plus
+  * simulation) and is only a rough hint. The throughput section times the
+  * pure decode, CRC and formatting paths on the host.
+  *
+  * The stored baseline is bench/ds2438_api_baseline.json, made with
+  *     ds2438_api_bench -d -o bench/ds2438_api_baseline.json
+  ******************************************************************************
+  */
+
+#include "ds2438_batch.hpp"
+#include "ds2438_sim.hpp"
+
+#include "../DS2438_Library.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace sim = ds2438::sim;
+
+namespace {
+
+struct ApiResult
+{
+    std::string name;
+    uint32_t calls = 0;
+    uint32_t failed = 0;
+    double resets = 0;          // per call
+    double slots = 0;           // per call
+    double bus_us = 0;          // per call
+    double wcet_bus_us = 0;     // worst call
+    double host_ns = 0;         // per call
+    double host_ns_max = 0;
+};
+
+struct Throughput
+{
+    std::string name;
+    double ops_per_s;
+    double bytes_per_s;
+};
+
+sim::Bus* bus;
+ds2438_bus_t ow;
+ds2438_t dev;
+
+template <class F>
+ApiResult measure(const char* name, uint32_t calls, F call)
+{
+    ApiResult r;
+    r.name = name;
+    r.calls = calls;
+    uint64_t resets = bus->stats.resets, slots = bus->stats.slots;
+    sim::Time bus_start = bus->now();
+    for (uint32_t i = 0; i < calls; i++)
+    {
+        sim::Time t0 = bus->now();
+        auto h0 = std::chrono::steady_clock::now();
+        if (!call(i))
+            r.failed++;
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - h0).count();
+        r.wcet_bus_us = std::max(r.wcet_bus_us, (bus->now() - t0) / 1e3);
+        r.host_ns += ns;
+        r.host_ns_max = std::max(r.host_ns_max, ns);
+    }
+    r.resets = double(bus->stats.resets - resets) / calls;
+    r.slots = double(bus->stats.slots - slots) / calls;
+    r.bus_us = (bus->now() - bus_start) / 1e3 / calls;
+    r.host_ns /= calls;
+    return r;
+}
+
+template <class F>
+Throughput throughput(const char* name, size_t bytes_per_op, F op)
+{
+    const size_t ops = 2000000;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ops; i++)
+        op(i);
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return {name, ops / s, ops * bytes_per_op / s};
+}
+
+std::vector<ApiResult> run_apis(uint32_t n)
+{
+    std::vector<ApiResult> results;
+    uint8_t page_data[9];
+    float value;
+    int16_t raw;
+    uint8_t byte;
+    int32_t ext;
+    uint32_t seconds;
+    ds2438_lifetime_t lifetime;
+    ds2438_snapshot_t snapshot;
+    uint8_t rom[DS2438_ROM_SIZE];
+
+    auto add = [&](const char* name, auto call) { results.push_back(measure(name, n, call)); };
+
+    add("DS2438_IsDevicePresent", [](uint32_t) { return DS2438_IsDevicePresent(&dev) != 0; });
+    add("DS2438_ReadPage", [&](uint32_t i) { return DS2438_ReadPage(&dev, i % 8, page_data) == DS2438_OP_SUCCESS; });
+    add("DS2438_WritePage", [&](uint32_t i) {
+        std::memset(page_data, static_cast<int>(i), 8);
+        return DS2438_WritePage(&dev, 3 + i % 4, page_data) == DS2438_OP_SUCCESS;
+    });
+    add("DS2438_EnableIAD", [](uint32_t) { return DS2438_EnableIAD(&dev) == DS2438_OP_SUCCESS; });
+    add("DS2438_DisableIAD", [](uint32_t) { return DS2438_DisableIAD(&dev) == DS2438_OP_SUCCESS; });
+    add("DS2438_EnableCA", [](uint32_t) { return DS2438_EnableCA(&dev) == DS2438_OP_SUCCESS; });
+    add("DS2438_DisableCA", [](uint32_t) { return DS2438_DisableCA(&dev) == DS2438_OP_SUCCESS; });
+    DS2438_EnableIAD(&dev);
+    DS2438_EnableCA(&dev);
+    add("DS2438_SelectInputSource", [](uint32_t i) { return DS2438_SelectInputSource(&dev, i % 2) == DS2438_OP_SUCCESS; });
+    add("DS2438_StartVoltageConversion", [](uint32_t) { return DS2438_StartVoltageConversion(&dev) == DS2438_OP_SUCCESS; });
+    bus->delay(20 * sim::MS);
+    add("DS2438_HasVoltageData", [&](uint32_t) { return DS2438_HasVoltageData(&dev, &byte) == DS2438_OP_SUCCESS && !byte; });
+    add("DS2438_GetVoltageData", [&](uint32_t) { return DS2438_GetVoltageData(&dev, &value) == DS2438_OP_SUCCESS; });
+    add("DS2438_ReadVoltage", [&](uint32_t) { return DS2438_ReadVoltage(&dev, &value) == DS2438_OP_SUCCESS; });
+    add("DS2438_StartTemperatureConversion", [](uint32_t) { return DS2438_StartTemperatureConversion(&dev) == DS2438_OP_SUCCESS; });
+    bus->delay(20 * sim::MS);
+    add("DS2438_HasTemperatureData", [&](uint32_t) { return DS2438_HasTemperatureData(&dev, &byte) == DS2438_OP_SUCCESS && !byte; });
+    add("DS2438_GetTemperatureData", [&](uint32_t) { return DS2438_GetTemperatureData(&dev, &value) == DS2438_OP_SUCCESS; });
+    add("DS2438_ReadTemperature", [&](uint32_t) { return DS2438_ReadTemperature(&dev, &value) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetCurrentData", [&](uint32_t) { return DS2438_GetCurrentData(&dev, &value) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetCurrentRaw", [&](uint32_t) { return DS2438_GetCurrentRaw(&dev, &raw) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetCurrentOffset", [&](uint32_t) { return DS2438_GetCurrentOffset(&dev, &raw) == DS2438_OP_SUCCESS; });
+    add("DS2438_SetCurrentOffset", [](uint32_t i) { return DS2438_SetCurrentOffset(&dev, static_cast<int16_t>(i % 5)) == DS2438_OP_SUCCESS; });
+    add("DS2438_CalibrateCurrentOffset(4)", [](uint32_t) { return DS2438_CalibrateCurrentOffset(&dev, 4) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetCurrentThreshold", [&](uint32_t) { return DS2438_GetCurrentThreshold(&dev, &byte) == DS2438_OP_SUCCESS; });
+    add("DS2438_SetCurrentThreshold", [](uint32_t i) { return DS2438_SetCurrentThreshold(&dev, i % 4) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetICA", [&](uint32_t) { return DS2438_GetICA(&dev, &byte) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetCapacity_mAh", [&](uint32_t) { return DS2438_GetCapacity_mAh(&dev, &value) == DS2438_OP_SUCCESS; });
+    add("DS2438_UpdateICA", [](uint32_t) { return DS2438_UpdateICA(&dev) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetExtendedICA", [&](uint32_t) { return DS2438_GetExtendedICA(&dev, &ext) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetAccumulatedCapacity_mAh", [&](uint32_t) { return DS2438_GetAccumulatedCapacity_mAh(&dev, &value) == DS2438_OP_SUCCESS; });
+    add("DS2438_SaveICACheckpoint", [](uint32_t) { return DS2438_SaveICACheckpoint(&dev) == DS2438_OP_SUCCESS; });
+    add("DS2438_RestoreICACheckpoint", [](uint32_t) { return DS2438_RestoreICACheckpoint(&dev) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetLifetimeAccumulators", [&](uint32_t) { return DS2438_GetLifetimeAccumulators(&dev, 2000, &lifetime) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetETM", [&](uint32_t) { return DS2438_GetETM(&dev, &seconds) == DS2438_OP_SUCCESS; });
+    add("DS2438_SetETM", [](uint32_t i) { return DS2438_SetETM(&dev, 1000 + i) == DS2438_OP_SUCCESS; });
+    add("DS2438_CompensateETM", [](uint32_t) { return DS2438_CompensateETM(&dev, 1) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetDisconnectTimestamp", [&](uint32_t) { return DS2438_GetDisconnectTimestamp(&dev, &seconds) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetEndOfChargeTimestamp", [&](uint32_t) { return DS2438_GetEndOfChargeTimestamp(&dev, &seconds) == DS2438_OP_SUCCESS; });
+    add("DS2438_InitTimebase", [](uint32_t) { return DS2438_InitTimebase(&dev) == DS2438_OP_SUCCESS; });
+    add("DS2438_SyncTimebase", [](uint32_t) { return DS2438_SyncTimebase(&dev) == DS2438_OP_SUCCESS; });
+    add("DS2438_GetTimestamp_us", [](uint32_t) { return DS2438_GetTimestamp_us(&dev) != 0; });
+    add("DS2438_ReadSnapshot", [&](uint32_t) { return DS2438_ReadSnapshot(&dev, &snapshot) == DS2438_OP_SUCCESS; });
+    add("OneWire_WriteByte", [](uint32_t i) { OneWire_WriteByte(&ow, static_cast<int>(i)); return true; });
+    add("OneWire_ReadByte", [](uint32_t) { OneWire_ReadByte(&ow); return true; });
+    add("OneWire_ReadRom", [&](uint32_t) { return OneWire_ReadRom(&ow, rom) == DS2438_OP_SUCCESS; });
+    add("OneWire_SearchNext", [&](uint32_t) {
+        OneWire_SearchReset(&ow);
+        return OneWire_SearchNext(&ow, rom) == DS2438_OP_SUCCESS;
+    });
+    //addressing the device by its ROM ID costs 64 write slots per reset
+    ds2438_t matched;
+    DS2438_Init(&matched, &ow, rom, DS2438_SENSE_RESISTOR);
+    add("DS2438_ReadPage(MATCH_ROM)", [&](uint32_t i) { return DS2438_ReadPage(&matched, i % 8, page_data) == DS2438_OP_SUCCESS; });
+    return results;
+}
+
+std::vector<Throughput> run_throughput()
+{
+    std::vector<Throughput> results;
+    std::vector<uint8_t> pages(4096 * ds2438::PAGE_BYTES);
+    for (size_t i = 0; i < pages.size(); i++)
+        pages[i] = static_cast<uint8_t>(i * 131 + 7);
+    volatile float sink_f = 0;
+    volatile uint8_t sink_b = 0;
+
+    results.push_back(throughput("decode_page0", ds2438::PAGE_BYTES, [&](size_t i) {
+        float t, v, c;
+        uint8_t f;
+        ds2438::decode_page0_scalar(&pages[(i % 4096) * ds2438::PAGE_BYTES], t, v, c, f);
+        sink_f = t + v + c + f;
+    }));
+    results.push_back(throughput("crc8_page", 8, [&](size_t i) {
+        sink_b = sim::crc8(&pages[(i % 4096) * ds2438::PAGE_BYTES], 8);
+    }));
+    results.push_back(throughput("uart_put_frame_page", ds2438::PAGE_BYTES, [&](size_t i) {
+        uart_put_frame_page(&pages[(i % 4096) * ds2438::PAGE_BYTES], static_cast<uint8_t>(i % 8));
+    }));
+    results.push_back(throughput("uart_put_float", 4, [](size_t i) {
+        uart_put_float(static_cast<float>(i) * 0.001f - 500.0f, 6);
+    }));
+    (void)sink_f;
+    (void)sink_b;
+    return results;
+}
+
+void write_json(FILE* out, const std::vector<ApiResult>& apis, const std::vector<Throughput>& tp, bool deterministic)
+{
+    //one API per line, so that baselines diff line by line
+    std::fprintf(out, "{\n  \"apis\": [\n");
+    for (size_t i = 0; i < apis.size(); i++)
+    {
+        const ApiResult& r = apis[i];
+        std::fprintf(out,
+                     "    {\"name\": \"%s\", \"calls\": %u, \"failed\": %u, \"resets\": %.2f, \"slots\": %.2f, "
+                     "\"bus_us\": %.1f, \"wcet_bus_us\": %.1f",
+                     r.name.c_str(), r.calls, r.failed, r.resets, r.slots, r.bus_us, r.wcet_bus_us);
+        if (!deterministic)
+            std::fprintf(out, ", \"host_ns\": %.0f, \"host_ns_max\": %.0f", r.host_ns, r.host_ns_max);
+        std::fprintf(out, "}%s\n", i + 1 < apis.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]");
+    if (!deterministic)
+    {
+        std::fprintf(out, ",\n  \"throughput\": [\n");
+        for (size_t i = 0; i < tp.size(); i++)
+        {
+            std::fprintf(out, "    {\"name\": \"%s\", \"ops_per_s\": %.0f, \"bytes_per_s\": %.0f}%s\n",
+                         tp[i].name.c_str(), tp[i].ops_per_s, tp[i].bytes_per_s, i + 1 < tp.size() ? "," : "");
+        }
+        std::fprintf(out, "  ]");
+    }
+    std::fprintf(out, "\n}\n");
+}
+
+double field(const std::string& line, const char* key)
+{
+    std::string pattern = std::string("\"") + key + "\": ";
+    size_t pos = line.find(pattern);
+    return pos == std::string::npos ? 0 : std::strtod(line.c_str() + pos + pattern.size(), nullptr);
+}
+
+// Compare the bus fields with a baseline written by this tool, returns the number of regressions
+int compare(const char* path, const std::vector<ApiResult>& apis)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::perror(path);
+        return -1;
+    }
+    std::map<std::string, std::string> baseline;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t pos = line.find("{\"name\": \"");
+        if (pos == std::string::npos || line.find("\"resets\"") == std::string::npos)
+            continue;
+        pos += 10;
+        baseline[line.substr(pos, line.find('"', pos) - pos)] = line;
+    }
+
+    int regressions = 0;
+    for (const ApiResult& r : apis)
+    {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end())
+        {
+            std::fprintf(stderr, "new       %s\n", r.name.c_str());
+            continue;
+        }
+        const double now[] = {r.resets, r.slots, r.bus_us, r.wcet_bus_us};
+        const char* keys[] = {"resets", "slots", "bus_us", "wcet_bus_us"};
+        for (int k = 0; k < 4; k++)
+        {
+            double old = field(it->second, keys[k]);
+            //the JSON has 1-2 decimals
+            if (now[k] > old + 0.05)
+            {
+                std::fprintf(stderr, "worse     %-36s %-12s %10.2f -> %10.2f\n", r.name.c_str(), keys[k], old, now[k]);
+                regressions++;
+            }
+            else if (now[k] < old - 0.05)
+            {
+                std::fprintf(stderr, "better    %-36s %-12s %10.2f -> %10.2f\n", r.name.c_str(), keys[k], old, now[k]);
+            }
+        }
+        baseline.erase(it);
+    }
+    for (auto& entry : baseline)
+        std::fprintf(stderr, "removed   %s\n", entry.first.c_str());
+    return regressions;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    uint32_t calls = 20;
+    const char* out_path = nullptr;
+    const char* baseline = nullptr;
+    bool deterministic = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:o:db:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': calls = std::max(1, std::atoi(optarg)); break;
+        case 'o': out_path = optarg; break;
+        case 'd': deterministic = true; break;
+        case 'b': baseline = optarg; break;
+        default:
+            std::fprintf(stderr, "usage: %s [-n calls] [-o out.json] [-d] [-b baseline.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    sim::Bus sim_bus;
+    sim::Device& device = sim_bus.add_device(0x0000A1B2C3D4E5ULL);
+    device.vad = 2.5;
+    device.sense_mV = 12.0;
+    device.temperature = 21.5;
+    bus = &sim_bus;
+    sim::set_hal_bus(&sim_bus);
+    uart1_init(UART_BAUDRATE_DEFAULT);
+    init_OnewirePort(&ow);
+    DS2438_Init(&dev, &ow, nullptr, DS2438_SENSE_RESISTOR);
+
+    std::vector<ApiResult> apis = run_apis(calls);
+    std::vector<Throughput> tp;
+    if (!deterministic)
+        tp = run_throughput();
+
+    FILE* out = stdout;
+    if (out_path && !(out = std::fopen(out_path, "w")))
+    {
+        std::perror(out_path);
+        return 1;
+    }
+    write_json(out, apis, tp, deterministic);
+    if (out != stdout)
+        std::fclose(out);
+
+    if (baseline)
+    {
+        int regressions = compare(baseline, apis);
+        if (regressions < 0)
+            return 1;
+        std::fprintf(stderr, "%d regressions against %s\n", regressions, baseline);
+        return regressions ? 1 : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_batch.cpp
+  * @brief   Scalar, SSE4.1 and AVX2 kernels of the page 0 batch decoder
+  ******************************************************************************
+  * The SIMD kernels are compiled with target attributes, so no -m flags are
+  * needed; the CPU is checked at runtime.
+  ******************************************************************************
+  */
+
+#include "ds2438_batch.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DS2438_BATCH_X86 1
+#endif
+
+namespace ds2438 {
+
+namespace {
+
+void decode_scalar(const uint8_t* pages, size_t begin, size_t end, const Page0Batch& out)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        decode_page0_scalar(pages + i * PAGE_BYTES, out.temperature[i], out.voltage[i],
+                            out.current[i], out.flags[i]);
+    }
+}
+
+#ifdef DS2438_BATCH_X86
+
+// Byte 0-3 and 4-7 of a page as little endian words
+inline uint32_t load_u32(const uint8_t* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+// 4 pages per iteration: lo = bytes 0-3, hi = bytes 4-7 of every page
+__attribute__((target("sse4.1")))
+size_t decode_sse41(const uint8_t* pages, size_t count, const Page0Batch& out)
+{
+    const __m128 temp_lsb = _mm_set1_ps(0.03125f);
+    const __m128 hundred = _mm_set1_ps(100.0f);
+    const __m128 divisor = _mm_set1_ps(CURRENT_DIVISOR);
+    const __m128i three = _mm_set1_epi32(3);
+    const __m128i byte = _mm_set1_epi32(0xFF);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const uint8_t* p = pages + i * PAGE_BYTES;
+        __m128i lo = _mm_setr_epi32(load_u32(p), load_u32(p + 9), load_u32(p + 18), load_u32(p + 27));
+        __m128i hi = _mm_setr_epi32(load_u32(p + 4), load_u32(p + 13), load_u32(p + 22), load_u32(p + 31));
+
+        //temperature: bytes 1-2 as int16, arithmetic shift by 3
+        __m128i t = _mm_srai_epi32(_mm_slli_epi32(lo, 8), 19);
+        _mm_storeu_ps(out.temperature + i, _mm_mul_ps(_mm_cvtepi32_ps(t), temp_lsb));
+
+        //voltage: 2 bits of byte 4, byte 3
+        __m128i v = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(hi, three), 8), _mm_srli_epi32(lo, 24));
+        _mm_storeu_ps(out.voltage + i, _mm_div_ps(_mm_cvtepi32_ps(v), hundred));
+
+        //current: bytes 5-6 as int16, set to 0 below the threshold
+        __m128i c = _mm_srai_epi32(_mm_slli_epi32(hi, 8), 16);
+        __m128i th = _mm_srli_epi32(hi, 30);
+        __m128i limit = _mm_or_si128(
+            _mm_and_si128(_mm_cmpeq_epi32(th, _mm_set1_epi32(1)), _mm_set1_epi32(2)),
+            _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi32(th, _mm_set1_epi32(2)), _mm_set1_epi32(4)),
+                         _mm_and_si128(_mm_cmpeq_epi32(th, three), _mm_set1_epi32(8))));
+        __m128i gate = _mm_cmplt_epi32(_mm_abs_epi32(c), limit);
+        c = _mm_andnot_si128(gate, c);
+        _mm_storeu_ps(out.current + i, _mm_div_ps(_mm_cvtepi32_ps(c), divisor));
+
+        //flags: byte 0
+        __m128i f = _mm_and_si128(lo, byte);
+        f = _mm_packus_epi16(_mm_packus_epi32(f, f), f);
+        uint32_t flags = static_cast<uint32_t>(_mm_cvtsi128_si32(f));
+        std::memcpy(out.flags + i, &flags, 4);
+    }
+    return i;
+}
+
+// 8 pages per iteration, bytes 0-3 and 4-7 gathered with a stride of 9
+__attribute__((target("avx2")))
+size_t decode_avx2(const uint8_t* pages, size_t count, const Page0Batch& out)
+{
+    const __m256i stride = _mm256_setr_epi32(0, 9, 18, 27, 36, 45, 54, 63);
+    const __m256 temp_lsb = _mm256_set1_ps(0.03125f);
+    const __m256 hundred = _mm256_set1_ps(100.0f);
+    const __m256 divisor = _mm256_set1_ps(CURRENT_DIVISOR);
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i byte = _mm256_set1_epi32(0xFF);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const int* p = reinterpret_cast<const int*>(pages + i * PAGE_BYTES);
+        __m256i lo = _mm256_i32gather_epi32(p, stride, 1);
+        __m256i hi = _mm256_i32gather_epi32(reinterpret_cast<const int*>(pages + i * PAGE_BYTES + 4), stride, 1);
+
+        __m256i t = _mm256_srai_epi32(_mm256_slli_epi32(lo, 8), 19);
+        _mm256_storeu_ps(out.temperature + i, _mm256_mul_ps(_mm256_cvtepi32_ps(t), temp_lsb));
+
+        __m256i v = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(hi, three), 8), _mm256_srli_epi32(lo, 24));
+        _mm256_storeu_ps(out.voltage + i, _mm256_div_ps(_mm256_cvtepi32_ps(v), hundred));
+
+        __m256i c = _mm256_srai_epi32(_mm256_slli_epi32(hi, 8), 16);
+        __m256i th = _mm256_srli_epi32(hi, 30);
+        //limit = 1 << threshold, 0 if there is no threshold
+        __m256i limit = _mm256_andnot_si256(_mm256_cmpeq_epi32(th, zero), _mm256_sllv_epi32(one, th));
+        __m256i gate = _mm256_cmpgt_epi32(limit, _mm256_abs_epi32(c));
+        c = _mm256_andnot_si256(gate, c);
+        _mm256_storeu_ps(out.current + i, _mm256_div_ps(_mm256_cvtepi32_ps(c), divisor));
+
+        __m256i f = _mm256_and_si256(lo, byte);
+        __m128i f16 = _mm_packus_epi32(_mm256_castsi256_si128(f), _mm256_extracti128_si256(f, 1));
+        __m128i f8 = _mm_packus_epi16(f16, f16);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out.flags + i), f8);
+    }
+    return i;
+}
+
+#endif
+
+} // namespace
+
+Kernel decode_page0_batch(const uint8_t* pages, size_t count, const Page0Batch& out, Kernel kernel)
+{
+#ifdef DS2438_BATCH_X86
+    //fall back to the next kernel the CPU supports
+    if ((kernel == Kernel::Auto || kernel == Kernel::Avx2) && !__builtin_cpu_supports("avx2"))
+        kernel = (kernel == Kernel::Auto) ? Kernel::Sse41 : Kernel::Scalar;
+    if (kernel == Kernel::Auto)
+        kernel = Kernel::Avx2;
+    if (kernel == Kernel::Sse41 && !__builtin_cpu_supports("sse4.1"))
+        kernel = Kernel::Scalar;
+    size_t done = 0;
+    if (kernel == Kernel::Avx2)
+        done = decode_avx2(pages, count, out);
+    else if (kernel == Kernel::Sse41)
+        done = decode_sse41(pages, count, out);
+    //the rest that does not fill a whole vector
+    decode_scalar(pages, done, count, out);
+    return kernel;
+#else
+    decode_scalar(pages, 0, count, out);
+    return Kernel::Scalar;
+#endif
+}
+
+} // namespace ds2438
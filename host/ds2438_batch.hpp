@@ -0,0 +1,74 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_batch.hpp
+  * @brief   Batch decoder for archived raw page 0 snapshots
+  ******************************************************************************
+  * Decodes arrays of raw 9-byte page 0 buffers (as returned by
+  * DS2438_ReadPage(0, ...)) into struct-of-arrays temperature, voltage,
+  * current and flags. The conversions are those of DS2438_GetTemperatureData(),
+  * DS2438_GetVoltageData() and DS2438_GetCurrentData(), done in float.
+  * SSE4.1 and AVX2 kernels are selected at runtime and give bit-exact
+  * the same results as decode_page0_scalar().
+  ******************************************************************************
+  */
+
+#ifndef DS2438_BATCH_HPP
+#define DS2438_BATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ds2438 {
+
+constexpr size_t PAGE_BYTES = 9;
+
+/**
+*   \brief Output arrays, each with room for the number of decoded pages.
+*/
+struct Page0Batch
+{
+    float* temperature;     // C
+    float* voltage;         // V
+    float* current;         // mA, gated by the threshold in byte 7
+    uint8_t* flags;         // status/configuration byte
+};
+
+enum class Kernel
+{
+    Auto,                   // best kernel the CPU supports
+    Scalar,
+    Sse41,
+    Avx2
+};
+
+// Same constant as 4.096*DS2438_SENSE_RESISTOR in DS2438_Library.c
+constexpr float CURRENT_DIVISOR = 4.096f * 150;
+
+/**
+*   \brief Scalar reference decode of one page.
+*/
+inline void decode_page0_scalar(const uint8_t* page, float& temperature, float& voltage,
+                                float& current, uint8_t& flags)
+{
+    flags = page[0];
+    int16_t t = static_cast<int16_t>((page[2] << 8) | page[1]) >> 3;
+    temperature = static_cast<float>(t) * 0.03125f;
+    int32_t v = ((page[4] & 0x3) << 8) | page[3];
+    voltage = static_cast<float>(v) / 100.0f;
+    int32_t c = static_cast<int16_t>((page[6] << 8) | page[5]);
+    int32_t threshold = (page[7] >> 6) & 0x3;
+    if (threshold && (c < 0 ? -c : c) < (1 << threshold))
+        c = 0;
+    current = static_cast<float>(c) / CURRENT_DIVISOR;
+}
+
+/**
+*   \brief Decode count pages stored back to back (9 bytes each).
+*   \return the kernel that was used
+*/
+Kernel decode_page0_batch(const uint8_t* pages, size_t count, const Page0Batch& out,
+                          Kernel kernel = Kernel::Auto);
+
+} // namespace ds2438
+
+#endif
@@ -0,0 +1,116 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_batch_bench.cpp
+  * @brief   Bit-exactness check and benchmark of the page 0 batch decoder
+  ******************************************************************************
+  * Build:
+  *     g++ -std=c++17 -O2 ds2438_batch.cpp ds2438_batch_bench.cpp -o ds2438_batch_bench
+  *
+  * Usage:
+  *     ds2438_batch_bench [pages]
+  *
+  * Decodes random pages (plus all temperature/current corner cases) with every
+  * kernel, compares the results bit by bit with the scalar reference and
+  * reports pages per second.
+  ******************************************************************************
+  */
+
+#include "ds2438_batch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+struct Output
+{
+    std::vector<float> temperature, voltage, current;
+    std::vector<uint8_t> flags;
+
+    explicit Output(size_t n) : temperature(n), voltage(n), current(n), flags(n) {}
+
+    ds2438::Page0Batch batch()
+    {
+        return {temperature.data(), voltage.data(), current.data(), flags.data()};
+    }
+};
+
+const char* kernel_name(ds2438::Kernel kernel)
+{
+    switch (kernel)
+    {
+    case ds2438::Kernel::Scalar: return "scalar";
+    case ds2438::Kernel::Sse41: return "sse4.1";
+    case ds2438::Kernel::Avx2: return "avx2";
+    default: return "auto";
+    }
+}
+
+size_t mismatches(const Output& a, const Output& b, size_t n)
+{
+    size_t bad = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        bad += std::memcmp(&a.temperature[i], &b.temperature[i], 4) != 0 ||
+               std::memcmp(&a.voltage[i], &b.voltage[i], 4) != 0 ||
+               std::memcmp(&a.current[i], &b.current[i], 4) != 0 || a.flags[i] != b.flags[i];
+    }
+    return bad;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+    std::vector<uint8_t> pages(count * ds2438::PAGE_BYTES);
+    uint32_t seed = 12345;
+    for (uint8_t& b : pages)
+    {
+        seed = seed * 1664525 + 1013904223;
+        b = static_cast<uint8_t>(seed >> 24);
+    }
+    //every 16-bit pattern of the temperature and current registers at the start
+    for (size_t i = 0; i < 65536 && i < count; i++)
+    {
+        uint8_t* p = &pages[i * ds2438::PAGE_BYTES];
+        p[1] = p[5] = static_cast<uint8_t>(i);
+        p[2] = p[6] = static_cast<uint8_t>(i >> 8);
+    }
+
+    //scalar reference, one page at a time
+    Output reference(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        ds2438::decode_page0_scalar(&pages[i * ds2438::PAGE_BYTES], reference.temperature[i],
+                                    reference.voltage[i], reference.current[i], reference.flags[i]);
+    }
+
+    int result = 0;
+    ds2438::Kernel kernels[] = {ds2438::Kernel::Scalar, ds2438::Kernel::Sse41, ds2438::Kernel::Avx2};
+    for (ds2438::Kernel kernel : kernels)
+    {
+        if ((kernel == ds2438::Kernel::Sse41 && !__builtin_cpu_supports("sse4.1")) ||
+            (kernel == ds2438::Kernel::Avx2 && !__builtin_cpu_supports("avx2")))
+        {
+            std::printf("%-7s not supported by this CPU\n", kernel_name(kernel));
+            continue;
+        }
+        Output out(count);
+        ds2438::decode_page0_batch(pages.data(), count, out.batch(), kernel);//warm up
+        auto start = std::chrono::steady_clock::now();
+        const int runs = 5;
+        for (int r = 0; r < runs; r++)
+            ds2438::decode_page0_batch(pages.data(), count, out.batch(), kernel);
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs;
+        size_t bad = mismatches(reference, out, count);
+        std::printf("%-7s %8.1f M pages/s  %6.2f GB/s  mismatches %zu\n", kernel_name(kernel),
+                    count / s / 1e6, count * ds2438::PAGE_BYTES / s / 1e9, bad);
+        if (bad)
+            result = 1;
+    }
+    return result;
+}
@@ -0,0 +1,189 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_coro_bench.cpp
+  * @brief   Many device coroutines on one simulated bus
+  ******************************************************************************
+  * Build:
+  *     gcc -std=c99 -O2 -c ../DS2438_Library.c -o DS2438_Library.o
+  *     g++ -std=c++20 -O2 -DDS2438_CORO_FRAMES=1024 ds2438_sim.cpp ds2438_hal_sim.cpp ds2438_coro_bench.cpp DS2438_Library.o -o ds2438_coro_bench
+  *
+  * Usage:
+  *     ds2438_coro_bench [-d devices] [-n snapshots] [-f flip_ppm]
+  *
+  *   -d  devices on the bus, one coroutine each (default 200)
+  *   -n  snapshots per device (default 3)
+  *   -f  probability of a flipped device bit in ppm
+  *
+  * Every device coroutine takes its snapshots with co_await
+  * Device::read_snapshot() and checks them against the analog inputs of
+  * its model; all of them share the bus through the driver queue. The
+  * same snapshots taken one by one with the blocking DS2438_ReadSnapshot()
+  * give the reference bus time.
+  ******************************************************************************
+  */
+
+#include "ds2438_sim.hpp"
+
+#include "../DS2438_Coroutine.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <vector>
+
+namespace sim = ds2438::sim;
+
+namespace {
+
+sim::Bus* sim_bus = nullptr;
+sim::Time idle_ns = 0;          // virtual time in the idle hook of the executor
+
+struct Counts
+{
+    int done = 0;
+    int failed = 0;
+    int wrong = 0;
+};
+
+bool check(const ds2438_snapshot_t& snapshot, const sim::Device& model)
+{
+    return std::fabs(snapshot.voltage - model.vad) <= 0.006 &&
+           std::fabs(snapshot.temperature - model.temperature) <= 0.016;
+}
+
+ds2438::Task<> monitor(ds2438::Executor& executor, ds2438::Device& device, const sim::Device& model, int snapshots,
+                       Counts& counts)
+{
+    for (int i = 0; i < snapshots; i++)
+    {
+        auto snapshot = co_await device.read_snapshot();
+        if (!snapshot.ok())
+            counts.failed++;
+        else if (!check(snapshot.value, model))
+            counts.wrong++;
+        else
+            counts.done++;
+        co_await executor.sleep_for_us(1000);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int devices = 200, snapshots = 3;
+    uint32_t flip_ppm = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:n:f:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd': devices = std::max(1, std::atoi(optarg)); break;
+        case 'n': snapshots = std::atoi(optarg); break;
+        case 'f': flip_ppm = std::strtoul(optarg, nullptr, 10); break;
+        default:
+            std::fprintf(stderr, "usage: %s [-d devices] [-n snapshots] [-f flip_ppm]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (2 * devices > DS2438_CORO_FRAMES)
+    {
+        std::fprintf(stderr, "%d devices need %d coroutine frames, built with %d\n", devices, 2 * devices,
+                     DS2438_CORO_FRAMES);
+        return 1;
+    }
+
+    sim::Bus bus;
+    for (int i = 0; i < devices; i++)
+    {
+        sim::Device& model = bus.add_device(0x0000A1B2C3D4E5ULL + 0x1000 * i);
+        model.vad = 1.0 + 0.01 * (i % 300);
+        model.temperature = -20.0 + 0.0625 * (i % 1000);
+    }
+    sim::set_hal_bus(&bus);
+
+    ds2438_bus_t ow;
+    init_OnewirePort(&ow);
+    std::vector<ds2438_t> handles(devices);
+    std::vector<const sim::Device*> models(devices);
+    uint8_t rom[DS2438_ROM_SIZE];
+    int found = 0;
+    OneWire_SearchReset(&ow);
+    while (found < devices && OneWire_SearchNext(&ow, rom) == DS2438_OP_SUCCESS)
+    {
+        DS2438_Init(&handles[found], &ow, rom, DS2438_SENSE_RESISTOR);
+        DS2438_SelectInputSource(&handles[found], DS2438_INPUT_VOLTAGE_VAD);
+        for (int i = 0; i < devices; i++)
+        {
+            if (std::equal(rom, rom + DS2438_ROM_SIZE, bus.device(i).rom()))
+                models[found] = &bus.device(i);
+        }
+        found++;
+    }
+    if (found != devices)
+    {
+        std::fprintf(stderr, "SEARCH ROM found %d of %d devices\n", found, devices);
+        return 1;
+    }
+    for (int i = 0; i < devices; i++)
+        bus.device(i).faults.flip_ppm = flip_ppm;
+
+    // reference: the blocking API, one device after the other
+    Counts blocking;
+    sim::Time start = bus.now();
+    for (int n = 0; n < snapshots; n++)
+    {
+        for (int d = 0; d < devices; d++)
+        {
+            ds2438_snapshot_t snapshot;
+            if (DS2438_ReadSnapshot(&handles[d], &snapshot) != DS2438_OP_SUCCESS)
+                blocking.failed++;
+            else if (!check(snapshot, *models[d]))
+                blocking.wrong++;
+            else
+                blocking.done++;
+        }
+    }
+    sim::Time blocking_ns = bus.now() - start;
+
+    // one coroutine per device, the idle hook is the application work
+    sim_bus = &bus;
+    ds2438::Executor executor([] {
+        sim::Time before = sim_bus->now();
+        wait_10us(10);
+        idle_ns += sim_bus->now() - before;
+    });
+    std::vector<ds2438::Device> wrappers;
+    wrappers.reserve(devices);
+    Counts counts;
+    for (int d = 0; d < devices; d++)
+    {
+        wrappers.emplace_back(executor, &handles[d]);
+        if (!executor.spawn(monitor(executor, wrappers[d], *models[d], snapshots, counts)))
+        {
+            std::fprintf(stderr, "no coroutine frame for device %d\n", d);
+            return 1;
+        }
+    }
+    start = bus.now();
+    auto wall_start = std::chrono::steady_clock::now();
+    executor.run();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    sim::Time coro_ns = bus.now() - start;
+
+    int total = devices * snapshots;
+    std::printf("%d devices, %d snapshots each\n", devices, snapshots);
+    std::printf("blocking:   %6d ok, %d failed, %d wrong, %8.3f s bus time, %6.1f ms per snapshot\n", blocking.done,
+                blocking.failed, blocking.wrong, blocking_ns / 1e9, blocking_ns / 1e6 / total);
+    std::printf("coroutines: %6d ok, %d failed, %d wrong, %8.3f s bus time, %6.1f ms per snapshot, %.3f s idle\n",
+                counts.done, counts.failed, counts.wrong, coro_ns / 1e9, coro_ns / 1e6 / total, idle_ns / 1e9);
+    std::printf("frames: %zu peak of %d (%d bytes each), %zu in use after run, host time %.3f s\n",
+                ds2438::FramePool::peak(), DS2438_CORO_FRAMES, DS2438_CORO_FRAME_SIZE, ds2438::FramePool::used(),
+                wall);
+    if (ds2438::FramePool::used() != 0 || counts.wrong || blocking.wrong || (!flip_ppm && (counts.failed || blocking.failed)))
+        return 2;
+    return 0;
+}
@@ -0,0 +1,149 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_hal_sim.cpp
+  * @brief   DS2438_Hal.h on top of the DS2438 simulator
+  ******************************************************************************
+  * The pin functions act on the Bus set with set_hal_bus() for their line,
+  * delays advance the virtual time of all of them (and pass real time after set_hal_pace()) and the cycle counter runs at HAL_CPU_HZ in virtual time.
+  * UART transfers complete at once and go to the sink set with
+  * set_uart_sink().
+  ******************************************************************************
+  */
+
+#include "ds2438_sim.hpp"
+
+#include "../DS2438_Hal.h"
+
+#include <chrono>
+#include <thread>
+
+namespace ds2438::sim {
+
+namespace {
+
+Bus* hal_lines[HAL_LINES] = {};
+Bus*& hal_bus = hal_lines[0];   // clock of the HAL
+std::function<void(const char*, size_t)> uart_sink;
+double hal_pace = 0;
+double pace_debt_ns = 0;    // real time owed, slept in steps of 1 ms
+uint32_t irq_masked = 0;    // 1 between ds2438_hal_irq_disable() and ds2438_hal_irq_enable()
+
+} // namespace
+
+void set_hal_bus(Bus* bus, uint8_t line)
+{
+    hal_lines[line] = bus;
+}
+
+void set_uart_sink(std::function<void(const char*, size_t)> sink)
+{
+    uart_sink = std::move(sink);
+}
+
+void set_hal_pace(double scale)
+{
+    hal_pace = scale;
+    pace_debt_ns = 0;
+}
+
+} // namespace ds2438::sim
+
+using ds2438::sim::hal_bus;
+using ds2438::sim::hal_lines;
+using ds2438::sim::hal_pace;
+using ds2438::sim::pace_debt_ns;
+using ds2438::sim::irq_masked;
+
+extern "C" {
+
+void ds2438_hal_pin_init(uint8_t line)
+{
+    hal_lines[line]->release();
+}
+
+void ds2438_hal_pin_low(uint8_t line)
+{
+    hal_lines[line]->drive_low();
+}
+
+void ds2438_hal_pin_release(uint8_t line)
+{
+    hal_lines[line]->release();
+}
+
+int ds2438_hal_pin_read(uint8_t line)
+{
+    return hal_lines[line]->sample();
+}
+
+void ds2438_hal_delay_us(uint32_t us)
+{
+    for (ds2438::sim::Bus* bus : hal_lines)
+    {
+        if (bus)
+            bus->delay(us * ds2438::sim::US);
+    }
+    if (hal_pace > 0)
+    {
+        pace_debt_ns += hal_pace * us * 1000.0;
+        if (pace_debt_ns >= 1e6)
+        {
+            auto step = std::chrono::nanoseconds(static_cast<int64_t>(pace_debt_ns));
+            std::this_thread::sleep_for(step);
+            pace_debt_ns -= step.count();
+        }
+    }
+}
+
+uint32_t ds2438_hal_sleep_us(uint32_t us)
+{
+    //no other interrupts, the core sleeps all the time
+    ds2438_hal_delay_us(us);
+    return us;
+}
+
+void ds2438_hal_cycles_init(void)
+{
+}
+
+uint32_t ds2438_hal_cycles(void)
+{
+    //wraps like the 32-bit DWT counter
+    return static_cast<uint32_t>(hal_bus->now() * (ds2438::sim::HAL_CPU_HZ / 1000000) / ds2438::sim::US);
+}
+
+uint32_t ds2438_hal_cycles_per_s(void)
+{
+    return ds2438::sim::HAL_CPU_HZ;
+}
+
+int32_t ds2438_hal_uart_init(uint32_t baudrate)
+{
+    return baudrate ? 0 : DS2438_HAL_UART_BAD_BAUDRATE;
+}
+
+void ds2438_hal_uart_start_tx(const char* data, uint16_t length)
+{
+    if (ds2438::sim::uart_sink)
+        ds2438::sim::uart_sink(data, length);
+    uart_tx_complete();
+}
+
+int ds2438_hal_uart_tx_idle(void)
+{
+    return 1;
+}
+
+uint32_t ds2438_hal_irq_disable(void)
+{
+    uint32_t state = irq_masked;
+    irq_masked = 1;
+    return state;
+}
+
+void ds2438_hal_irq_enable(uint32_t state)
+{
+    irq_masked = state;
+}
+
+} // extern "C"
@@ -0,0 +1,509 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_ingestd.cpp
+  * @brief   Ingestion daemon for the text output of many DS2438 boards
+  ******************************************************************************
+  * Opens serial devices, ptys or FIFOs non-blocking, multiplexes them with
+  * epoll, parses the lines of the DS2438 example program (ds2438_text.hpp)
+  * and hands the typed records to a consumer thread through lock-free queues.
+  *
+  * Build:
+  *     g++ -std=c++17 -O2 -pthread ds2438_ingestd.cpp -o ds2438_ingestd
+  *
+  * Usage:
+  *     ds2438_ingestd [-t threads] [-p] /dev/ttyUSB0 /dev/ttyUSB1 ...
+  *     ds2438_ingestd [-t threads] -e boards [-r cycles/s] [-d seconds]
+  *
+  *   -t  number of epoll threads (default 1)
+  *   -p  print every record as CSV line to stdout
+  *   -e  emulate the given number of boards over ptys (load generator)
+  *   -r  output cycles per second and emulated board, 0 = as fast as possible
+  *   -d  run time in seconds with -e (default 5)
+  ******************************************************************************
+  */
+
+#include "ds2438_text.hpp"
+#include "spsc_queue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+// ===========================================================
+//                      TYPES
+// ===========================================================
+
+struct IngestRecord
+{
+    uint32_t board;
+    uint64_t read_ns;           // time the line was read from the device
+    ds2438::TextRecord record;
+};
+
+struct Board
+{
+    std::string path;
+    int fd = -1;
+    char line[256];             // incomplete line from the last read
+    size_t length = 0;
+    bool overlong = false;      // skipping an overlong line up to the next '\n'
+    bool fifo = false;          // EOF only means that no writer is connected
+};
+
+// log2 histogram of latencies in ns
+struct Histogram
+{
+    uint64_t buckets[64] = {};
+    uint64_t count = 0;
+    uint64_t max = 0;
+
+    void add(uint64_t ns)
+    {
+        buckets[ns ? 63 - __builtin_clzll(ns) : 0]++;
+        count++;
+        if (ns > max)
+            max = ns;
+    }
+
+    // upper bound of the bucket holding the given quantile
+    uint64_t quantile(double q) const
+    {
+        uint64_t target = static_cast<uint64_t>(q * count), seen = 0;
+        for (int i = 0; i < 64; i++)
+        {
+            seen += buckets[i];
+            if (seen > target)
+                return std::min<uint64_t>((2ULL << i) - 1, max);
+        }
+        return max;
+    }
+};
+
+std::atomic<bool> running{true};
+
+// per ingest thread counters, written by one thread only
+struct alignas(64) IngestStats
+{
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> lines{0};
+    std::atomic<uint64_t> parse_errors{0};
+    std::atomic<uint64_t> queue_full{0};
+};
+
+uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void on_signal(int)
+{
+    running = false;
+}
+
+// ===========================================================
+//                      DEVICES
+// ===========================================================
+
+// Raw mode for ttys, so the line discipline does not echo or translate
+void set_raw(int fd)
+{
+    termios tio;
+    if (tcgetattr(fd, &tio) != 0)
+        return;//FIFO or file
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, B921600);//UART_BAUDRATE_DEFAULT of the firmware
+    cfsetospeed(&tio, B921600);
+    tcsetattr(fd, TCSANOW, &tio);
+}
+
+int open_device(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_NOCTTY);
+    if (fd >= 0)
+        set_raw(fd);
+    return fd;
+}
+
+// ===========================================================
+//                      INGEST THREAD
+// ===========================================================
+
+void split_lines(Board& board, uint32_t id, const char* data, size_t length, uint64_t read_ns,
+                 ds2438::SpscQueue<IngestRecord>& queue, IngestStats& stats)
+{
+    const char* p = data;
+    const char* end = data + length;
+    while (p < end)
+    {
+        const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        const char* stop = nl ? nl : end;
+        size_t chunk = stop - p;
+        if (board.overlong || board.length + chunk > sizeof(board.line))
+        {
+            //line does not fit: drop it up to the next '\n'
+            board.overlong = true;
+            board.length = 0;
+        }
+        else
+        {
+            std::memcpy(board.line + board.length, p, chunk);
+            board.length += chunk;
+        }
+        if (!nl)
+            break;
+
+        if (board.overlong)
+        {
+            stats.parse_errors.fetch_add(1, std::memory_order_relaxed);
+            board.overlong = false;
+        }
+        else
+        {
+            IngestRecord item;
+            item.board = id;
+            item.read_ns = read_ns;
+            if (!ds2438::parse_line(board.line, board.line + board.length, item.record))
+                stats.parse_errors.fetch_add(1, std::memory_order_relaxed);
+            else if (item.record.kind != ds2438::LineKind::Empty && !queue.push(item))
+                stats.queue_full.fetch_add(1, std::memory_order_relaxed);
+        }
+        stats.lines.fetch_add(1, std::memory_order_relaxed);
+        board.length = 0;
+        p = nl + 1;
+    }
+}
+
+void ingest_thread(std::vector<Board>* boards, std::vector<uint32_t> ids,
+                   ds2438::SpscQueue<IngestRecord>* queue, IngestStats* stats)
+{
+    int ep = epoll_create1(0);
+    for (uint32_t id : ids)
+    {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u32 = id;
+        epoll_ctl(ep, EPOLL_CTL_ADD, (*boards)[id].fd, &ev);
+    }
+
+    char buffer[65536];
+    epoll_event events[64];
+    size_t open_count = ids.size();
+    while (running && open_count)
+    {
+        int n = epoll_wait(ep, events, 64, 100);
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t id = events[i].data.u32;
+            Board& board = (*boards)[id];
+            //edge triggered: read until the device is drained
+            for (;;)
+            {
+                ssize_t got = read(board.fd, buffer, sizeof(buffer));
+                if (got > 0)
+                {
+                    stats->bytes.fetch_add(got, std::memory_order_relaxed);
+                    split_lines(board, id, buffer, got, now_ns(), *queue, *stats);
+                    continue;
+                }
+                if (got < 0 && errno == EAGAIN)
+                    break;
+                if (got < 0 && errno == EINTR)
+                    continue;
+                if (got == 0 && board.fifo)
+                    break;//wait for the next writer
+                //EOF or error (e.g. EIO when the pty master closed)
+                epoll_ctl(ep, EPOLL_CTL_DEL, board.fd, nullptr);
+                close(board.fd);
+                board.fd = -1;
+                open_count--;
+                break;
+            }
+        }
+    }
+    close(ep);
+}
+
+// ===========================================================
+//                      CONSUMER
+// ===========================================================
+
+const char* kind_name(ds2438::LineKind kind)
+{
+    switch (kind)
+    {
+    case ds2438::LineKind::Voltage: return "V";
+    case ds2438::LineKind::Current: return "mA";
+    case ds2438::LineKind::Capacity: return "mAh";
+    case ds2438::LineKind::Temperature: return "C";
+    case ds2438::LineKind::Page: return "page";
+    case ds2438::LineKind::DevicePresent: return "present";
+    case ds2438::LineKind::DeviceNotFound: return "not_found";
+    case ds2438::LineKind::ReadError: return "read_error";
+    default: return "?";
+    }
+}
+
+struct ConsumerResult
+{
+    uint64_t records = 0;
+    Histogram latency;
+};
+
+void consumer_thread(std::vector<ds2438::SpscQueue<IngestRecord>*> queues, bool print,
+                     std::atomic<bool>* done, ConsumerResult* result)
+{
+    IngestRecord item;
+    for (;;)
+    {
+        bool any = false;
+        for (auto* queue : queues)
+        {
+            while (queue->pop(item))
+            {
+                any = true;
+                result->records++;
+                result->latency.add(now_ns() - item.read_ns);
+                if (!print)
+                    continue;
+                const ds2438::TextRecord& r = item.record;
+                if (r.kind == ds2438::LineKind::Page)
+                    std::printf("%u,page,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", item.board, r.page_number,
+                                r.page_data[0], r.page_data[1], r.page_data[2], r.page_data[3],
+                                r.page_data[4], r.page_data[5], r.page_data[6], r.page_data[7]);
+                else
+                    std::printf("%u,%s,%.8f\n", item.board, kind_name(r.kind), r.value);
+            }
+        }
+        if (!any)
+        {
+            if (done->load())
+                break;
+            std::this_thread::yield();
+        }
+    }
+}
+
+// ===========================================================
+//                      LOAD GENERATOR
+// ===========================================================
+
+// One output cycle of main.c
+std::string make_cycle(unsigned board, unsigned cycle)
+{
+    char text[1024];
+    int n = std::snprintf(text, sizeof(text),
+        "V: %f\r\nmA: %.8f\r\nRemaining Capacity in mAh: %.8f\r\nTemperature: %.8f \xC2\xB0""C\r\n"
+        "\r\nPagedata (00h-06h):\r\n",
+        3.7 + board * 0.01, -150.25 + cycle % 100, 1200.0 - cycle * 0.01, 23.53125);
+    for (unsigned page = 0; page < 7; page++)
+    {
+        n += std::snprintf(text + n, sizeof(text) - n, "Page %u content (MSB to LSB): %u %u %u %u %u %u %u %u\r\n",
+                           page, page, cycle & 0xFF, board & 0xFF, 0u, 200u, 0u, 0u, 255u);
+    }
+    return std::string(text, n);
+}
+
+// Create a pty pair, returns the master fd and the slave path
+int open_pty(std::string& slave)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+        return -1;
+    slave = ptsname(master);
+    return master;
+}
+
+void generator_thread(std::vector<int> masters, double rate, std::atomic<uint64_t>* written)
+{
+    std::vector<std::string> cycles;
+    for (unsigned b = 0; b < masters.size(); b++)
+        cycles.push_back(make_cycle(b, 0));
+    std::vector<size_t> offset(masters.size(), 0);
+    std::vector<unsigned> count(masters.size(), 0);
+    auto start = std::chrono::steady_clock::now();
+
+    while (running)
+    {
+        bool progress = false;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (unsigned b = 0; b < masters.size(); b++)
+        {
+            if (rate > 0 && offset[b] == 0 && count[b] >= elapsed * rate)
+                continue;//board is ahead of its rate
+            const std::string& text = cycles[b];
+            ssize_t n = write(masters[b], text.data() + offset[b], text.size() - offset[b]);
+            if (n <= 0)
+                continue;//pty buffer full
+            progress = true;
+            written->fetch_add(n, std::memory_order_relaxed);
+            offset[b] += n;
+            if (offset[b] == text.size())
+            {
+                offset[b] = 0;
+                cycles[b] = make_cycle(b, ++count[b]);
+            }
+        }
+        if (!progress)
+            std::this_thread::sleep_for(std::chrono::microseconds(rate > 0 ? 500 : 50));
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    unsigned threads = 1, emulate = 0;
+    double rate = 0, duration = 5;
+    bool print = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:pe:r:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't': threads = std::max(1, std::atoi(optarg)); break;
+        case 'p': print = true; break;
+        case 'e': emulate = std::atoi(optarg); break;
+        case 'r': rate = std::atof(optarg); break;
+        case 'd': duration = std::atof(optarg); break;
+        default:
+            std::fprintf(stderr, "usage: %s [-t threads] [-p] [-e boards [-r rate] [-d s]] [devices...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    std::vector<Board> boards;
+    std::vector<int> masters;
+    for (unsigned i = 0; i < emulate; i++)
+    {
+        Board board;
+        int master = open_pty(board.path);
+        if (master < 0)
+        {
+            std::perror("posix_openpt");
+            return 1;
+        }
+        fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+        masters.push_back(master);
+        boards.push_back(board);
+    }
+    for (int i = optind; i < argc; i++)
+    {
+        Board board;
+        board.path = argv[i];
+        boards.push_back(board);
+    }
+    if (boards.empty())
+    {
+        std::fprintf(stderr, "no devices given\n");
+        return 1;
+    }
+    for (Board& board : boards)
+    {
+        board.fd = open_device(board.path);
+        struct stat st;
+        board.fifo = board.fd >= 0 && fstat(board.fd, &st) == 0 && S_ISFIFO(st.st_mode);
+        if (board.fd < 0)
+        {
+            std::fprintf(stderr, "%s: %s\n", board.path.c_str(), std::strerror(errno));
+            return 1;
+        }
+    }
+
+    //boards are distributed round robin over the ingest threads,
+    //every thread has its own queue to the consumer
+    threads = std::min<unsigned>(threads, boards.size());
+    std::vector<std::unique_ptr<ds2438::SpscQueue<IngestRecord>>> queues;
+    std::vector<ds2438::SpscQueue<IngestRecord>*> queue_ptrs;
+    std::vector<IngestStats> stats(threads);
+    std::vector<std::thread> ingest;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        queues.emplace_back(new ds2438::SpscQueue<IngestRecord>(1 << 16));
+        queue_ptrs.push_back(queues.back().get());
+    }
+    for (unsigned t = 0; t < threads; t++)
+    {
+        std::vector<uint32_t> ids;
+        for (uint32_t id = t; id < boards.size(); id += threads)
+            ids.push_back(id);
+        ingest.emplace_back(ingest_thread, &boards, ids, queues[t].get(), &stats[t]);
+    }
+
+    std::atomic<bool> consumer_done{false};
+    ConsumerResult result;
+    std::thread consumer(consumer_thread, queue_ptrs, print, &consumer_done, &result);
+
+    std::atomic<uint64_t> written{0};
+    std::thread generator;
+    if (emulate)
+        generator = std::thread(generator_thread, masters, rate, &written);
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t last_lines = 0;
+    while (running)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uint64_t lines = 0;
+        for (IngestStats& s : stats)
+            lines += s.lines.load();
+        std::fprintf(stderr, "%.0f s: %llu lines/s\n", elapsed, static_cast<unsigned long long>(lines - last_lines));
+        last_lines = lines;
+        if (emulate && elapsed >= duration)
+            running = false;
+    }
+
+    if (generator.joinable())
+        generator.join();
+    for (std::thread& t : ingest)
+        t.join();
+    consumer_done = true;
+    consumer.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t bytes = 0, lines = 0, errors = 0, full = 0;
+    for (IngestStats& s : stats)
+    {
+        bytes += s.bytes.load();
+        lines += s.lines.load();
+        errors += s.parse_errors.load();
+        full += s.queue_full.load();
+    }
+    std::fprintf(stderr,
+                 "boards %zu, threads %u, %.1f s\n"
+                 "bytes %llu (%.1f MB/s), lines %llu (%.0f lines/s), records %llu\n"
+                 "parse errors %llu, queue full drops %llu\n"
+                 "latency read->consumer: p50 < %llu ns, p99 < %llu ns, max %llu ns\n",
+                 boards.size(), threads, elapsed,
+                 static_cast<unsigned long long>(bytes), bytes / elapsed / 1e6,
+                 static_cast<unsigned long long>(lines), lines / elapsed,
+                 static_cast<unsigned long long>(result.records),
+                 static_cast<unsigned long long>(errors), static_cast<unsigned long long>(full),
+                 static_cast<unsigned long long>(result.latency.quantile(0.5)),
+                 static_cast<unsigned long long>(result.latency.quantile(0.99)),
+                 static_cast<unsigned long long>(result.latency.max));
+    for (int master : masters)
+        close(master);
+    return 0;
+}
@@ -0,0 +1,345 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_library_check.cpp
+  * @brief   Edge cases of the DS2438 Library on the simulator
+  ******************************************************************************
+  * Build:
+  *     gcc -std=c99 -O2 -c ../DS2438_Library.c -o DS2438_Library.o
+  *     g++ -std=c++17 -O2 ds2438_sim.cpp ds2438_hal_sim.cpp ds2438_library_check.cpp DS2438_Library.o -o ds2438_library_check
+  *
+  * Usage:
+  *     ds2438_library_check
+  *
+  * Puts the registers of a simulated device into states the example
+  * program does not reach and checks how the library handles them.
+  ******************************************************************************
+  */
+
+#include "ds2438_sim.hpp"
+
+#include "../DS2438_Library.h"
+#include "../DS2438_Hal.h"
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+namespace sim = ds2438::sim;
+
+namespace {
+
+int errors = 0;
+
+void expect(bool ok, const char* what)
+{
+    if (!ok)
+    {
+        std::fprintf(stderr, "%s\n", what);
+        errors++;
+    }
+}
+
+// Registers set by hand, the model must not update them
+void set_ica(sim::Bus& bus, sim::Device& model, uint8_t ica, int16_t current)
+{
+    model.memory(1, bus.now())[4] = ica;
+    model.memory(0, bus.now())[5] = static_cast<uint8_t>(current);
+    model.memory(0, bus.now())[6] = static_cast<uint8_t>(static_cast<uint16_t>(current) >> 8);
+}
+
+// DS2438_UpdateICA(): small steps against the sign of the current, wraps
+void check_ica(sim::Bus& bus, sim::Device& model, ds2438_t* dev)
+{
+    int32_t ica_ext = 0;
+    expect(DS2438_DisableIAD(dev) == DS2438_OP_SUCCESS, "DS2438_DisableIAD failed");
+
+    set_ica(bus, model, 10, -1);
+    expect(DS2438_UpdateICA(dev) == DS2438_OP_SUCCESS, "DS2438_UpdateICA failed");
+    //ICA up by 1 LSB while the current reads slightly negative
+    set_ica(bus, model, 11, -1);
+    DS2438_UpdateICA(dev);
+    expect(DS2438_GetExtendedICA(dev, &ica_ext) == DS2438_OP_SUCCESS && ica_ext == 11,
+           "ICA +1 with a negative current is not +1");
+    //and down by 1 LSB while it reads slightly positive
+    set_ica(bus, model, 10, 1);
+    DS2438_UpdateICA(dev);
+    DS2438_GetExtendedICA(dev, &ica_ext);
+    expect(ica_ext == 10, "ICA -1 with a positive current is not -1");
+
+    //steps over half the register range follow the current
+    set_ica(bus, model, 160, 500);
+    DS2438_UpdateICA(dev);
+    DS2438_GetExtendedICA(dev, &ica_ext);
+    expect(ica_ext == 160, "ICA +150 while charging is not +150");
+    set_ica(bus, model, 10, -500);
+    DS2438_UpdateICA(dev);
+    DS2438_GetExtendedICA(dev, &ica_ext);
+    expect(ica_ext == 10, "ICA -150 while discharging is not -150");
+    set_ica(bus, model, 5, 500);
+    DS2438_UpdateICA(dev);
+    set_ica(bus, model, 105, 500);
+    DS2438_UpdateICA(dev);
+    DS2438_GetExtendedICA(dev, &ica_ext);
+    expect(ica_ext == 105, "ICA -5, +100 is not 105");
+
+    DS2438_EnableIAD(dev);
+}
+
+// DS2438_SetETM() and DS2438_CompensateETM() with IAD on: ICA, offset and IAD stay
+void check_etm(sim::Bus& bus, sim::Device& model, ds2438_t* dev)
+{
+    uint32_t etm = 0;
+    uint8_t page[9];
+    set_ica(bus, model, 77, 0);
+    model.memory(1, bus.now())[5] = 0x28;//offset 5
+    model.memory(1, bus.now())[6] = 0x00;
+    model.memory(0, bus.now())[0] |= 0x01;
+    expect(DS2438_SetETM(dev, 5000) == DS2438_OP_SUCCESS, "DS2438_SetETM failed");
+    expect(DS2438_CompensateETM(dev, -100) == DS2438_OP_SUCCESS, "DS2438_CompensateETM failed");
+    expect(DS2438_GetETM(dev, &etm) == DS2438_OP_SUCCESS && etm >= 4900 && etm <= 4901,
+           "ETM not set and corrected");
+    expect(DS2438_ReadPage(dev, 0x01, page) == DS2438_OP_SUCCESS && page[4] == 77 && page[5] == 0x28,
+           "DS2438_SetETM changed ICA or offset");
+    expect(DS2438_ReadPage(dev, 0x00, page) == DS2438_OP_SUCCESS && (page[0] & 0x01), "DS2438_SetETM left IAD off");
+}
+
+// Difference between the timestamp and the ETM in s
+double timebase_error(ds2438_t* dev)
+{
+    uint32_t etm = 0;
+    DS2438_GetETM(dev, &etm);
+    return DS2438_GetTimestamp_us(dev) / 1e6 - etm;
+}
+
+// DS2438_SyncTimebase(): ETM set back and forward, days of uptime
+void check_timebase(ds2438_t* dev)
+{
+    expect(DS2438_SetETM(dev, 100000) == DS2438_OP_SUCCESS, "DS2438_SetETM failed");
+    expect(DS2438_InitTimebase(dev) == DS2438_OP_SUCCESS, "DS2438_InitTimebase failed");
+    for (int i = 0; i < 3; i++)
+    {
+        ds2438_hal_delay_us(50000000);
+        DS2438_SyncTimebase(dev);
+    }
+    double error = timebase_error(dev);
+    expect(error >= -1 && error <= 1, "timestamp differs from the ETM");
+
+    DS2438_SetETM(dev, 1000);
+    DS2438_SyncTimebase(dev);
+    error = timebase_error(dev);
+    expect(error >= -1 && error <= 1, "timestamp does not follow the ETM back");
+    ds2438_hal_delay_us(50000000);
+    DS2438_SyncTimebase(dev);
+    error = timebase_error(dev);
+    expect(error >= -1 && error <= 1, "timestamp wrong after the ETM went back");
+
+    DS2438_SetETM(dev, 5000000);
+    DS2438_SyncTimebase(dev);
+    error = timebase_error(dev);
+    expect(error >= -1 && error <= 1, "timestamp does not follow the ETM forward");
+
+    //80 h, longer than tb_cycles * 1000000 would last without folding
+    uint64_t last_us = DS2438_GetTimestamp_us(dev);
+    bool monotonic = true;
+    for (int i = 0; i < 80 * 72; i++)
+    {
+        ds2438_hal_delay_us(50000000);
+        DS2438_SyncTimebase(dev);
+        uint64_t now_us = DS2438_GetTimestamp_us(dev);
+        monotonic = monotonic && now_us > last_us;
+        last_us = now_us;
+    }
+    error = timebase_error(dev);
+    expect(monotonic && error >= -1 && error <= 1, "timestamp wrong after 80 h");
+}
+
+// DS2438_CalibrateCurrentOffset(): a failure at any point keeps the old offset and configuration
+void check_calibration(sim::Bus& bus, sim::Device& model, ds2438_t* dev)
+{
+    int16_t offset = 0;
+    uint8_t page[9], config = 0;
+    DS2438_EnableIAD(dev);
+    DS2438_DisableCA(dev);
+    DS2438_SetCurrentOffset(dev, 5);
+    if (DS2438_ReadPage(dev, 0, page) == DS2438_OP_SUCCESS)
+        config = page[0] & 0x0F;
+
+    uint64_t resets = bus.stats.resets;
+    expect(DS2438_CalibrateCurrentOffset(dev, 2) == DS2438_OP_SUCCESS, "DS2438_CalibrateCurrentOffset failed");
+    uint32_t calibration_resets = static_cast<uint32_t>(bus.stats.resets - resets);
+    int failures = 0;
+    for (uint32_t k = 0; k < calibration_resets; k++)
+    {
+        DS2438_SetCurrentOffset(dev, 5);
+        //every byte of more reads than the CRC retries inverted, starting after k resets
+        model.faults.delay_resets = k;
+        model.faults.flip_next_bits = 9 * 8 * (DS2438_RETRY_CRC_DEFAULT + 1);
+        uint8_t result = DS2438_CalibrateCurrentOffset(dev, 2);
+        model.faults.delay_resets = 0;
+        model.faults.flip_next_bits = 0;
+        if (result == DS2438_OP_SUCCESS)
+            continue;
+        failures++;
+        expect(DS2438_GetCurrentOffset(dev, &offset) == DS2438_OP_SUCCESS && offset == 5,
+               "failed calibration does not restore the offset");
+        expect(DS2438_ReadPage(dev, 0, page) == DS2438_OP_SUCCESS && (page[0] & 0x0F) == config,
+               "failed calibration does not restore the configuration");
+    }
+    expect(failures > 0, "no calibration failed");
+    DS2438_SetCurrentOffset(dev, 0);
+    DS2438_EnableCA(dev);
+}
+
+// DS2438_HasVoltageData(), DS2438_HasTemperatureData(): a failed read is not "done"
+void check_busy(sim::Device& model, ds2438_t* dev)
+{
+    uint8_t busy = 2;
+    DS2438_StartVoltageConversion(dev);
+    expect(DS2438_HasVoltageData(dev, &busy) == DS2438_OP_SUCCESS && busy == 1, "voltage conversion not busy");
+    ds2438_hal_delay_us(10000);
+    expect(DS2438_HasVoltageData(dev, &busy) == DS2438_OP_SUCCESS && busy == 0, "voltage conversion still busy");
+    DS2438_StartTemperatureConversion(dev);
+    expect(DS2438_HasTemperatureData(dev, &busy) == DS2438_OP_SUCCESS && busy == 1, "temperature conversion not busy");
+
+    //device gone during the conversion
+    busy = 2;
+    model.faults.skip_presence = 100;
+    expect(DS2438_HasTemperatureData(dev, &busy) == DS2438_DEV_NOT_FOUND && busy == 2,
+           "DS2438_HasTemperatureData without device does not fail");
+    expect(DS2438_HasVoltageData(dev, &busy) == DS2438_DEV_NOT_FOUND && busy == 2,
+           "DS2438_HasVoltageData without device does not fail");
+    model.faults.skip_presence = 0;
+}
+
+// The blocking page write returns once the EEPROM is programmed (NVB, 0x20, cleared)
+void check_write(ds2438_t* dev)
+{
+    uint8_t page[9] = {1, 2, 3, 4, 5, 6, 7, 8}, config[9];
+    expect(DS2438_WritePage(dev, 0x03, page) == DS2438_OP_SUCCESS, "DS2438_WritePage failed");
+    expect(DS2438_ReadPage(dev, 0x00, config) == DS2438_OP_SUCCESS && !(config[0] & 0x20),
+           "DS2438_WritePage returned while the EEPROM is programmed");
+}
+
+void on_page(ds2438_t*, uint8_t status, const ds2438_async_result_t*, void* context)
+{
+    *static_cast<uint8_t*>(context) = status;
+}
+
+// Queueing a request from a critical section must leave interrupts disabled
+void check_irq(ds2438_t* dev)
+{
+    uint8_t status = DS2438_BUSY;
+    uint32_t outer = ds2438_hal_irq_disable();
+    expect(DS2438_ReadPageAsync(dev, 0x03, on_page, &status) == DS2438_OP_SUCCESS, "DS2438_ReadPageAsync failed");
+    uint32_t inner = ds2438_hal_irq_disable();
+    expect(outer == 0 && inner != 0, "DS2438_ReadPageAsync enabled interrupts in a critical section");
+    ds2438_hal_irq_enable(inner);
+    ds2438_hal_irq_enable(outer);
+    for (int i = 0; i < 10 && status == DS2438_BUSY; i++)
+        DS2438_Poll();
+    expect(status == DS2438_OP_SUCCESS, "queued page read failed");
+}
+
+// Text of uart_put_float(value, decimals)
+std::string put_float(float value, uint8_t decimals)
+{
+    std::string text;
+    sim::set_uart_sink([&](const char* data, size_t length) { text.append(data, length); });
+    uart_put_float(value, decimals);
+    sim::set_uart_sink(nullptr);
+    return text;
+}
+
+// uart_put_float(): rounding, non-finite and out of range values
+void check_float()
+{
+    expect(put_float(23.53125f, 6) == "23.531250", "uart_put_float(23.53125, 6)");
+    expect(put_float(-12.345678f, 3) == "-12.346", "uart_put_float(-12.345678, 3)");
+    expect(put_float(-0.25f, 1) == "-0.3", "uart_put_float(-0.25, 1)");
+    expect(put_float(0.9999999f, 2) == "1.00", "uart_put_float(0.9999999, 2)");
+    expect(put_float(16777216.0f, 0) == "16777216", "uart_put_float(2^24, 0)");
+    expect(put_float(NAN, 2) == "nan", "uart_put_float(NaN)");
+    expect(put_float(INFINITY, 2) == "inf", "uart_put_float(inf)");
+    expect(put_float(-INFINITY, 2) == "-inf", "uart_put_float(-inf)");
+    std::string big = put_float(1e30f, 9);
+    expect(big.size() == 20 && big.compare(0, 3, "920") == 0, "uart_put_float(1e30, 9) not clamped");
+    big = put_float(-1e30f, 0);
+    expect(big.size() == 20 && big.compare(0, 3, "-92") == 0, "uart_put_float(-1e30, 0) not clamped");
+}
+
+// Pause of an absent device and of a stuck bus, ended by a call 2^31 cycles or more after it
+void check_deadlines(sim::Bus& bus, sim::Device& model, ds2438_t* dev)
+{
+    uint8_t page[9];
+    ds2438_hal_delay_us(DS2438_BACKOFF_MAX_MS_DEFAULT * 1000);//end the pause of check_busy()
+    expect(DS2438_ReadPage(dev, 1, page) == DS2438_OP_SUCCESS, "device not back after its pause");
+    model.faults.skip_presence = DS2438_RETRY_PRESENCE_DEFAULT + 1;
+    expect(DS2438_ReadPage(dev, 1, page) == DS2438_DEV_NOT_FOUND, "absent device found");
+    uint64_t resets = bus.stats.resets;
+    expect(DS2438_ReadPage(dev, 1, page) == DS2438_DEV_NOT_FOUND && bus.stats.resets == resets,
+           "absent device not left alone during the pause");
+    ds2438_hal_delay_us(40000000);//2.88e9 cycles at 72 MHz
+    expect(DS2438_ReadPage(dev, 1, page) == DS2438_OP_SUCCESS, "device still paused 40 s after its pause");
+
+    bus.set_stuck_low(true);
+    expect(reset_Onewire(dev->bus) == DS2438_BUS_FAULT, "stuck bus not detected");
+    bus.set_stuck_low(false);
+    expect(reset_Onewire(dev->bus) == DS2438_BUS_FAULT, "stuck bus not left alone until the recheck");
+    ds2438_hal_delay_us(40000000);
+    expect(reset_Onewire(dev->bus) == 0, "bus still stuck 40 s after the recheck time");
+}
+
+// Two buses on two lines of the HAL: each device is read on its own wire
+void check_lines(sim::Bus& bus, sim::Device& model, ds2438_t* dev)
+{
+    sim::Bus second;
+    sim::Device& other = second.add_device(0x0000F1F2F3F4F5ULL);
+    other.vad = 2.5;
+    model.vad = 1.5;
+    sim::set_hal_bus(&second, 1);
+    ds2438_bus_t ow;
+    ds2438_t dev2;
+    OneWire_InitBus(&ow, 1);
+    DS2438_Init(&dev2, &ow, nullptr, DS2438_SENSE_RESISTOR);
+    DS2438_SelectInputSource(dev, DS2438_INPUT_VOLTAGE_VAD);
+    DS2438_SelectInputSource(&dev2, DS2438_INPUT_VOLTAGE_VAD);
+
+    float voltage = 0, voltage2 = 0;
+    uint64_t resets = bus.stats.resets, resets2 = second.stats.resets;
+    expect(DS2438_ReadVoltage(&dev2, &voltage2) == DS2438_OP_SUCCESS && std::fabs(voltage2 - 2.5) < 0.006,
+           "device on line 1 not read");
+    expect(bus.stats.resets == resets && second.stats.resets > resets2, "line 1 drives the wire of line 0");
+    resets2 = second.stats.resets;
+    expect(DS2438_ReadVoltage(dev, &voltage) == DS2438_OP_SUCCESS && std::fabs(voltage - 1.5) < 0.006,
+           "device on line 0 not read");
+    expect(second.stats.resets == resets2, "line 0 drives the wire of line 1");
+    sim::set_hal_bus(nullptr, 1);
+}
+
+} // namespace
+
+int main()
+{
+    sim::Bus bus;
+    sim::Device& model = bus.add_device(0x0000A1B2C3D4E5ULL);
+    sim::set_hal_bus(&bus);
+
+    ds2438_bus_t ow;
+    ds2438_t dev;
+    init_OnewirePort(&ow);
+    DS2438_Init(&dev, &ow, nullptr, DS2438_SENSE_RESISTOR);
+
+    check_ica(bus, model, &dev);
+    check_etm(bus, model, &dev);
+    check_timebase(&dev);
+    check_calibration(bus, model, &dev);
+    check_write(&dev);
+    check_irq(&dev);
+    check_busy(model, &dev);
+    check_deadlines(bus, model, &dev);
+    check_lines(bus, model, &dev);
+    check_float();
+
+    std::printf("%s, %d errors\n", errors ? "FAILED" : "ok", errors);
+    return errors ? 2 : 0;
+}
@@ -0,0 +1,288 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_logparse.cpp
+  * @brief   Parallel parser for text logs of the DS2438 example program
+  ******************************************************************************
+  * Parses logs of the text UART output (main.c, uart_put_page_content())
+  * at close to disk speed: the file is mapped, split into one chunk per
+  * thread, lines are found with memchr and parsed by ds2438_text.hpp
+  * without strtod or locale.
+  *
+  * A chunk owns every line that starts inside it, the last line of a chunk
+  * is read beyond the chunk end (boundary stitching). Damaged lines, e.g.
+  * two lines run together after a lost "\r\n", are resynchronised at the
+  * last record prefix inside the line. Errors are reported with their
+  * byte offset in the file.
+  *
+  * Build:
+  *     g++ -std=c++17 -O2 -pthread ds2438_logparse.cpp -o ds2438_logparse
+  *
+  * Usage:
+  *     ds2438_logparse [-t threads] [-c] [-e max_errors] <logfile>
+  *
+  *   -t  number of threads (default: all cores)
+  *   -c  write the records as CSV lines to stdout, in file order
+  *   -e  number of errors to list (default 20)
+  ******************************************************************************
+  */
+
+#include "ds2438_text.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr int KINDS = static_cast<int>(ds2438::LineKind::Invalid) + 1;
+
+const char* const KIND_NAMES[KINDS] = {
+    "empty", "V", "mA", "mAh", "C", "page", "present", "not_found", "read_error", "invalid"};
+
+struct ParseError
+{
+    size_t offset;
+    const char* reason;
+};
+
+struct ChunkResult
+{
+    uint64_t lines = 0;
+    uint64_t kinds[KINDS] = {};
+    uint64_t recovered = 0;
+    double min[KINDS], max[KINDS], sum[KINDS];
+    std::vector<ParseError> errors;     // first max_errors errors of the chunk
+    uint64_t error_count = 0;
+    std::string csv;
+
+    ChunkResult()
+    {
+        std::fill(min, min + KINDS, 1e300);
+        std::fill(max, max + KINDS, -1e300);
+        std::fill(sum, sum + KINDS, 0.0);
+    }
+};
+
+// Prefixes a record can start with, used to resynchronise damaged lines
+const char* const PREFIXES[] = {"V: ", "mA: ", "Remaining Capacity in mAh: ", "Temperature: ", "Page "};
+
+// Start of the last record prefix after the beginning of the line, or nullptr
+const char* find_resync(const char* p, const char* end)
+{
+    const char* best = nullptr;
+    for (const char* prefix : PREFIXES)
+    {
+        size_t length = std::strlen(prefix);
+        for (const char* q = p + 1; q + length <= end; q++)
+        {
+            q = static_cast<const char*>(std::memchr(q, prefix[0], end - q));
+            if (!q || q + length > end)
+                break;
+            if (std::memcmp(q, prefix, length) == 0 && (!best || q > best))
+                best = q;
+        }
+    }
+    return best;
+}
+
+void add_error(ChunkResult& r, size_t max_errors, size_t offset, const char* reason)
+{
+    r.error_count++;
+    if (r.errors.size() < max_errors)
+        r.errors.push_back({offset, reason});
+}
+
+void append_csv(std::string& csv, const ds2438::TextRecord& record, size_t offset)
+{
+    char text[128];
+    int n;
+    if (record.kind == ds2438::LineKind::Page)
+        n = std::snprintf(text, sizeof(text), "%zu,page,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", offset, record.page_number,
+                          record.page_data[0], record.page_data[1], record.page_data[2], record.page_data[3],
+                          record.page_data[4], record.page_data[5], record.page_data[6], record.page_data[7]);
+    else
+        n = std::snprintf(text, sizeof(text), "%zu,%s,%.8f\n", offset,
+                          KIND_NAMES[static_cast<int>(record.kind)], record.value);
+    csv.append(text, n);
+}
+
+// Parse all lines that start in [begin, end) of the file
+void parse_chunk(const char* file, size_t file_size, size_t begin, size_t end, bool csv,
+                 size_t max_errors, ChunkResult* r)
+{
+    const char* base = file;
+    const char* file_end = file + file_size;
+    const char* p = base + begin;
+    //the line crossing into this chunk belongs to the previous one
+    if (begin > 0 && base[begin - 1] != '\n')
+    {
+        const char* nl = static_cast<const char*>(std::memchr(p, '\n', file_end - p));
+        p = nl ? nl + 1 : file_end;
+    }
+
+    ds2438::TextRecord record;
+    while (p < base + end)
+    {
+        const char* nl = static_cast<const char*>(std::memchr(p, '\n', file_end - p));
+        const char* line_end = nl ? nl : file_end;
+        size_t offset = p - base;
+        r->lines++;
+
+        if (!nl)
+        {
+            //last line of the file without line ending: written while the board was reset,
+            //any field may be cut off
+            add_error(*r, max_errors, offset, "truncated line at end of file");
+            record.kind = ds2438::LineKind::Invalid;
+        }
+        else if (ds2438::parse_line(p, line_end, record))
+        {
+        }
+        else if (const char* resync = find_resync(p, line_end))
+        {
+            add_error(*r, max_errors, offset, "damaged line, resynchronised");
+            if (ds2438::parse_line(resync, line_end, record))
+            {
+                r->recovered++;
+                offset = resync - base;
+            }
+        }
+        else
+        {
+            add_error(*r, max_errors, offset, "invalid line");
+        }
+
+        int kind = static_cast<int>(record.kind);
+        r->kinds[kind]++;
+        if (record.kind >= ds2438::LineKind::Voltage && record.kind <= ds2438::LineKind::Temperature)
+        {
+            r->min[kind] = std::min(r->min[kind], record.value);
+            r->max[kind] = std::max(r->max[kind], record.value);
+            r->sum[kind] += record.value;
+        }
+        if (csv && record.kind != ds2438::LineKind::Empty && record.kind != ds2438::LineKind::Invalid)
+            append_csv(r->csv, record, offset);
+        p = nl ? nl + 1 : file_end;
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    bool csv = false;
+    size_t max_errors = 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:ce:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't': threads = std::max(1, std::atoi(optarg)); break;
+        case 'c': csv = true; break;
+        case 'e': max_errors = std::strtoull(optarg, nullptr, 10); break;
+        default:
+            std::fprintf(stderr, "usage: %s [-t threads] [-c] [-e max_errors] <logfile>\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        std::fprintf(stderr, "usage: %s [-t threads] [-c] [-e max_errors] <logfile>\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        std::perror(argv[optind]);
+        return 1;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size == 0)
+    {
+        std::fprintf(stderr, "empty file\n");
+        return 0;
+    }
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        std::perror("mmap");
+        return 1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    const char* file = static_cast<const char*>(map);
+
+    //more chunks than threads would only help with uneven lines; equal sizes suffice
+    size_t chunks = std::min<size_t>(threads, std::max<size_t>(1, size / (1 << 20)));
+    std::vector<ChunkResult> results(chunks);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t c = 0; c < chunks; c++)
+    {
+        size_t begin = size * c / chunks;
+        size_t end = size * (c + 1) / chunks;
+        workers.emplace_back(parse_chunk, file, size, begin, end, csv, max_errors, &results[c]);
+    }
+    for (std::thread& t : workers)
+        t.join();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    ChunkResult total;
+    std::vector<ParseError> errors;
+    for (ChunkResult& r : results)
+    {
+        if (csv)
+            std::fwrite(r.csv.data(), 1, r.csv.size(), stdout);
+        total.lines += r.lines;
+        total.recovered += r.recovered;
+        total.error_count += r.error_count;
+        for (int k = 0; k < KINDS; k++)
+        {
+            total.kinds[k] += r.kinds[k];
+            total.min[k] = std::min(total.min[k], r.min[k]);
+            total.max[k] = std::max(total.max[k], r.max[k]);
+            total.sum[k] += r.sum[k];
+        }
+        errors.insert(errors.end(), r.errors.begin(), r.errors.end());
+    }
+
+    std::fprintf(stderr, "%zu bytes, %llu lines in %.3f s (%.2f GB/s, %.1f M lines/s, %zu threads)\n", size,
+                 static_cast<unsigned long long>(total.lines), s, size / s / 1e9, total.lines / s / 1e6, chunks);
+    for (int k = 0; k < KINDS; k++)
+    {
+        if (!total.kinds[k])
+            continue;
+        std::fprintf(stderr, "  %-10s %12llu", KIND_NAMES[k], static_cast<unsigned long long>(total.kinds[k]));
+        if (k >= static_cast<int>(ds2438::LineKind::Voltage) && k <= static_cast<int>(ds2438::LineKind::Temperature))
+            std::fprintf(stderr, "  min %.4f max %.4f mean %.4f", total.min[k], total.max[k],
+                         total.sum[k] / total.kinds[k]);
+        std::fprintf(stderr, "\n");
+    }
+    std::fprintf(stderr, "errors %llu, recovered %llu\n", static_cast<unsigned long long>(total.error_count),
+                 static_cast<unsigned long long>(total.recovered));
+    std::sort(errors.begin(), errors.end(), [](const ParseError& a, const ParseError& b) { return a.offset < b.offset; });
+    for (size_t i = 0; i < errors.size() && i < max_errors; i++)
+    {
+        const char* line = file + errors[i].offset;
+        const char* nl = static_cast<const char*>(std::memchr(line, '\n', file + size - line));
+        int length = static_cast<int>(std::min<size_t>(nl ? nl - line : file + size - line, 60));
+        while (length && line[length - 1] == '\r')
+            length--;
+        std::fprintf(stderr, "  offset %zu: %s: \"%.*s\"\n", errors[i].offset, errors[i].reason, length, line);
+    }
+    munmap(map, size);
+    return total.error_count ? 2 : 0;
+}
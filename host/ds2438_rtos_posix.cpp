@@ -0,0 +1,182 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_rtos_posix.cpp
+  * @brief   DS2438_Rtos_Port.h on Linux threads
+  ******************************************************************************
+  * Threads are pthreads; the priority becomes a SCHED_FIFO priority if the
+  * process may use it (root or CAP_SYS_NICE) and is ignored otherwise.
+  * Each thread that uses the port, including ones it did not start, gets a
+  * signal made of a flag and a condition variable.
+  ******************************************************************************
+  */
+
+#include "../DS2438_Rtos_Port.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <vector>
+
+namespace {
+
+struct Thread
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool signalled = false;
+};
+
+struct Queue
+{
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<std::vector<unsigned char>> messages;
+    size_t count;
+    size_t size;
+};
+
+struct Start
+{
+    void (*entry)(void*);
+    void* argument;
+    Thread* thread;
+};
+
+// never freed: a signal may still be sent to a thread that is about to exit
+thread_local Thread* self = nullptr;
+
+Thread* current()
+{
+    if (!self)
+        self = new Thread;
+    return self;
+}
+
+void* trampoline(void* p)
+{
+    std::unique_ptr<Start> start(static_cast<Start*>(p));
+    self = start->thread;
+    start->entry(start->argument);
+    return nullptr;
+}
+
+// wait on cv until ready() or timeout_ms, false on timeout
+template <typename Ready>
+bool wait_for(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, uint32_t timeout_ms, Ready ready)
+{
+    if (timeout_ms == DS2438_OS_WAIT_FOREVER)
+    {
+        cv.wait(lock, ready);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+}
+
+} // namespace
+
+extern "C" {
+
+void* ds2438_os_thread_new(void (*entry)(void*), void* argument, uint32_t stack_size, int32_t priority)
+{
+    Thread* thread = new Thread;
+    Start* start = new Start{entry, argument, thread};
+    pthread_t id;
+    int result = -1;
+    // first with the priority, then without if that is not allowed
+    for (int fifo = 1; fifo >= 0 && result != 0; fifo--)
+    {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        // the host needs more stack than the MCU
+        pthread_attr_setstacksize(&attr, std::max<size_t>(stack_size, 256 * 1024));
+        if (fifo)
+        {
+            sched_param param{};
+            param.sched_priority = priority;
+            pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+            pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+            if (pthread_attr_setschedparam(&attr, &param) != 0)
+            {
+                pthread_attr_destroy(&attr);
+                continue;
+            }
+        }
+        result = pthread_create(&id, &attr, trampoline, start);
+        pthread_attr_destroy(&attr);
+    }
+    if (result != 0)
+    {
+        delete start;
+        delete thread;
+        return nullptr;
+    }
+    return thread;
+}
+
+void* ds2438_os_thread_self(void)
+{
+    return current();
+}
+
+void ds2438_os_signal(void* thread)
+{
+    Thread* t = static_cast<Thread*>(thread);
+    {
+        std::lock_guard<std::mutex> lock(t->mutex);
+        t->signalled = true;
+    }
+    t->cv.notify_one();
+}
+
+int ds2438_os_wait_signal(uint32_t timeout_ms)
+{
+    Thread* t = current();
+    std::unique_lock<std::mutex> lock(t->mutex);
+    if (!wait_for(t->cv, lock, timeout_ms, [t] { return t->signalled; }))
+        return 1;
+    t->signalled = false;
+    return 0;
+}
+
+void* ds2438_os_queue_new(uint32_t count, uint32_t size)
+{
+    Queue* queue = new Queue;
+    queue->count = count;
+    queue->size = size;
+    return queue;
+}
+
+int ds2438_os_queue_put(void* queue, const void* message, uint32_t timeout_ms)
+{
+    Queue* q = static_cast<Queue*>(queue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!wait_for(q->not_full, lock, timeout_ms, [q] { return q->messages.size() < q->count; }))
+        return 1;
+    const unsigned char* bytes = static_cast<const unsigned char*>(message);
+    q->messages.emplace_back(bytes, bytes + q->size);
+    lock.unlock();
+    q->not_empty.notify_one();
+    return 0;
+}
+
+int ds2438_os_queue_get(void* queue, void* message, uint32_t timeout_ms)
+{
+    Queue* q = static_cast<Queue*>(queue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!wait_for(q->not_empty, lock, timeout_ms, [q] { return !q->messages.empty(); }))
+        return 1;
+    std::memcpy(message, q->messages.front().data(), q->size);
+    q->messages.pop_front();
+    lock.unlock();
+    q->not_full.notify_one();
+    return 0;
+}
+
+} // extern "C"
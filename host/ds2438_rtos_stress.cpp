@@ -0,0 +1,348 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_rtos_stress.cpp
+  * @brief   Many threads on one simulated bus through the DS2438 bus server
+  ******************************************************************************
+  * Build:
+  *     gcc -std=c99 -O2 -c ../DS2438_Library.c -o DS2438_Library.o
+  *     gcc -std=c99 -O2 -I.. -c ../DS2438_Rtos.c -o DS2438_Rtos.o
+  *     g++ -std=c++17 -O2 -pthread ds2438_sim.cpp ds2438_hal_sim.cpp ds2438_rtos_posix.cpp ds2438_rtos_stress.cpp DS2438_Rtos.o DS2438_Library.o -o ds2438_rtos_stress
+  *
+  * Usage:
+  *     ds2438_rtos_stress [-t threads] [-n requests] [-d devices] [-f flip_ppm] [-r pace]
+  *
+  *   -t  client threads (default 8)
+  *   -n  requests per thread (default 500)
+  *   -d  devices on the bus (default 4)
+  *   -f  probability of a flipped device bit in ppm
+  *   -r  real time per bus time (default 0.01), so requests queue up
+  *       while the server works and identical ones can be merged
+  *
+  * Every client mixes blocking and asynchronous voltage, temperature and
+  * page reads of random devices, and writes its own EEPROM page (one per
+  * thread) with the asynchronous function followed by a blocking read
+  * that has to return the new data. Values are checked against the models,
+  * page reads by their CRC. The simulator is not thread safe, so any bus
+  * access outside the server thread would break it.
+  *
+  * An asynchronous request rejected with a full queue is retried after a
+  * growing pause until the server takes it, and every request taken has
+  * to call its callback exactly once. A second server for the bus and a
+  * request for a device on another bus have to be refused.
+  ******************************************************************************
+  */
+
+#include "ds2438_sim.hpp"
+
+#include "../DS2438_Rtos.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace sim = ds2438::sim;
+
+namespace {
+
+ds2438_server_t server;
+std::vector<ds2438_t> handles;
+std::vector<const sim::Device*> models;
+
+struct Counts
+{
+    std::atomic<int> done{0};
+    std::atomic<int> failed{0};
+    std::atomic<int> wrong{0};
+    std::atomic<int> busy{0};           // submissions rejected because the queue was full
+    std::atomic<int> accepted{0};       // asynchronous requests the server took
+    std::atomic<int> completed{0};      // callbacks of asynchronous requests
+};
+
+Counts counts;
+
+struct Client;
+
+// one asynchronous request, the context of its callback
+struct Ticket
+{
+    Client* client = nullptr;
+    bool accepted = false;
+    std::atomic<int> calls{0};
+};
+
+// per request of a client, the async ones in flight count as pending
+struct Client
+{
+    int index = 0;
+    std::atomic<int> pending{0};
+    std::unique_ptr<Ticket[]> tickets;  // one per request
+};
+
+bool check_voltage(int device, float voltage)
+{
+    return std::fabs(voltage - models[device]->vad) <= 0.006;
+}
+
+bool check_temperature(int device, float temperature)
+{
+    return std::fabs(temperature - models[device]->temperature) <= 0.016;
+}
+
+void count(uint8_t status, bool ok)
+{
+    if (status != DS2438_OP_SUCCESS)
+        counts.failed++;
+    else if (!ok)
+        counts.wrong++;
+    else
+        counts.done++;
+}
+
+int device_of(ds2438_t* dev)
+{
+    return static_cast<int>(dev - handles.data());
+}
+
+void complete(void* context)
+{
+    Ticket* ticket = static_cast<Ticket*>(context);
+    ticket->calls++;
+    counts.completed++;
+    ticket->client->pending--;
+}
+
+void on_voltage(ds2438_t* dev, uint8_t status, const ds2438_async_result_t* result, void* context)
+{
+    count(status, check_voltage(device_of(dev), result->value));
+    complete(context);
+}
+
+void on_temperature(ds2438_t* dev, uint8_t status, const ds2438_async_result_t* result, void* context)
+{
+    count(status, check_temperature(device_of(dev), result->value));
+    complete(context);
+}
+
+void on_write(ds2438_t*, uint8_t status, const ds2438_async_result_t*, void* context)
+{
+    count(status, true);
+    complete(context);
+}
+
+// Queue request n of the client, retrying with a growing pause while the queue is full
+template <typename Submit>
+void submit(Client* self, int n, Submit call)
+{
+    Ticket* ticket = &self->tickets[n];
+    ticket->client = self;
+    self->pending++;
+    auto pause = std::chrono::microseconds(20);
+    uint8_t status;
+    while ((status = call(ticket)) == DS2438_BUSY)
+    {
+        counts.busy++;
+        std::this_thread::sleep_for(pause);
+        pause = std::min(pause * 2, std::chrono::microseconds(2000));
+    }
+    if (status != DS2438_OP_SUCCESS)
+    {
+        self->pending--;
+        counts.failed++;
+        return;
+    }
+    ticket->accepted = true;
+    counts.accepted++;
+}
+
+void client(Client* self, int requests, int devices)
+{
+    std::mt19937 random(self->index);
+    int own_device = self->index % devices;
+    uint8_t own_page = 3 + (self->index / devices) % 5;
+    for (int n = 0; n < requests; n++)
+    {
+        int device = random() % devices;
+        ds2438_t* dev = &handles[device];
+        switch (random() % 6)
+        {
+        case 0:
+        {
+            float voltage = 0;
+            uint8_t status = DS2438_ServerReadVoltage(&server, dev, &voltage);
+            count(status, check_voltage(device, voltage));
+            break;
+        }
+        case 1:
+        {
+            float temperature = 0;
+            uint8_t status = DS2438_ServerReadTemperature(&server, dev, &temperature);
+            count(status, check_temperature(device, temperature));
+            break;
+        }
+        case 2:
+        {
+            uint8_t page_data[9];
+            count(DS2438_ServerReadPage(&server, dev, random() % 8, page_data), true);
+            break;
+        }
+        case 3:
+        case 4:
+        {
+            bool voltage = random() % 2;
+            submit(self, n, [&](Ticket* ticket) {
+                return voltage ? DS2438_ServerReadVoltageAsync(&server, dev, on_voltage, ticket)
+                               : DS2438_ServerReadTemperatureAsync(&server, dev, on_temperature, ticket);
+            });
+            break;
+        }
+        default:
+        {
+            // a read queued behind the write must not get an older result
+            uint8_t page_data[9] = {static_cast<uint8_t>(self->index), static_cast<uint8_t>(n),
+                                    static_cast<uint8_t>(n >> 8), static_cast<uint8_t>(random())};
+            uint8_t read_data[9];
+            submit(self, n, [&](Ticket* ticket) {
+                return DS2438_ServerWritePageAsync(&server, &handles[own_device], own_page, page_data, on_write, ticket);
+            });
+            uint8_t status = DS2438_ServerReadPage(&server, &handles[own_device], own_page, read_data);
+            count(status, std::equal(page_data, page_data + 8, read_data));
+            break;
+        }
+        }
+    }
+    while (self->pending)
+        std::this_thread::yield();
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int threads = 8, requests = 500, devices = 4;
+    uint32_t flip_ppm = 0;
+    double pace = 0.01;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:d:f:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't': threads = std::max(1, std::atoi(optarg)); break;
+        case 'n': requests = std::atoi(optarg); break;
+        case 'd': devices = std::max(1, std::atoi(optarg)); break;
+        case 'f': flip_ppm = std::strtoul(optarg, nullptr, 10); break;
+        case 'r': pace = std::atof(optarg); break;
+        default:
+            std::fprintf(stderr, "usage: %s [-t threads] [-n requests] [-d devices] [-f flip_ppm] [-r pace]\n",
+                         argv[0]);
+            return 1;
+        }
+    }
+    if (threads > 5 * devices)
+    {
+        std::fprintf(stderr, "%d threads need %d devices for their own pages\n", threads, (threads + 4) / 5);
+        return 1;
+    }
+
+    sim::Bus bus;
+    for (int i = 0; i < devices; i++)
+    {
+        sim::Device& model = bus.add_device(0x0000A1B2C3D4E5ULL + 0x1000 * i);
+        model.vad = 1.0 + 0.25 * i;
+        model.temperature = 20.0 + 0.5 * i;
+    }
+    sim::set_hal_bus(&bus);
+
+    ds2438_bus_t ow;
+    init_OnewirePort(&ow);
+    handles.resize(devices);
+    models.resize(devices);
+    uint8_t rom[DS2438_ROM_SIZE];
+    int found = 0;
+    OneWire_SearchReset(&ow);
+    while (found < devices && OneWire_SearchNext(&ow, rom) == DS2438_OP_SUCCESS)
+    {
+        DS2438_Init(&handles[found], &ow, rom, DS2438_SENSE_RESISTOR);
+        DS2438_SelectInputSource(&handles[found], DS2438_INPUT_VOLTAGE_VAD);
+        for (int i = 0; i < devices; i++)
+        {
+            if (std::equal(rom, rom + DS2438_ROM_SIZE, bus.device(i).rom()))
+                models[found] = &bus.device(i);
+        }
+        found++;
+    }
+    if (found != devices)
+    {
+        std::fprintf(stderr, "SEARCH ROM found %d of %d devices\n", found, devices);
+        return 1;
+    }
+    for (int i = 0; i < devices; i++)
+        bus.device(i).faults.flip_ppm = flip_ppm;
+
+    // from here on only the server thread touches the bus
+    sim::set_hal_pace(pace);
+    if (DS2438_ServerStart(&server, &ow, DS2438_RTOS_PRIORITY) != DS2438_OP_SUCCESS)
+    {
+        std::fprintf(stderr, "server thread could not be started\n");
+        return 1;
+    }
+    ds2438_server_t second;
+    ds2438_bus_t other{};
+    ds2438_t stray;
+    DS2438_Init(&stray, &other, rom, DS2438_SENSE_RESISTOR);
+    float value;
+    if (DS2438_ServerStart(&second, &ow, DS2438_RTOS_PRIORITY) != DS2438_BUSY ||
+        DS2438_ServerReadVoltage(&server, &stray, &value) != DS2438_BAD_PARAM ||
+        DS2438_ServerReadVoltageAsync(&server, &stray, on_voltage, nullptr) != DS2438_BAD_PARAM)
+    {
+        std::fprintf(stderr, "server took a bus or a device it does not serve\n");
+        return 2;
+    }
+    sim::Time start = bus.now();
+    auto wall_start = std::chrono::steady_clock::now();
+    std::vector<Client> clients(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+        clients[t].index = t;
+        clients[t].tickets.reset(new Ticket[requests]);
+        workers.emplace_back(client, &clients[t], requests, devices);
+    }
+    for (auto& worker : workers)
+        worker.join();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    sim::Time bus_ns = bus.now() - start;
+
+    // every request the server took calls back once, a rejected one never
+    int lost = 0, repeated = 0;
+    for (auto& c : clients)
+    {
+        for (int n = 0; n < requests; n++)
+        {
+            int calls = c.tickets[n].calls;
+            if (calls < c.tickets[n].accepted)
+                lost++;
+            else if (calls > c.tickets[n].accepted)
+                repeated++;
+        }
+    }
+
+    std::printf("%d threads, %d requests each, %d devices\n", threads, requests, devices);
+    std::printf("results: %d ok, %d failed, %d wrong, %d retries (queue full)\n", counts.done.load(),
+                counts.failed.load(), counts.wrong.load(), counts.busy.load());
+    std::printf("async: %d accepted, %d completed, %d never, %d more than once\n", counts.accepted.load(),
+                counts.completed.load(), lost, repeated);
+    std::printf("server: %u requests, %u served, %u merged, %.3f s bus time, host time %.3f s\n", server.requests,
+                server.executed, server.merged, bus_ns / 1e9, wall);
+    if (counts.wrong || (!flip_ppm && counts.failed) || server.requests != server.executed + server.merged ||
+        lost || repeated || counts.accepted != counts.completed)
+        return 2;
+    return 0;
+}
@@ -0,0 +1,184 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_script_check.cpp
+  * @brief   Compares the scripts of DS2438_Script.hpp with the library
+  ******************************************************************************
+  * Build:
+  *     gcc -std=c99 -O2 -c ../DS2438_Library.c -o DS2438_Library.o
+  *     g++ -std=c++17 -O2 ds2438_sim.cpp ds2438_hal_sim.cpp ds2438_script_check.cpp DS2438_Library.o -o ds2438_script_check
+  *
+  * Usage:
+  *     ds2438_script_check [-d devices]
+  *
+  *   -d  devices on the bus (default 3), checked with MATCH ROM; a bus
+  *       with a single device is checked with SKIP ROM as well
+  *
+  * For every page the script read_page<P> has to return the same bytes
+  * as DS2438_ReadPage() with the same resets and time slots on the bus.
+  * write_page<4> is read back with the library, a conversion started with
+  * convert_voltage / convert_temperature has to give the value of the
+  * model, and a flipped bit has to fail the CRC step.
+  ******************************************************************************
+  */
+
+#include "ds2438_sim.hpp"
+
+#include "../DS2438_Script.hpp"
+#include "../DS2438_Hal.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace sim = ds2438::sim;
+namespace script = ds2438::script;
+
+namespace {
+
+int errors = 0;
+
+void expect(bool ok, const char* what, int device, int page = -1)
+{
+    if (!ok)
+    {
+        if (page >= 0)
+            std::fprintf(stderr, "device %d page %d: %s\n", device, page, what);
+        else
+            std::fprintf(stderr, "device %d: %s\n", device, what);
+        errors++;
+    }
+}
+
+struct Cost
+{
+    uint64_t resets;
+    uint64_t slots;
+};
+
+Cost cost(const sim::Bus& bus)
+{
+    return Cost{bus.stats.resets, bus.stats.slots};
+}
+
+template <uint8_t P>
+void check_page(sim::Bus& bus, ds2438_t* dev, int device)
+{
+    uint8_t expected[9], data[9];
+    Cost start = cost(bus);
+    expect(DS2438_ReadPage(dev, P, expected) == DS2438_OP_SUCCESS, "DS2438_ReadPage failed", device, P);
+    Cost library = cost(bus);
+    expect(script::run<script::read_page<P>>(dev, data) == DS2438_OP_SUCCESS, "read_page failed", device, P);
+    Cost scripted = cost(bus);
+    expect(std::equal(expected, expected + 9, data), "read_page data differs", device, P);
+    expect(library.resets - start.resets == scripted.resets - library.resets &&
+               library.slots - start.slots == scripted.slots - library.slots,
+           "read_page bus cost differs", device, P);
+}
+
+template <uint8_t... P>
+void check_pages(sim::Bus& bus, ds2438_t* dev, int device, std::integer_sequence<uint8_t, P...>)
+{
+    (check_page<P>(bus, dev, device), ...);
+}
+
+void check_device(sim::Bus& bus, ds2438_t* dev, sim::Device& model, int device)
+{
+    check_pages(bus, dev, device, std::make_integer_sequence<uint8_t, 8>{});
+
+    // user page 4 written by the script, read back by the library
+    uint8_t written[9] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, static_cast<uint8_t>(device), 0};
+    uint8_t read[9];
+    expect(script::run<script::write_page<4>>(dev, written) == DS2438_OP_SUCCESS, "write_page failed", device, 4);
+    ds2438_hal_delay_us(10000);//EEPROM programming
+    expect(DS2438_ReadPage(dev, 4, read) == DS2438_OP_SUCCESS && std::equal(written, written + 8, read),
+           "write_page not read back", device, 4);
+
+    uint8_t page[9];
+    expect(script::run<script::convert_voltage>(dev) == DS2438_OP_SUCCESS, "convert_voltage failed", device);
+    ds2438_hal_delay_us(10000);
+    expect(script::run<script::read_page<0>>(dev, page) == DS2438_OP_SUCCESS, "read_page<0> failed", device, 0);
+    //voltage register: 10 mV units in bytes 3 and 4
+    double voltage = ((page[4] & 0x03) << 8 | page[3]) * 0.01;
+    expect(std::fabs(voltage - model.vad) <= 0.006, "convert_voltage gives a wrong value", device);
+
+    expect(script::run<script::convert_temperature>(dev) == DS2438_OP_SUCCESS, "convert_temperature failed", device);
+    ds2438_hal_delay_us(10000);
+    expect(script::run<script::read_page<0>>(dev, page) == DS2438_OP_SUCCESS, "read_page<0> failed", device, 0);
+    //temperature register: 1/256 C in bytes 1 and 2
+    double temperature = static_cast<int16_t>(page[2] << 8 | page[1]) / 256.0;
+    expect(std::fabs(temperature - model.temperature) <= 0.016, "convert_temperature gives a wrong value", device);
+
+    model.faults.flip_next_bits = 1;
+    uint32_t crc_errors = dev->stats.bus.crc_errors;
+    expect(script::run<script::read_page<1>>(dev, page) == DS2438_CRC_ERROR &&
+               dev->stats.bus.crc_errors == crc_errors + 1,
+           "flipped bit not detected", device, 1);
+    model.faults.flip_next_bits = 0;
+}
+
+// all devices of a bus, addressed with MATCH ROM, or a single one with SKIP ROM
+void check_bus(int devices, bool skip_rom)
+{
+    sim::Bus bus;
+    for (int i = 0; i < devices; i++)
+    {
+        sim::Device& model = bus.add_device(0x0000A1B2C3D4E5ULL + 0x1000 * i);
+        model.vad = 1.0 + 0.25 * i;
+        model.temperature = 20.0 + 0.5 * i;
+    }
+    sim::set_hal_bus(&bus);
+
+    ds2438_bus_t ow;
+    init_OnewirePort(&ow);
+    std::vector<ds2438_t> handles(devices);
+    uint8_t rom[DS2438_ROM_SIZE];
+    OneWire_SearchReset(&ow);
+    for (int found = 0; found < devices; found++)
+    {
+        if (OneWire_SearchNext(&ow, rom) != DS2438_OP_SUCCESS)
+        {
+            std::fprintf(stderr, "SEARCH ROM found %d of %d devices\n", found, devices);
+            errors++;
+            return;
+        }
+        DS2438_Init(&handles[found], &ow, skip_rom ? nullptr : rom, DS2438_SENSE_RESISTOR);
+        DS2438_SelectInputSource(&handles[found], DS2438_INPUT_VOLTAGE_VAD);
+        ds2438_hal_delay_us(10000);//EEPROM programming, NVB would differ between the reads
+        for (int i = 0; i < devices; i++)
+        {
+            if (std::equal(rom, rom + DS2438_ROM_SIZE, bus.device(i).rom()))
+                check_device(bus, &handles[found], bus.device(i), found);
+        }
+    }
+    std::printf("%d device%s, %s: %d errors so far\n", devices, devices > 1 ? "s" : "",
+                skip_rom ? "SKIP ROM" : "MATCH ROM", errors);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int devices = 3;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd': devices = std::max(1, std::atoi(optarg)); break;
+        default:
+            std::fprintf(stderr, "usage: %s [-d devices]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    check_bus(1, true);
+    check_bus(devices, false);
+
+    std::printf("script sizes in flash: read_page %zu, write_page %zu, convert %zu bytes\n",
+                sizeof(script::read_page<0>), sizeof(script::write_page<0>), sizeof(script::convert_voltage));
+    return errors ? 2 : 0;
+}
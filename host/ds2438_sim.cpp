@@ -0,0 +1,643 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_sim.cpp
+  * @brief   Bit-level simulation of DS2438 devices on a 1-Wire bus
+  ******************************************************************************
+  */
+
+#include "ds2438_sim.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace ds2438::sim {
+
+namespace {
+
+// Function commands
+constexpr uint8_t CONVERT_T = 0x44;
+constexpr uint8_t CONVERT_V = 0xB4;
+constexpr uint8_t RECALL_MEMORY = 0xB8;
+constexpr uint8_t READ_SCRATCHPAD = 0xBE;
+constexpr uint8_t WRITE_SCRATCHPAD = 0x4E;
+constexpr uint8_t COPY_SCRATCHPAD = 0x48;
+
+// ROM commands
+constexpr uint8_t READ_ROM = 0x33;
+constexpr uint8_t MATCH_ROM = 0x55;
+constexpr uint8_t SKIP_ROM = 0xCC;
+constexpr uint8_t SEARCH_ROM = 0xF0;
+
+// Status/configuration byte (page 0, byte 0)
+constexpr uint8_t IAD = 0x01;
+constexpr uint8_t CA = 0x02;
+constexpr uint8_t AD = 0x08;
+constexpr uint8_t TB = 0x10;
+constexpr uint8_t NVB = 0x20;
+constexpr uint8_t ADB = 0x40;
+
+// One ICA LSB per current register LSB and hour is 1/2 (both in units of the sense resistor)
+constexpr double ICA_PER_CONVERSION = 1.0 / (2.0 * 36.41 * 3600.0);
+
+} // namespace
+
+uint8_t crc8(const uint8_t* data, size_t length)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        uint8_t byte = data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            uint8_t mix = (crc ^ byte) & 0x01;
+            crc >>= 1;
+            if (mix)
+                crc ^= 0x8C;
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+// ===========================================================
+//                  DEVICE
+// ===========================================================
+
+Device::Device(uint64_t serial)
+{
+    rom_[0] = FAMILY_CODE;
+    for (int i = 0; i < 6; i++)
+        rom_[1 + i] = static_cast<uint8_t>(serial >> (8 * i));
+    rom_[7] = crc8(rom_, 7);
+    memory_[0][0] = IAD | CA | 0x04 | AD;   // power-up default: IAD, CA, EE, AD set
+    rng_ = static_cast<uint32_t>(serial * 2654435761u) | 1;
+}
+
+uint8_t* Device::memory(uint8_t page, Time now)
+{
+    refresh(now);
+    return memory_[page & 7];
+}
+
+// Apply everything that happened since the last refresh: finished
+// conversions, current conversions of the last interval and the ETM
+void Device::refresh(Time now)
+{
+    uint8_t& config = memory_[0][0];
+    if (temp_done_ && now >= temp_done_)
+    {
+        double t = std::clamp(temperature, -55.0, 125.0);
+        uint16_t reg = static_cast<uint16_t>(static_cast<int16_t>(std::lround(t * 32)) * 8);
+        memory_[0][1] = static_cast<uint8_t>(reg);
+        memory_[0][2] = static_cast<uint8_t>(reg >> 8);
+        config &= ~TB;
+        temp_done_ = 0;
+    }
+    if (voltage_done_ && now >= voltage_done_)
+    {
+        double v = (config & AD) ? vdd : vad;
+        long reg = std::clamp(std::lround(v * 100), 0L, 1023L);
+        memory_[0][3] = static_cast<uint8_t>(reg);
+        memory_[0][4] = static_cast<uint8_t>(reg >> 8);
+        config &= ~ADB;
+        voltage_done_ = 0;
+    }
+    if (eeprom_done_ && now >= eeprom_done_)
+    {
+        config &= ~NVB;
+        eeprom_done_ = 0;
+    }
+
+    if (config & IAD)
+    {
+        uint64_t conversions = (now - current_last_) / CURRENT_CONV_PERIOD;
+        if (conversions)
+        {
+            current_last_ += conversions * CURRENT_CONV_PERIOD;
+            //the offset register is added to every measurement
+            int16_t offset = static_cast<int16_t>(memory_[1][5] | (memory_[1][6] << 8)) >> 3;
+            long reg = std::clamp(std::lround(sense_mV * 4.096) + offset, -1024L, 1023L);
+            memory_[0][5] = static_cast<uint8_t>(reg);
+            memory_[0][6] = static_cast<uint8_t>(static_cast<uint16_t>(reg) >> 8);
+
+            //currents below the threshold are not accumulated
+            int threshold = (memory_[0][7] >> 6) & 0x03;
+            if (threshold && std::labs(reg) < (1L << threshold))
+                reg = 0;
+            double delta = reg * ICA_PER_CONVERSION * static_cast<double>(conversions);
+            ica_fraction_ += delta;
+            double whole = std::floor(ica_fraction_);
+            ica_fraction_ -= whole;
+            memory_[1][4] = static_cast<uint8_t>(memory_[1][4] + static_cast<int64_t>(whole));
+
+            if (config & CA)
+            {
+                //one CCA/DCA LSB is 32 ICA LSBs, both saturate
+                double& fraction = delta > 0 ? cca_fraction_ : dca_fraction_;
+                uint8_t* reg16 = delta > 0 ? &memory_[7][4] : &memory_[7][6];
+                fraction += std::fabs(delta) / 32;
+                double add = std::floor(fraction);
+                fraction -= add;
+                uint32_t value = std::min<uint32_t>(0xFFFF, (reg16[0] | (reg16[1] << 8)) + static_cast<uint32_t>(add));
+                reg16[0] = static_cast<uint8_t>(value);
+                reg16[1] = static_cast<uint8_t>(value >> 8);
+            }
+        }
+    }
+    else
+    {
+        current_last_ = now;
+    }
+
+    uint32_t etm = etm_base_ + static_cast<uint32_t>((now - etm_time_) / S);
+    for (int i = 0; i < 4; i++)
+        memory_[1][i] = static_cast<uint8_t>(etm >> (8 * i));
+}
+
+void Device::reset(Time)
+{
+    generation_++;
+    pulling_ = false;
+    rx_bits_ = 0;
+    rx_byte_ = 0;
+    tx_length_ = 0;
+    tx_bit_ = 0;
+    state_ = State::RomCommand;
+    mode_ = Mode::Receive;
+}
+
+void Device::send(const uint8_t* data, size_t length)
+{
+    std::memcpy(tx_, data, length);
+    tx_length_ = static_cast<uint8_t>(length);
+    tx_bit_ = 0;
+    mode_ = Mode::Send;
+}
+
+bool Device::flip()
+{
+    if (faults.flip_next_bits && !faults.delay_resets)
+    {
+        faults.flip_next_bits--;
+        return true;
+    }
+    if (faults.flip_ppm)
+    {
+        rng_ ^= rng_ << 13;
+        rng_ ^= rng_ >> 17;
+        rng_ ^= rng_ << 5;
+        return rng_ % 1000000 < faults.flip_ppm;
+    }
+    return false;
+}
+
+bool Device::next_send_bit()
+{
+    //after the last byte the device leaves the line released, the master reads 1s
+    if (tx_bit_ >= tx_length_ * 8)
+        return true;
+    bool bit = (tx_[tx_bit_ / 8] >> (tx_bit_ % 8)) & 1;
+    tx_bit_++;
+    return flip() ? !bit : bit;
+}
+
+void Device::on_byte(uint8_t byte, Time now)
+{
+    switch (state_)
+    {
+    case State::RomCommand:
+        if (byte == READ_ROM)
+        {
+            state_ = State::ReadRom;
+            send(rom_, 8);
+        }
+        else if (byte == MATCH_ROM)
+        {
+            state_ = State::MatchRom;
+            write_pos_ = 0;
+        }
+        else if (byte == SKIP_ROM)
+        {
+            state_ = State::FunctionCommand;
+        }
+        else if (byte == SEARCH_ROM)
+        {
+            state_ = State::SearchRom;
+            mode_ = Mode::Search;
+            search_bit_ = 0;
+            search_phase_ = 0;
+        }
+        else
+        {
+            state_ = State::Idle;
+            mode_ = Mode::Ignore;
+        }
+        break;
+
+    case State::MatchRom:
+        if (byte != rom_[write_pos_])
+        {
+            state_ = State::Idle;
+            mode_ = Mode::Ignore;
+        }
+        else if (++write_pos_ == 8)
+        {
+            state_ = State::FunctionCommand;
+        }
+        break;
+
+    case State::FunctionCommand:
+        command_ = byte;
+        commands++;
+        refresh(now);
+        if (byte == CONVERT_T || byte == CONVERT_V)
+        {
+            if (byte == CONVERT_T)
+            {
+                memory_[0][0] |= TB;
+                temp_done_ = now + TEMP_CONV_TIME;
+            }
+            else
+            {
+                memory_[0][0] |= ADB;
+                voltage_done_ = now + VOLTAGE_CONV_TIME;
+            }
+            state_ = State::Idle;
+            mode_ = Mode::Ignore;
+        }
+        else if (byte == RECALL_MEMORY || byte == READ_SCRATCHPAD ||
+                 byte == WRITE_SCRATCHPAD || byte == COPY_SCRATCHPAD)
+        {
+            state_ = State::PageNumber;
+        }
+        else
+        {
+            state_ = State::Idle;
+            mode_ = Mode::Ignore;
+        }
+        break;
+
+    case State::PageNumber:
+        if (byte > 7)
+        {
+            state_ = State::Idle;
+            mode_ = Mode::Ignore;
+        }
+        else
+        {
+            execute(byte, now);
+        }
+        break;
+
+    case State::WriteScratchpad:
+        if (write_pos_ < 8)
+            scratchpad_[page_][write_pos_++] = byte;
+        break;
+
+    default:
+        break;
+    }
+}
+
+void Device::execute(uint8_t page, Time now)
+{
+    page_ = page;
+    state_ = State::Idle;
+    mode_ = Mode::Ignore;
+    refresh(now);
+    switch (command_)
+    {
+    case RECALL_MEMORY:
+        std::memcpy(scratchpad_[page], memory_[page], 8);
+        break;
+
+    case READ_SCRATCHPAD:
+    {
+        uint8_t data[9];
+        std::memcpy(data, scratchpad_[page], 8);
+        data[8] = crc8(data, 8);
+        state_ = State::ReadScratchpad;
+        send(data, 9);
+        break;
+    }
+
+    case WRITE_SCRATCHPAD:
+        state_ = State::WriteScratchpad;
+        mode_ = Mode::Receive;
+        write_pos_ = 0;
+        break;
+
+    case COPY_SCRATCHPAD:
+    {
+        const uint8_t* sp = scratchpad_[page];
+        if (page == 0)
+        {
+            //only IAD, CA, EE, AD and the threshold register are writable
+            memory_[0][0] = (memory_[0][0] & 0xF0) | (sp[0] & 0x0F);
+            memory_[0][7] = sp[7];
+            if (!(memory_[0][0] & IAD))
+                current_last_ = now;
+        }
+        else if (page == 1)
+        {
+            etm_base_ = sp[0] | (sp[1] << 8) | (sp[2] << 16) | (static_cast<uint32_t>(sp[3]) << 24);
+            etm_time_ = now;
+            memory_[1][4] = sp[4];
+            ica_fraction_ = 0;
+            //the offset register can only be written while IAD = 0
+            if (!(memory_[0][0] & IAD))
+            {
+                memory_[1][5] = sp[5];
+                memory_[1][6] = sp[6];
+            }
+            memory_[1][7] = sp[7];
+        }
+        else
+        {
+            std::memcpy(memory_[page], sp, 8);
+        }
+        memory_[0][0] |= NVB;
+        eeprom_done_ = now + EEPROM_WRITE_TIME;
+        refresh(now);
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+void Device::on_search_bit(int bit)
+{
+    int own = (rom_[search_bit_ / 8] >> (search_bit_ % 8)) & 1;
+    search_phase_ = 0;
+    if (bit != own)
+    {
+        //the master chose the other branch
+        state_ = State::Idle;
+        mode_ = Mode::Ignore;
+    }
+    else if (++search_bit_ == 64)
+    {
+        state_ = State::FunctionCommand;
+        mode_ = Mode::Receive;
+    }
+}
+
+// ===========================================================
+//                  BUS
+// ===========================================================
+
+Device& Bus::add_device(uint64_t serial)
+{
+    devices_.push_back(std::make_unique<Device>(serial));
+    return *devices_.back();
+}
+
+void Bus::schedule(Time time, Device& device, EventType type)
+{
+    events_.push({time, order_++, &device, device.generation_, type});
+}
+
+void Bus::advance(Time until)
+{
+    while (!events_.empty() && events_.top().time <= until)
+    {
+        Event event = events_.top();
+        events_.pop();
+        now_ = event.time;
+        if (event.generation == event.device->generation_)
+            handle(event);
+    }
+    now_ = until;
+}
+
+void Bus::handle(const Event& event)
+{
+    Device& device = *event.device;
+    stats.events++;
+    switch (event.type)
+    {
+    case EventType::Sample:
+    {
+        int bit = line_ ? 1 : 0;
+        if (device.mode_ == Device::Mode::Search)
+        {
+            device.on_search_bit(bit);
+        }
+        else if (device.mode_ == Device::Mode::Receive)
+        {
+            device.rx_byte_ |= static_cast<uint8_t>(bit << device.rx_bits_);
+            if (++device.rx_bits_ == 8)
+            {
+                uint8_t byte = device.rx_byte_;
+                device.rx_bits_ = 0;
+                device.rx_byte_ = 0;
+                device.on_byte(byte, now_);
+            }
+        }
+        break;
+    }
+
+    case EventType::Presence:
+        device.pulling_ = true;
+        update_line();
+        schedule(now_ + PRESENCE_LOW, device, EventType::Release);
+        break;
+
+    case EventType::Release:
+        device.pulling_ = false;
+        update_line();
+        break;
+    }
+}
+
+// The master pulled the line low: every device starts a time slot
+void Bus::slot_start()
+{
+    for (auto& d : devices_)
+    {
+        Device& device = *d;
+        bool bit;
+        switch (device.mode_)
+        {
+        case Device::Mode::Receive:
+            schedule(now_ + SLOT_SAMPLE, device, EventType::Sample);
+            continue;
+
+        case Device::Mode::Send:
+            bit = device.next_send_bit();
+            break;
+
+        case Device::Mode::Search:
+            if (device.search_phase_ == 2)
+            {
+                schedule(now_ + SLOT_SAMPLE, device, EventType::Sample);
+                continue;
+            }
+            bit = (device.rom_[device.search_bit_ / 8] >> (device.search_bit_ % 8)) & 1;
+            if (device.search_phase_++ == 1)
+                bit = !bit;
+            if (device.flip())
+                bit = !bit;
+            break;
+
+        default:
+            continue;
+        }
+        if (!bit)
+        {
+            //hold the line low past the sampling point of the master
+            device.pulling_ = true;
+            schedule(now_ + SLOT_SAMPLE, device, EventType::Release);
+        }
+    }
+    update_line();
+}
+
+// The line went high: end of a slot or of a reset pulse
+void Bus::line_rise()
+{
+    if (!fall_valid_)
+        return;
+    fall_valid_ = false;
+    if (now_ - fall_time_ < RESET_MIN)
+    {
+        stats.slots++;
+        return;
+    }
+    stats.resets++;
+    bool presence = false;
+    for (auto& d : devices_)
+    {
+        Device& device = *d;
+        device.reset(now_);
+        if (device.faults.delay_resets)
+        {
+            device.faults.delay_resets--;
+        }
+        else if (device.faults.skip_presence)
+        {
+            device.faults.skip_presence--;
+            continue;
+        }
+        if (device.faults.skip_presence_ppm)
+        {
+            device.rng_ ^= device.rng_ << 13;
+            device.rng_ ^= device.rng_ >> 17;
+            device.rng_ ^= device.rng_ << 5;
+            if (device.rng_ % 1000000 < device.faults.skip_presence_ppm)
+                continue;
+        }
+        schedule(now_ + PRESENCE_WAIT, device, EventType::Presence);
+        presence = true;
+    }
+    if (presence)
+        stats.presence++;
+}
+
+void Bus::update_line()
+{
+    bool pulled = stuck_low_ || master_low_;
+    for (auto& d : devices_)
+        pulled = pulled || d->pulling_;
+    bool rise = !line_ && !pulled;
+    line_ = !pulled;
+    write_vcd();
+    if (rise)
+        line_rise();
+}
+
+void Bus::drive_low()
+{
+    advance(now_);
+    if (master_low_)
+        return;
+    master_low_ = true;
+    if (line_)
+    {
+        fall_time_ = now_;
+        fall_valid_ = true;
+        line_ = false;
+        slot_start();
+    }
+    else
+    {
+        //a device or a short holds the line, no edge the devices could see
+        update_line();
+    }
+}
+
+void Bus::release()
+{
+    advance(now_);
+    master_low_ = false;
+    update_line();
+}
+
+int Bus::sample()
+{
+    advance(now_);
+    return line_ ? 1 : 0;
+}
+
+void Bus::delay(Time ns)
+{
+    advance(now_ + ns);
+}
+
+void Bus::set_stuck_low(bool stuck)
+{
+    advance(now_);
+    stuck_low_ = stuck;
+    fall_valid_ = false;
+    update_line();
+}
+
+bool Bus::record_vcd(const std::string& path)
+{
+    vcd_.close();
+    if (path.empty())
+        return true;
+    vcd_.open(path);
+    if (!vcd_)
+        return false;
+    vcd_ << "$timescale 1ns $end\n"
+            "$scope module onewire $end\n"
+            "$var wire 1 m master $end\n"
+            "$var wire 1 d device $end\n"
+            "$var wire 1 q dq $end\n"
+            "$upscope $end\n"
+            "$enddefinitions $end\n";
+    std::memset(vcd_state_, 'x', sizeof(vcd_state_));
+    vcd_time_ = now_;
+    vcd_ << "#" << now_ << "\n";
+    write_vcd();
+    return true;
+}
+
+void Bus::write_vcd()
+{
+    if (!vcd_.is_open())
+        return;
+    bool device = false;
+    for (auto& d : devices_)
+        device = device || d->pulling_;
+    const char state[3] = {master_low_ ? '0' : '1', device ? '0' : '1', line_ ? '1' : '0'};
+    static const char ids[3] = {'m', 'd', 'q'};
+    for (int i = 0; i < 3; i++)
+    {
+        if (state[i] == vcd_state_[i])
+            continue;
+        if (now_ != vcd_time_)
+        {
+            vcd_ << "#" << now_ << "\n";
+            vcd_time_ = now_;
+        }
+        vcd_ << state[i] << ids[i] << "\n";
+        vcd_state_[i] = state[i];
+    }
+}
+
+} // namespace ds2438::sim
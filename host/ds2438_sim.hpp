@@ -0,0 +1,272 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_sim.hpp
+  * @brief   Bit-level simulation of DS2438 devices on a 1-Wire bus
+  ******************************************************************************
+  * The bus is a wired-AND of the master pin and every device. Devices see
+  * the line edges and run the 1-Wire slave state machine: reset/presence,
+  * READ/MATCH/SKIP/SEARCH ROM, CONVERT T/V, RECALL MEMORY, READ/WRITE/COPY
+  * SCRATCHPAD on pages 0-7 with a scratchpad and a memory copy per page.
+  *
+  * Time is virtual (ns) and only moves when the master waits, so the
+  * driver runs as fast as the host can execute it. Device reactions are
+  * events in a queue; conversions, the ETM and the current accumulators
+  * are updated lazily from the virtual time.
+  *
+  * ds2438_hal_sim.cpp binds DS2438_Hal.h to a Bus, so DS2438_Library.c
+  * runs unchanged against the simulation.
+  ******************************************************************************
+  */
+
+#ifndef DS2438_SIM_HPP
+#define DS2438_SIM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+namespace ds2438::sim {
+
+using Time = uint64_t;      // ns
+
+constexpr Time US = 1000;
+constexpr Time MS = 1000 * US;
+constexpr Time S = 1000 * MS;
+
+// Device timing (DS2438 data sheet)
+constexpr Time RESET_MIN = 480 * US;            // shorter low pulses are slots
+constexpr Time PRESENCE_WAIT = 30 * US;         // tPDH
+constexpr Time PRESENCE_LOW = 120 * US;         // tPDL
+constexpr Time SLOT_SAMPLE = 30 * US;           // device samples / holds a 0 this long
+constexpr Time TEMP_CONV_TIME = 10 * MS;
+constexpr Time VOLTAGE_CONV_TIME = 10 * MS;
+constexpr Time EEPROM_WRITE_TIME = 10 * MS;
+constexpr Time CURRENT_CONV_PERIOD = S * 100 / 3641;     // 36.41 Hz
+
+constexpr uint8_t FAMILY_CODE = 0x26;
+
+/**
+*   \brief Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1) as used for ROM and pages.
+*/
+uint8_t crc8(const uint8_t* data, size_t length);
+
+/**
+*   \brief Faults injected by a device.
+*/
+struct DeviceFaults
+{
+    uint32_t flip_next_bits = 0;    // invert the next n bits the device sends
+    uint32_t flip_ppm = 0;          // probability of inverting a sent bit
+    uint32_t skip_presence = 0;     // answer the next n resets without presence pulse
+    uint32_t skip_presence_ppm = 0; // probability of a missing presence pulse
+    uint32_t delay_resets = 0;      // resets before flip_next_bits and skip_presence apply
+};
+
+/**
+*   \brief One DS2438 with its analog inputs.
+*/
+class Device
+{
+public:
+    explicit Device(uint64_t serial);
+
+    // 64-bit ROM ID: family code, 48-bit serial, CRC8
+    const uint8_t* rom() const { return rom_; }
+
+    // analog inputs, used by the next conversion
+    double temperature = 25.0;      // C
+    double vdd = 3.7;               // V
+    double vad = 1.0;               // V
+    double sense_mV = 0.0;          // voltage over the sense resistor, > 0 charging
+
+    DeviceFaults faults;
+
+    // Memory of a page (8 bytes) as the device holds it, updated to time now
+    uint8_t* memory(uint8_t page, Time now);
+
+    uint64_t commands = 0;          // function commands executed
+
+private:
+    friend class Bus;
+
+    enum class State : uint8_t
+    {
+        Idle,               // wait for the next reset
+        RomCommand,
+        ReadRom,
+        MatchRom,
+        SearchRom,
+        FunctionCommand,
+        PageNumber,         // page byte of a function command
+        WriteScratchpad,
+        ReadScratchpad
+    };
+
+    enum class Mode : uint8_t
+    {
+        Ignore,             // do nothing in slots
+        Receive,            // sample the bits the master writes
+        Send,               // drive the bits of tx_ to the master
+        Search              // SEARCH ROM: bit, complement, direction
+    };
+
+    void reset(Time now);
+    void on_byte(uint8_t byte, Time now);
+    void on_search_bit(int bit);
+    void send(const uint8_t* data, size_t length);
+    void execute(uint8_t page, Time now);
+    void refresh(Time now);
+    bool next_send_bit();
+    bool flip();
+
+    uint8_t rom_[8];
+    uint8_t memory_[8][8] = {};
+    uint8_t scratchpad_[8][8] = {};
+
+    State state_ = State::Idle;
+    Mode mode_ = Mode::Ignore;
+    uint8_t command_ = 0;
+    uint8_t page_ = 0;
+    uint8_t rx_byte_ = 0;
+    uint8_t rx_bits_ = 0;
+    uint8_t tx_[9] = {};
+    uint8_t tx_length_ = 0;
+    uint16_t tx_bit_ = 0;
+    uint8_t write_pos_ = 0;
+    uint8_t search_bit_ = 0;        // bit of the ROM in SEARCH ROM
+    uint8_t search_phase_ = 0;      // 0 bit, 1 complement, 2 direction
+    bool pulling_ = false;          // device drives the line low
+    uint64_t generation_ = 0;       // invalidates events of earlier resets
+
+    Time temp_done_ = 0;            // end of a running conversion, 0 if none
+    Time voltage_done_ = 0;
+    Time eeprom_done_ = 0;
+    Time current_last_ = 0;         // time of the last current conversion
+    double ica_fraction_ = 0;       // ICA below 1 LSB
+    double cca_fraction_ = 0;
+    double dca_fraction_ = 0;
+    uint32_t etm_base_ = 0;         // ETM at etm_time_
+    Time etm_time_ = 0;
+    uint32_t rng_;
+};
+
+/**
+*   \brief Bus counters.
+*/
+struct BusStats
+{
+    uint64_t resets = 0;            // low pulses >= RESET_MIN
+    uint64_t presence = 0;          // resets answered by at least one device
+    uint64_t slots = 0;             // master time slots
+    uint64_t events = 0;            // device events processed
+};
+
+/**
+*   \brief The 1-Wire line with the master pin and the devices.
+*/
+class Bus
+{
+public:
+    Bus() = default;
+    Bus(const Bus&) = delete;
+    Bus& operator=(const Bus&) = delete;
+
+    Device& add_device(uint64_t serial);
+    Device& device(size_t index) { return *devices_[index]; }
+    size_t device_count() const { return devices_.size(); }
+
+    // master side, called through the HAL
+    void drive_low();
+    void release();
+    int sample();
+    void delay(Time ns);
+    Time now() const { return now_; }
+
+    // bus shorted to ground: the line stays low, devices see no edges
+    void set_stuck_low(bool stuck);
+
+    // value change dump of master, device and line levels, "" stops recording
+    bool record_vcd(const std::string& path);
+
+    BusStats stats;
+
+private:
+    enum class EventType : uint8_t
+    {
+        Sample,             // device samples a bit written by the master
+        Release,            // device releases the line
+        Presence            // device starts its presence pulse
+    };
+
+    struct Event
+    {
+        Time time;
+        uint64_t order;     // keeps events of the same time in insertion order
+        Device* device;
+        uint64_t generation;
+        EventType type;
+
+        bool operator>(const Event& other) const
+        {
+            return time != other.time ? time > other.time : order > other.order;
+        }
+    };
+
+    void schedule(Time time, Device& device, EventType type);
+    void advance(Time until);
+    void handle(const Event& event);
+    void update_line();
+    void slot_start();
+    void line_rise();
+    void write_vcd();
+
+    std::vector<std::unique_ptr<Device>> devices_;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+    uint64_t order_ = 0;
+    Time now_ = 0;
+    Time fall_time_ = 0;            // start of the current master low pulse
+    bool fall_valid_ = false;
+    bool master_low_ = false;
+    bool line_ = true;
+    bool stuck_low_ = false;
+    std::ofstream vcd_;
+    char vcd_state_[3];             // last written master, device and line levels
+    Time vcd_time_ = 0;
+};
+
+// ===========================================================
+//                  HAL BINDING (ds2438_hal_sim.cpp)
+// ===========================================================
+
+/**
+*   \brief Bus behind a 1-Wire line of the HAL, line 0 must be set before
+*   the driver is used. Line 0 gives the time of the cycle counter, delays
+*   advance the buses of all lines.
+*/
+constexpr uint8_t HAL_LINES = 4;
+void set_hal_bus(Bus* bus, uint8_t line = 0);
+
+/**
+*   \brief Receiver of the UART output, default: discard.
+*/
+void set_uart_sink(std::function<void(const char*, size_t)> sink);
+
+/**
+*   \brief Makes ds2438_hal_delay_us() also take scale times the delay in
+*   real time, so other threads see a slow bus; default 0: no real time.
+*/
+void set_hal_pace(double scale);
+
+/**
+*   \brief CPU clock the HAL cycle counter runs at in virtual time.
+*/
+constexpr uint32_t HAL_CPU_HZ = 72000000;
+
+} // namespace ds2438::sim
+
+#endif
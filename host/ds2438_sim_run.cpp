@@ -0,0 +1,308 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_sim_run.cpp
+  * @brief   Runs the DS2438 driver on Linux against the simulator
+  ******************************************************************************
+  * Build:
+  *     gcc -std=c99 -O2 -c ../DS2438_Library.c -o DS2438_Library.o
+  *     g++ -std=c++17 -O2 ds2438_sim.cpp ds2438_hal_sim.cpp ds2438_sim_run.cpp DS2438_Library.o -o ds2438_sim_run
+  *
+  * Usage:
+  *     ds2438_sim_run [-n cycles] [-d devices] [-f flip_ppm] [-p presence_ppm] [-s] [-v file.vcd] [-u] [-t file] [-a]
+  *
+  *   -n  measurement cycles of the example program (default 100)
+  *   -d  devices on the bus (default 1); with more than one the ROM IDs are
+  *       searched and every device is addressed with MATCH ROM
+  *   -f  probability of a flipped device bit in ppm
+  *   -p  probability of a missing presence pulse in ppm
+  *   -s  short the bus to ground for the third quarter of the cycles
+  *   -v  write the line levels as VCD waveform
+  *   -u  print the UART output
+  *   -t  write DS2438_TraceDump() to file at the end, needs the library
+  *       compiled with -DDS2438_TRACE_ENABLE=1 (see ds2438_trace_dump.cpp)
+  *   -a  read voltage, temperature and pages with the ...Async functions,
+  *       doing 100 us of application work between the DS2438_Poll() calls,
+  *       and report how much of that time was free
+  *
+  * Each cycle does what main.c does (voltage, current, ICA, temperature,
+  * pages 0-6) for every device while the analog inputs of the models
+  * change, and checks the decoded values and the page CRCs.
+  ******************************************************************************
+  */
+
+#include "ds2438_sim.hpp"
+
+#include "../DS2438_Library.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <vector>
+
+namespace sim = ds2438::sim;
+
+namespace {
+
+void print_rom(const uint8_t* rom)
+{
+    std::printf("ROM %02X %02X%02X%02X%02X%02X%02X CRC %02X\n", rom[0], rom[6], rom[5], rom[4], rom[3], rom[2],
+                rom[1], rom[7]);
+}
+
+// Checks of the async results of one device
+struct AsyncCheck
+{
+    sim::Device* device;
+    int* failed;
+    int* wrong;
+    int* crc_errors;
+    bool uart;
+};
+
+// Application work between two DS2438_Poll() calls, returns its virtual time in ns
+uint64_t app_work(sim::Bus& bus)
+{
+    uint64_t start = bus.now();
+    wait_10us(10);
+    return bus.now() - start;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int cycles = 100, devices = 1;
+    uint32_t flip_ppm = 0, presence_ppm = 0;
+    bool short_bus = false, uart = false, async = false;
+    const char* vcd = nullptr;
+    const char* trace = nullptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:f:p:sv:ut:a")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': cycles = std::atoi(optarg); break;
+        case 'd': devices = std::max(1, std::atoi(optarg)); break;
+        case 'f': flip_ppm = std::strtoul(optarg, nullptr, 10); break;
+        case 'p': presence_ppm = std::strtoul(optarg, nullptr, 10); break;
+        case 's': short_bus = true; break;
+        case 'v': vcd = optarg; break;
+        case 'u': uart = true; break;
+        case 't': trace = optarg; break;
+        case 'a': async = true; break;
+        default:
+            std::fprintf(stderr, "usage: %s [-n cycles] [-d devices] [-f flip_ppm] [-p presence_ppm] [-s] [-v file.vcd] [-u] [-t file] [-a]\n",
+                         argv[0]);
+            return 1;
+        }
+    }
+
+    sim::Bus bus;
+    for (int i = 0; i < devices; i++)
+        bus.add_device(0x0000A1B2C3D4E5ULL + 0x1000 * i);
+    sim::set_hal_bus(&bus);
+    if (uart)
+        sim::set_uart_sink([](const char* data, size_t length) { std::fwrite(data, 1, length, stdout); });
+    if (vcd && !bus.record_vcd(vcd))
+    {
+        std::perror(vcd);
+        return 1;
+    }
+
+    ds2438_bus_t ow;
+    uart1_init(UART_BAUDRATE_DEFAULT);
+    init_OnewirePort(&ow);
+    std::vector<ds2438_t> handles(devices);
+    uint8_t rom[DS2438_ROM_SIZE];
+    if (devices == 1)
+    {
+        if (OneWire_ReadRom(&ow, rom) != DS2438_OP_SUCCESS)
+        {
+            std::fprintf(stderr, "READ ROM failed\n");
+            return 1;
+        }
+        print_rom(rom);
+        DS2438_Init(&handles[0], &ow, nullptr, DS2438_SENSE_RESISTOR);
+    }
+    else
+    {
+        int found = 0;
+        OneWire_SearchReset(&ow);
+        while (found < devices && OneWire_SearchNext(&ow, rom) == DS2438_OP_SUCCESS)
+        {
+            print_rom(rom);
+            DS2438_Init(&handles[found++], &ow, rom, DS2438_SENSE_RESISTOR);
+        }
+        if (found != devices)
+        {
+            std::fprintf(stderr, "SEARCH ROM found %d of %d devices\n", found, devices);
+            return 1;
+        }
+    }
+
+    // the search returns the devices in ROM order, match them to the models
+    std::vector<sim::Device*> models(devices);
+    for (int d = 0; d < devices; d++)
+    {
+        for (int i = 0; i < devices; i++)
+        {
+            if (devices == 1 || std::equal(handles[d].rom, handles[d].rom + DS2438_ROM_SIZE, bus.device(i).rom()))
+                models[d] = &bus.device(i);
+        }
+        ds2438_t* dev = &handles[d];
+        DS2438_InitTimebase(dev);
+        DS2438_EnableIAD(dev);
+        DS2438_EnableCA(dev);
+        DS2438_SelectInputSource(dev, DS2438_INPUT_VOLTAGE_VAD);
+        models[d]->faults.flip_ppm = flip_ppm;
+        models[d]->faults.skip_presence_ppm = presence_ppm;
+    }
+
+    int failed = 0, wrong = 0, crc_errors = 0;
+    uint64_t async_ns = 0, free_ns = 0;
+    std::vector<AsyncCheck> checks(devices);
+    for (int d = 0; d < devices; d++)
+        checks[d] = {models[d], &failed, &wrong, &crc_errors, uart};
+    // queue a request, doing application work while the queue is full
+    auto submit = [&](auto request) {
+        while (request() == DS2438_BUSY)
+        {
+            DS2438_Poll();
+            free_ns += app_work(bus);
+        }
+    };
+    auto start = std::chrono::steady_clock::now();
+    for (int cycle = 0; cycle < cycles; cycle++)
+    {
+        if (short_bus && cycle == cycles / 2)
+            bus.set_stuck_low(true);
+        if (short_bus && cycle == cycles * 3 / 4)
+            bus.set_stuck_low(false);
+        uint64_t async_start = bus.now();
+        for (int d = 0; d < devices; d++)
+        {
+            ds2438_t* dev = &handles[d];
+            sim::Device& device = *models[d];
+            device.vad = 1.0 + 0.01 * ((cycle + 37 * d) % 300);
+            device.temperature = -20.0 + 0.0625 * ((cycle + 97 * d) % 1000);
+            device.sense_mV = 40.0 * std::sin(cycle * 0.05 + d);
+
+            float voltage, current, temperature;
+            if (!async)
+            {
+                if (DS2438_ReadVoltage(dev, &voltage) == DS2438_OP_SUCCESS)
+                    wrong += std::fabs(voltage - device.vad) > 0.006;
+                else
+                    failed++;
+            }
+            if (DS2438_GetCurrentData(dev, &current) == DS2438_OP_SUCCESS)
+                wrong += std::fabs(current * 4.096 * 150 - device.sense_mV * 4.096) > 1.5;
+            else
+                failed++;
+            if (DS2438_UpdateICA(dev) != DS2438_OP_SUCCESS)
+                failed++;
+            if (async)
+            {
+                // voltage, temperature and pages go through the queue
+                AsyncCheck* check = &checks[d];
+                submit([&] {
+                    return DS2438_ReadVoltageAsync(dev, [](ds2438_t*, uint8_t status, const ds2438_async_result_t* result, void* context) {
+                        AsyncCheck* check = static_cast<AsyncCheck*>(context);
+                        if (status == DS2438_OP_SUCCESS)
+                            *check->wrong += std::fabs(result->value - check->device->vad) > 0.006;
+                        else
+                            (*check->failed)++;
+                    }, check);
+                });
+                submit([&] {
+                    return DS2438_ReadTemperatureAsync(dev, [](ds2438_t*, uint8_t status, const ds2438_async_result_t* result, void* context) {
+                        AsyncCheck* check = static_cast<AsyncCheck*>(context);
+                        if (status == DS2438_OP_SUCCESS)
+                            *check->wrong += std::fabs(result->value - check->device->temperature) > 0.016;
+                        else
+                            (*check->failed)++;
+                    }, check);
+                });
+                for (uint8_t page = 0; page < 7; page++)
+                {
+                    submit([&] {
+                        return DS2438_ReadPageAsync(dev, page, [](ds2438_t*, uint8_t status, const ds2438_async_result_t* result, void* context) {
+                            AsyncCheck* check = static_cast<AsyncCheck*>(context);
+                            if (status != DS2438_OP_SUCCESS)
+                                (*check->failed)++;
+                            else if (sim::crc8(result->page_data, 8) != result->page_data[8])
+                                (*check->crc_errors)++;
+                            if (check->uart)
+                                uart_put_page_content(const_cast<uint8_t*>(result->page_data), result->page_number);
+                        }, check);
+                    });
+                }
+                continue;
+            }
+            if (DS2438_ReadTemperature(dev, &temperature) == DS2438_OP_SUCCESS)
+                wrong += std::fabs(temperature - device.temperature) > 0.016;
+            else
+                failed++;
+            for (uint8_t page = 0; page < 7; page++)
+            {
+                uint8_t page_data[9];
+                if (DS2438_ReadPage(dev, page, page_data) != DS2438_OP_SUCCESS)
+                    failed++;
+                else if (sim::crc8(page_data, 8) != page_data[8])
+                    crc_errors++;
+                if (uart)
+                    uart_put_page_content(page_data, page);
+            }
+        }
+        if (async)
+        {
+            while (DS2438_Poll())
+                free_ns += app_work(bus);
+            async_ns += bus.now() - async_start;
+        }
+        wait_10us(400000);
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t commands = 0;
+    for (int i = 0; i < devices; i++)
+        commands += bus.device(i).commands;
+    std::fprintf(stderr, "%d cycles, %d devices, %.1f s virtual time in %.3f s (%.0fx)\n", cycles, devices,
+                 bus.now() / 1e9, wall, bus.now() / 1e9 / wall);
+    std::fprintf(stderr, "resets %llu, presence %llu, slots %llu, events %llu, device commands %llu\n",
+                 static_cast<unsigned long long>(bus.stats.resets), static_cast<unsigned long long>(bus.stats.presence),
+                 static_cast<unsigned long long>(bus.stats.slots), static_cast<unsigned long long>(bus.stats.events),
+                 static_cast<unsigned long long>(commands));
+    std::fprintf(stderr, "failed calls %d, wrong values %d, page CRC errors %d\n", failed, wrong, crc_errors);
+    std::fprintf(stderr, "driver: %.3f s active in transactions, %.3f s asleep in waits\n", ow.stats.active_us / 1e6,
+                 ow.stats.sleep_us / 1e6);
+    if (async)
+        std::fprintf(stderr, "async: %.3f s until done, %.3f s (%.0f%%) free for the application\n", async_ns / 1e9,
+                     free_ns / 1e9, 100.0 * free_ns / async_ns);
+    sim::set_uart_sink([](const char* data, size_t length) { std::fwrite(data, 1, length, stderr); });
+    for (ds2438_t& dev : handles)
+    {
+        int32_t ica = 0;
+        DS2438_GetExtendedICA(&dev, &ica);
+        std::fprintf(stderr, "device %02X%02X%02X extended ICA %ld\n", dev.rom[3], dev.rom[2], dev.rom[1],
+                     static_cast<long>(ica));
+        DS2438_DumpStats(&dev);
+    }
+    if (trace)
+    {
+        FILE* file = std::fopen(trace, "wb");
+        if (!file)
+        {
+            std::perror(trace);
+            return 1;
+        }
+        sim::set_uart_sink([file](const char* data, size_t length) { std::fwrite(data, 1, length, file); });
+        DS2438_TraceDump();
+        sim::set_uart_sink(nullptr);
+        std::fclose(file);
+    }
+    return (failed || wrong || crc_errors) ? 2 : 0;
+}
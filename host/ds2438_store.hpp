@@ -0,0 +1,430 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_store.hpp
+  * @brief   Append-only columnar time-series store for DS2438 telemetry
+  ******************************************************************************
+  * A store file is a sequence of segments. Every segment holds up to
+  * SEGMENT_ROWS rows of one device, one column per field:
+  *
+  *     SegmentHeader   fixed size: device, row count, time range, per column
+  *                     min/max and the byte range of the column
+  *     columns         time: delta-of-delta, numeric fields: delta,
+  *                     config byte: XOR with the previous value;
+  *                     all as zigzag varints
+  *
+  * The headers are the index: the reader maps the file and only decodes
+  * segments whose device and time range match the query. Rows are decoded
+  * directly from the mapping, nothing is copied.
+  * The fields are the raw page 0/page 1 registers the library decodes.
+  ******************************************************************************
+  */
+
+#ifndef DS2438_STORE_HPP
+#define DS2438_STORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ds2438 {
+
+// ===========================================================
+//                      SCHEMA
+// ===========================================================
+
+/**
+*   \brief One sample of a device, raw register values.
+*/
+struct Row
+{
+    uint64_t time_us;
+    uint32_t device;
+    uint8_t config;         // page 0 byte 0: status/configuration
+    int16_t temperature;    // page 0 byte 1-2 >> 3, 0.03125 C per LSB
+    uint16_t voltage;       // page 0 byte 3-4, 10 mV per LSB
+    int16_t current;        // page 0 byte 5-6, two's complement
+    uint32_t etm;           // page 1 byte 0-3, s
+    uint8_t ica;            // page 1 byte 4
+    int16_t offset;         // page 1 byte 5-6 >> 3
+};
+
+// Conversions as in DS2438_Library.c
+constexpr double SENSE_RESISTOR = 150;
+inline double temperature_c(const Row& r) { return r.temperature * 0.03125; }
+inline double voltage_v(const Row& r) { return r.voltage / 100.0; }
+inline double current_ma(const Row& r) { return r.current / (4.096 * SENSE_RESISTOR); }
+
+enum Column : uint8_t
+{
+    COL_TIME, COL_CONFIG, COL_TEMPERATURE, COL_VOLTAGE, COL_CURRENT,
+    COL_ETM, COL_ICA, COL_OFFSET, COLUMN_COUNT
+};
+
+constexpr uint32_t SEGMENT_MAGIC = 0x53325344;     // "DS2S"
+constexpr uint32_t SEGMENT_ROWS = 4096;
+
+struct ColumnInfo
+{
+    int64_t min;
+    int64_t max;
+    uint32_t offset;        // from the start of the column data
+    uint32_t size;
+};
+
+struct SegmentHeader
+{
+    uint32_t magic;
+    uint32_t device;
+    uint32_t rows;
+    uint32_t data_size;     // bytes of column data following the header
+    uint64_t time_min;
+    uint64_t time_max;
+    ColumnInfo columns[COLUMN_COUNT];
+};
+
+namespace store_detail {
+
+inline int64_t field(const Row& r, int column)
+{
+    switch (column)
+    {
+    case COL_TIME: return static_cast<int64_t>(r.time_us);
+    case COL_CONFIG: return r.config;
+    case COL_TEMPERATURE: return r.temperature;
+    case COL_VOLTAGE: return r.voltage;
+    case COL_CURRENT: return r.current;
+    case COL_ETM: return r.etm;
+    case COL_ICA: return r.ica;
+    default: return r.offset;
+    }
+}
+
+inline void set_field(Row& r, int column, int64_t v)
+{
+    switch (column)
+    {
+    case COL_TIME: r.time_us = static_cast<uint64_t>(v); break;
+    case COL_CONFIG: r.config = static_cast<uint8_t>(v); break;
+    case COL_TEMPERATURE: r.temperature = static_cast<int16_t>(v); break;
+    case COL_VOLTAGE: r.voltage = static_cast<uint16_t>(v); break;
+    case COL_CURRENT: r.current = static_cast<int16_t>(v); break;
+    case COL_ETM: r.etm = static_cast<uint32_t>(v); break;
+    case COL_ICA: r.ica = static_cast<uint8_t>(v); break;
+    default: r.offset = static_cast<int16_t>(v); break;
+    }
+}
+
+inline void put_varint(std::vector<uint8_t>& out, int64_t value)
+{
+    uint64_t v = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);//zigzag
+    while (v >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+inline int64_t get_varint(const uint8_t*& p)
+{
+    uint64_t v = 0;
+    int shift = 0;
+    while (*p & 0x80)
+    {
+        v |= static_cast<uint64_t>(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    v |= static_cast<uint64_t>(*p++) << shift;
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+} // namespace store_detail
+
+// ===========================================================
+//                      WRITER
+// ===========================================================
+
+/**
+*   \brief Appends rows to a store file.
+*
+*   Rows are buffered per device; a segment is written when SEGMENT_ROWS rows
+*   of a device are collected and on flush(). Rows of one device have to be
+*   appended in time order.
+*/
+class StoreWriter
+{
+public:
+    explicit StoreWriter(const std::string& path) : file_(std::fopen(path.c_str(), "ab")) {}
+    ~StoreWriter() { close(); }
+    StoreWriter(const StoreWriter&) = delete;
+    StoreWriter& operator=(const StoreWriter&) = delete;
+
+    bool ok() const { return file_ != nullptr; }
+
+    void append(const Row& row)
+    {
+        std::vector<Row>& rows = pending_[row.device];
+        rows.push_back(row);
+        if (rows.size() == SEGMENT_ROWS)
+            write_segment(rows);
+    }
+
+    void flush()
+    {
+        for (auto& entry : pending_)
+        {
+            if (!entry.second.empty())
+                write_segment(entry.second);
+        }
+        if (file_)
+            std::fflush(file_);
+    }
+
+    void close()
+    {
+        if (!file_)
+            return;
+        flush();
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+
+private:
+    void write_segment(std::vector<Row>& rows)
+    {
+        using namespace store_detail;
+        SegmentHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.magic = SEGMENT_MAGIC;
+        header.device = rows[0].device;
+        header.rows = static_cast<uint32_t>(rows.size());
+        header.time_min = rows.front().time_us;
+        header.time_max = rows.back().time_us;
+
+        data_.clear();
+        for (int c = 0; c < COLUMN_COUNT; c++)
+        {
+            ColumnInfo& info = header.columns[c];
+            info.offset = static_cast<uint32_t>(data_.size());
+            info.min = info.max = field(rows[0], c);
+            int64_t previous = 0, previous_delta = 0;
+            for (const Row& row : rows)
+            {
+                int64_t v = field(row, c);
+                if (v < info.min) info.min = v;
+                if (v > info.max) info.max = v;
+                if (c == COL_TIME)
+                {
+                    //regular sampling makes delta-of-delta mostly 0
+                    int64_t delta = v - previous;
+                    put_varint(data_, delta - previous_delta);
+                    previous_delta = delta;
+                }
+                else if (c == COL_CONFIG)
+                {
+                    //flag byte: XOR keeps unchanged bits at 0
+                    put_varint(data_, v ^ previous);
+                }
+                else
+                {
+                    put_varint(data_, v - previous);
+                }
+                previous = v;
+            }
+            info.size = static_cast<uint32_t>(data_.size()) - info.offset;
+        }
+        //pad to 8 bytes, so the next header is aligned in the mapping
+        while (data_.size() % 8)
+            data_.push_back(0);
+        header.data_size = static_cast<uint32_t>(data_.size());
+        std::fwrite(&header, sizeof(header), 1, file_);
+        std::fwrite(data_.data(), 1, data_.size(), file_);
+        rows.clear();
+    }
+
+    std::FILE* file_;
+    std::map<uint32_t, std::vector<Row>> pending_;
+    std::vector<uint8_t> data_;
+};
+
+// ===========================================================
+//                      READER
+// ===========================================================
+
+constexpr uint32_t ANY_DEVICE = 0xFFFFFFFF;
+
+struct Aggregate
+{
+    uint64_t rows = 0;
+    int64_t min[COLUMN_COUNT];
+    int64_t max[COLUMN_COUNT];
+    uint32_t segments_decoded = 0;
+    uint32_t segments_from_index = 0;
+};
+
+/**
+*   \brief Read-only view of a store file through mmap.
+*
+*   An incomplete segment at the end of the file (e.g. after a crash while
+*   appending) is ignored.
+*/
+class StoreReader
+{
+public:
+    explicit StoreReader(const std::string& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            size_ = static_cast<size_t>(st.st_size);
+            void* map = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED)
+                base_ = static_cast<const uint8_t*>(map);
+        }
+        ::close(fd);
+        if (!base_)
+            return;
+        for (size_t pos = 0; pos + sizeof(SegmentHeader) <= size_;)
+        {
+            const SegmentHeader* h = reinterpret_cast<const SegmentHeader*>(base_ + pos);
+            if (h->magic != SEGMENT_MAGIC || pos + sizeof(SegmentHeader) + h->data_size > size_)
+                break;
+            segments_.push_back(h);
+            pos += sizeof(SegmentHeader) + h->data_size;
+        }
+    }
+
+    ~StoreReader()
+    {
+        if (base_)
+            munmap(const_cast<uint8_t*>(base_), size_);
+    }
+
+    StoreReader(const StoreReader&) = delete;
+    StoreReader& operator=(const StoreReader&) = delete;
+
+    bool ok() const { return base_ != nullptr; }
+    const std::vector<const SegmentHeader*>& segments() const { return segments_; }
+
+    /**
+    *   \brief Call on_row for every row of device (or ANY_DEVICE) with t0 <= time_us <= t1.
+    */
+    template <typename Callback>
+    void scan(uint32_t device, uint64_t t0, uint64_t t1, Callback&& on_row) const
+    {
+        for (const SegmentHeader* h : segments_)
+        {
+            if (!matches(h, device, t0, t1))
+                continue;
+            decode(h, [&](const Row& row) {
+                if (row.time_us >= t0 && row.time_us <= t1)
+                    on_row(row);
+            });
+        }
+    }
+
+    /**
+    *   \brief Row count and min/max of every column in a time range.
+    *
+    *   Segments completely inside the range are answered from the index.
+    */
+    Aggregate aggregate(uint32_t device, uint64_t t0, uint64_t t1) const
+    {
+        Aggregate a;
+        for (int c = 0; c < COLUMN_COUNT; c++)
+        {
+            a.min[c] = INT64_MAX;
+            a.max[c] = INT64_MIN;
+        }
+        for (const SegmentHeader* h : segments_)
+        {
+            if (!matches(h, device, t0, t1))
+                continue;
+            if (h->time_min >= t0 && h->time_max <= t1)
+            {
+                a.rows += h->rows;
+                for (int c = 0; c < COLUMN_COUNT; c++)
+                {
+                    if (h->columns[c].min < a.min[c]) a.min[c] = h->columns[c].min;
+                    if (h->columns[c].max > a.max[c]) a.max[c] = h->columns[c].max;
+                }
+                a.segments_from_index++;
+                continue;
+            }
+            a.segments_decoded++;
+            decode(h, [&](const Row& row) {
+                if (row.time_us < t0 || row.time_us > t1)
+                    return;
+                a.rows++;
+                for (int c = 0; c < COLUMN_COUNT; c++)
+                {
+                    int64_t v = store_detail::field(row, c);
+                    if (v < a.min[c]) a.min[c] = v;
+                    if (v > a.max[c]) a.max[c] = v;
+                }
+            });
+        }
+        return a;
+    }
+
+private:
+    static bool matches(const SegmentHeader* h, uint32_t device, uint64_t t0, uint64_t t1)
+    {
+        return (device == ANY_DEVICE || h->device == device) && h->time_max >= t0 && h->time_min <= t1;
+    }
+
+    // Decode all columns of a segment in lock step, one cursor per column
+    template <typename Callback>
+    void decode(const SegmentHeader* h, Callback&& on_row) const
+    {
+        using namespace store_detail;
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(h + 1);
+        const uint8_t* cursor[COLUMN_COUNT];
+        int64_t previous[COLUMN_COUNT] = {};
+        int64_t previous_delta = 0;
+        for (int c = 0; c < COLUMN_COUNT; c++)
+            cursor[c] = data + h->columns[c].offset;
+
+        Row row{};
+        row.device = h->device;
+        for (uint32_t i = 0; i < h->rows; i++)
+        {
+            for (int c = 0; c < COLUMN_COUNT; c++)
+            {
+                int64_t v = get_varint(cursor[c]);
+                if (c == COL_TIME)
+                {
+                    previous_delta += v;
+                    v = previous[c] + previous_delta;
+                }
+                else if (c == COL_CONFIG)
+                    v ^= previous[c];
+                else
+                    v += previous[c];
+                previous[c] = v;
+                set_field(row, c, v);
+            }
+            on_row(row);
+        }
+    }
+
+    const uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+    std::vector<const SegmentHeader*> segments_;
+};
+
+} // namespace ds2438
+
+#endif
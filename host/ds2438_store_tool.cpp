@@ -0,0 +1,141 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_store_tool.cpp
+  * @brief   Command line tool for DS2438 store files (ds2438_store.hpp)
+  ******************************************************************************
+  * Build:
+  *     g++ -std=c++17 -O2 ds2438_store_tool.cpp -o ds2438_store
+  *
+  * Usage:
+  *     ds2438_store gen <file> <devices> <rows per device>
+  *         append synthetic data, one row per device and second
+  *     ds2438_store info <file>
+  *         list the segments
+  *     ds2438_store query <file> <device|all> <t0_us> <t1_us>
+  *         aggregate over a time range and time a full scan of it
+  ******************************************************************************
+  */
+
+#include "ds2438_store.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int gen(const char* path, uint32_t devices, uint32_t rows)
+{
+    ds2438::StoreWriter writer(path);
+    if (!writer.ok())
+    {
+        std::perror(path);
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < rows; i++)
+    {
+        for (uint32_t d = 0; d < devices; d++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            ds2438::Row row;
+            row.time_us = 1000000ULL * i + d * 37;
+            row.device = d;
+            row.config = 0x03;
+            row.temperature = static_cast<int16_t>(736 + (seed >> 29));     // ~23 C
+            row.voltage = static_cast<uint16_t>(370 + (seed >> 30));        // ~3.7 V
+            row.current = static_cast<int16_t>(-300 + (seed >> 28));
+            row.etm = 100000 + i;
+            row.ica = static_cast<uint8_t>(200 - i / 600);
+            row.offset = -3;
+            writer.append(row);
+        }
+    }
+    writer.close();
+    double s = seconds_since(start);
+    std::printf("%llu rows in %.3f s (%.1f M rows/s)\n",
+                static_cast<unsigned long long>(rows) * devices, s, rows * devices / s / 1e6);
+    return 0;
+}
+
+int info(const char* path)
+{
+    ds2438::StoreReader reader(path);
+    if (!reader.ok())
+    {
+        std::perror(path);
+        return 1;
+    }
+    uint64_t rows = 0, bytes = 0;
+    for (const ds2438::SegmentHeader* h : reader.segments())
+    {
+        rows += h->rows;
+        bytes += sizeof(*h) + h->data_size;
+    }
+    std::printf("%zu segments, %llu rows, %.2f bytes/row\n", reader.segments().size(),
+                static_cast<unsigned long long>(rows), rows ? static_cast<double>(bytes) / rows : 0.0);
+    return 0;
+}
+
+int query(const char* path, const char* device_arg, uint64_t t0, uint64_t t1)
+{
+    ds2438::StoreReader reader(path);
+    if (!reader.ok())
+    {
+        std::perror(path);
+        return 1;
+    }
+    uint32_t device = std::strcmp(device_arg, "all") == 0 ? ds2438::ANY_DEVICE
+                                                           : static_cast<uint32_t>(std::atoi(device_arg));
+
+    auto start = std::chrono::steady_clock::now();
+    ds2438::Aggregate a = reader.aggregate(device, t0, t1);
+    double aggregate_s = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    uint64_t rows = 0;
+    double current_sum = 0;
+    reader.scan(device, t0, t1, [&](const ds2438::Row& row) {
+        rows++;
+        current_sum += ds2438::current_ma(row);
+    });
+    double scan_s = seconds_since(start);
+
+    std::printf("rows %llu\n", static_cast<unsigned long long>(a.rows));
+    if (a.rows)
+    {
+        std::printf("temperature %.3f .. %.3f C\n", a.min[ds2438::COL_TEMPERATURE] * 0.03125,
+                    a.max[ds2438::COL_TEMPERATURE] * 0.03125);
+        std::printf("voltage %.2f .. %.2f V\n", a.min[ds2438::COL_VOLTAGE] / 100.0,
+                    a.max[ds2438::COL_VOLTAGE] / 100.0);
+        std::printf("ica %lld .. %lld\n", static_cast<long long>(a.min[ds2438::COL_ICA]),
+                    static_cast<long long>(a.max[ds2438::COL_ICA]));
+        std::printf("mean current %.3f mA\n", current_sum / rows);
+    }
+    std::printf("aggregate: %.3f ms (%u segments from index, %u decoded)\n", aggregate_s * 1e3,
+                a.segments_from_index, a.segments_decoded);
+    std::printf("scan: %.3f ms (%.1f M rows/s)\n", scan_s * 1e3, scan_s > 0 ? rows / scan_s / 1e6 : 0.0);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc == 5 && std::strcmp(argv[1], "gen") == 0)
+        return gen(argv[2], std::atoi(argv[3]), std::atoi(argv[4]));
+    if (argc == 3 && std::strcmp(argv[1], "info") == 0)
+        return info(argv[2]);
+    if (argc == 6 && std::strcmp(argv[1], "query") == 0)
+        return query(argv[2], argv[3], std::strtoull(argv[4], nullptr, 10), std::strtoull(argv[5], nullptr, 10));
+    std::fprintf(stderr, "usage: %s gen <file> <devices> <rows> | info <file> | query <file> <device|all> <t0_us> <t1_us>\n",
+                 argv[0]);
+    return 1;
+}
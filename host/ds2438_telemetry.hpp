@@ -0,0 +1,292 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_telemetry.hpp
+  * @brief   Host side decoder for the binary telemetry of the DS2438 Libary
+  ******************************************************************************
+  * Decodes the frames sent by uart_put_frame_snapshot(), uart_put_frame_page(),
+  * uart_put_frame_event() and DS2438_TraceDump(). The record layout must match the
+  * BINARY TELEMETRY section of DS2438_Library.h.
+  *
+  * Usage:
+  *     ds2438::FrameDecoder decoder;
+  *     decoder.feed(buffer, length, [](const ds2438::Record& record) { ... });
+  ******************************************************************************
+  */
+
+#ifndef DS2438_TELEMETRY_HPP
+#define DS2438_TELEMETRY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <variant>
+#include <vector>
+
+namespace ds2438 {
+
+// ===========================================================
+//                      RECORD TYPES
+// ===========================================================
+
+constexpr uint8_t RECORD_SNAPSHOT = 0x01;
+constexpr uint8_t RECORD_PAGE = 0x02;
+constexpr uint8_t RECORD_EVENT = 0x03;
+constexpr uint8_t RECORD_TRACE = 0x04;
+
+constexpr size_t SNAPSHOT_SIZE = 31;
+constexpr size_t PAGE_SIZE = 12;
+constexpr size_t EVENT_SIZE = 15;
+
+constexpr uint8_t EVENT_DEV_NOT_FOUND = 0x01;
+constexpr uint8_t EVENT_READ_ERROR = 0x02;
+constexpr uint8_t EVENT_DISCONNECT = 0x03;
+constexpr uint8_t EVENT_END_OF_CHARGE = 0x04;
+
+constexpr uint8_t TRACE_RESET = 0x01;       // value: 0 presence pulse, 1 none, 7 (DS2438_BUS_FAULT) line held low
+constexpr uint8_t TRACE_WRITE = 0x02;
+constexpr uint8_t TRACE_READ = 0x03;
+
+struct Snapshot
+{
+    uint8_t sequence;
+    uint64_t temperature_us;
+    double temperature;         // C
+    uint64_t voltage_us;
+    double voltage;             // V
+    uint64_t current_us;
+    double current;             // mA
+    uint64_t ica_us;
+    uint8_t ica;
+};
+
+struct PageDump
+{
+    uint8_t sequence;
+    uint8_t page_number;
+    uint8_t data[9];
+};
+
+struct Event
+{
+    uint8_t sequence;
+    uint64_t time_us;
+    uint8_t code;
+    uint32_t value;
+};
+
+struct TraceEntry
+{
+    uint32_t cycles;            // CPU cycle counter of the MCU
+    uint8_t type;               // TRACE_
+    uint8_t value;
+};
+
+struct Trace
+{
+    uint8_t sequence;
+    std::vector<TraceEntry> entries;
+};
+
+using Record = std::variant<Snapshot, PageDump, Event, Trace>;
+
+// ===========================================================
+//                      HELPERS
+// ===========================================================
+
+// CRC-16/CCITT-FALSE, same as telemetry_crc16() on the MCU
+inline uint16_t crc16(const uint8_t* data, size_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= static_cast<uint16_t>(data[i] << 8);
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021)
+                                 : static_cast<uint16_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Little endian value of size bytes at data
+inline uint64_t get_le(const uint8_t* data, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        value |= static_cast<uint64_t>(data[i]) << (8 * i);
+    }
+    return value;
+}
+
+// Decode one COBS block (without the 0x00 delimiter), false if malformed
+inline bool cobs_decode(const uint8_t* in, size_t length, std::vector<uint8_t>& out)
+{
+    out.clear();
+    size_t i = 0;
+    while (i < length)
+    {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > length)
+            return false;
+        out.insert(out.end(), in + i, in + i + code - 1);
+        i += code - 1;
+        if (code != 0xFF && i < length)
+            out.push_back(0);
+    }
+    return true;
+}
+
+// Parse a decoded payload (CRC already checked and removed)
+inline bool parse_payload(const uint8_t* p, size_t length, Record& record)
+{
+    if (length < 2)
+        return false;
+    switch (p[0])
+    {
+    case RECORD_SNAPSHOT:
+    {
+        if (length != SNAPSHOT_SIZE)
+            return false;
+        Snapshot s;
+        s.sequence = p[1];
+        s.temperature_us = get_le(p + 2, 8);
+        s.temperature = static_cast<int16_t>(get_le(p + 10, 2)) / 100.0;
+        s.voltage_us = s.temperature_us + get_le(p + 12, 4);
+        s.voltage = get_le(p + 16, 2) / 100.0;
+        s.current_us = s.temperature_us + get_le(p + 18, 4);
+        s.current = static_cast<int32_t>(get_le(p + 22, 4)) / 1000.0;
+        s.ica_us = s.temperature_us + get_le(p + 26, 4);
+        s.ica = p[30];
+        record = s;
+        return true;
+    }
+    case RECORD_PAGE:
+    {
+        if (length != PAGE_SIZE)
+            return false;
+        PageDump d;
+        d.sequence = p[1];
+        d.page_number = p[2];
+        for (int i = 0; i < 9; i++)
+            d.data[i] = p[3 + i];
+        record = d;
+        return true;
+    }
+    case RECORD_EVENT:
+    {
+        if (length != EVENT_SIZE)
+            return false;
+        Event e;
+        e.sequence = p[1];
+        e.time_us = get_le(p + 2, 8);
+        e.code = p[10];
+        e.value = static_cast<uint32_t>(get_le(p + 11, 4));
+        record = e;
+        return true;
+    }
+    case RECORD_TRACE:
+    {
+        if (length < 3 || length != 3 + p[2] * 6u)
+            return false;
+        Trace t;
+        t.sequence = p[1];
+        for (size_t i = 3; i < length; i += 6)
+            t.entries.push_back({static_cast<uint32_t>(get_le(p + i, 4)), p[i + 4], p[i + 5]});
+        record = std::move(t);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// ===========================================================
+//                      FRAME DECODER
+// ===========================================================
+
+/**
+*   \brief Incremental decoder for a byte stream of frames.
+*
+*   Bytes can be fed in arbitrary chunks. Corrupted frames are counted
+*   and skipped, decoding resynchronises at the next 0x00 delimiter.
+*/
+class FrameDecoder
+{
+public:
+    template <typename Callback>
+    void feed(const uint8_t* data, size_t length, Callback&& on_record)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            if (data[i] != 0)
+            {
+                if (frame_.size() < MAX_FRAME)
+                    frame_.push_back(data[i]);
+                else
+                    overflow_ = true;
+                continue;
+            }
+            //0x00 delimiter: decode the collected frame
+            if (!frame_.empty())
+            {
+                Record record;
+                if (decode_frame(record))
+                    on_record(static_cast<const Record&>(record));
+            }
+            frame_.clear();
+            overflow_ = false;
+        }
+    }
+
+    uint64_t frames_ok() const { return frames_ok_; }
+    uint64_t crc_errors() const { return crc_errors_; }
+    uint64_t framing_errors() const { return framing_errors_; }
+    uint64_t lost_frames() const { return lost_frames_; }
+
+private:
+    static constexpr size_t MAX_FRAME = 256;
+
+    bool decode_frame(Record& record)
+    {
+        if (overflow_ || !cobs_decode(frame_.data(), frame_.size(), payload_) || payload_.size() < 4)
+        {
+            framing_errors_++;
+            return false;
+        }
+        size_t length = payload_.size() - 2;
+        uint16_t crc = static_cast<uint16_t>(get_le(payload_.data() + length, 2));
+        if (crc != crc16(payload_.data(), length))
+        {
+            crc_errors_++;
+            return false;
+        }
+        if (!parse_payload(payload_.data(), length, record))
+        {
+            framing_errors_++;
+            return false;
+        }
+        //gaps in the sequence number are frames lost on the link
+        uint8_t sequence = payload_[1];
+        if (have_sequence_)
+            lost_frames_ += static_cast<uint8_t>(sequence - next_sequence_);
+        next_sequence_ = static_cast<uint8_t>(sequence + 1);
+        have_sequence_ = true;
+        frames_ok_++;
+        return true;
+    }
+
+    std::vector<uint8_t> frame_;
+    std::vector<uint8_t> payload_;
+    bool overflow_ = false;
+    bool have_sequence_ = false;
+    uint8_t next_sequence_ = 0;
+    uint64_t frames_ok_ = 0;
+    uint64_t crc_errors_ = 0;
+    uint64_t framing_errors_ = 0;
+    uint64_t lost_frames_ = 0;
+};
+
+} // namespace ds2438
+
+#endif
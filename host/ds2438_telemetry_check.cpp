@@ -0,0 +1,135 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_telemetry_check.cpp
+  * @brief   Frames of the DS2438 Library decoded with ds2438_telemetry.hpp
+  ******************************************************************************
+  * Build:
+  *     gcc -std=c99 -O2 -c ../DS2438_Library.c -o DS2438_Library.o
+  *     g++ -std=c++17 -O2 ds2438_sim.cpp ds2438_hal_sim.cpp ds2438_telemetry_check.cpp DS2438_Library.o -o ds2438_telemetry_check
+  *
+  * Usage:
+  *     ds2438_telemetry_check
+  *
+  * Encodes snapshot, page and event frames with uart_put_frame_snapshot(),
+  * uart_put_frame_page() and uart_put_frame_event() through the UART of the
+  * simulator HAL, decodes them with FrameDecoder and compares every field.
+  * A page frame with one flipped byte has to be counted as CRC error and
+  * the decoder has to take the next frame again.
+  ******************************************************************************
+  */
+
+#include "ds2438_sim.hpp"
+#include "ds2438_telemetry.hpp"
+
+#include "../DS2438_Library.h"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace sim = ds2438::sim;
+
+namespace {
+
+int errors = 0;
+
+void expect(bool ok, const char* what)
+{
+    if (!ok)
+    {
+        std::fprintf(stderr, "%s\n", what);
+        errors++;
+    }
+}
+
+std::vector<uint8_t> uart;      // bytes sent by the library since the last take()
+
+std::vector<uint8_t> take()
+{
+    std::vector<uint8_t> bytes;
+    bytes.swap(uart);
+    return bytes;
+}
+
+// Decode bytes, the records found go to records
+void decode(ds2438::FrameDecoder& decoder, const std::vector<uint8_t>& bytes, std::vector<ds2438::Record>& records)
+{
+    decoder.feed(bytes.data(), bytes.size(), [&](const ds2438::Record& record) { records.push_back(record); });
+}
+
+bool near(double a, double b)
+{
+    return std::fabs(a - b) < 1e-9;
+}
+
+} // namespace
+
+int main()
+{
+    sim::Bus bus;
+    sim::set_hal_bus(&bus);
+    sim::set_uart_sink([](const char* data, size_t length) { uart.insert(uart.end(), data, data + length); });
+
+    ds2438::FrameDecoder decoder;
+    std::vector<ds2438::Record> records;
+
+    ds2438_snapshot_t snapshot{};
+    snapshot.temperature = -5.25f;
+    snapshot.temperature_us = 1234567890123ULL;
+    snapshot.voltage = 3.71f;
+    snapshot.voltage_us = snapshot.temperature_us + 1000;
+    snapshot.current = -150.25f;
+    snapshot.current_us = snapshot.temperature_us + 2000;
+    snapshot.ica = 0xAB;
+    snapshot.ica_us = snapshot.temperature_us + 3000;
+    uart_put_frame_snapshot(&snapshot);
+    decode(decoder, take(), records);
+
+    //no zero byte in the payload up to the page data, see the flip below
+    uint8_t page[9] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99};
+    uart_put_frame_page(page, 5);
+    std::vector<uint8_t> page_frame = take();
+    decode(decoder, page_frame, records);
+
+    uart_put_frame_event(987654321ULL, TELEMETRY_EVENT_DISCONNECT, 0xDEADBEEF);
+    decode(decoder, take(), records);
+
+    expect(records.size() == 3, "not three records decoded");
+    if (records.size() == 3)
+    {
+        const auto* s = std::get_if<ds2438::Snapshot>(&records[0]);
+        expect(s && s->temperature_us == snapshot.temperature_us && near(s->temperature, -5.25) &&
+                   s->voltage_us == snapshot.voltage_us && near(s->voltage, 3.71) &&
+                   s->current_us == snapshot.current_us && near(s->current, -150.25) &&
+                   s->ica_us == snapshot.ica_us && s->ica == 0xAB,
+               "snapshot fields differ");
+        const auto* d = std::get_if<ds2438::PageDump>(&records[1]);
+        bool same = d && d->page_number == 5 && d->sequence == static_cast<uint8_t>(s ? s->sequence + 1 : 0);
+        for (int i = 0; d && i < 9; i++)
+            same = same && d->data[i] == page[i];
+        expect(same, "page fields differ");
+        const auto* e = std::get_if<ds2438::Event>(&records[2]);
+        expect(e && e->time_us == 987654321ULL && e->code == ds2438::EVENT_DISCONNECT && e->value == 0xDEADBEEF,
+               "event fields differ");
+    }
+    expect(decoder.frames_ok() == 3 && decoder.crc_errors() == 0 && decoder.framing_errors() == 0 &&
+               decoder.lost_frames() == 0,
+           "decoder counted errors on good frames");
+
+    //COBS keeps the non-zero bytes in place: byte 5 is page_data[1], flipping it stays non-zero
+    page_frame[5] ^= 0x40;
+    records.clear();
+    decode(decoder, page_frame, records);
+    expect(records.empty() && decoder.crc_errors() == 1 && decoder.framing_errors() == 0,
+           "flipped byte not counted as CRC error");
+
+    //the next frame decodes again; the damaged one had an old sequence number, so nothing is lost
+    uart_put_frame_event(1, TELEMETRY_EVENT_DEV_NOT_FOUND, 0);
+    decode(decoder, take(), records);
+    expect(records.size() == 1 && decoder.frames_ok() == 4 && decoder.lost_frames() == 0,
+           "decoder does not resynchronise after the damaged frame");
+
+    sim::set_uart_sink(nullptr);
+    std::printf("%s, %d errors\n", errors ? "FAILED" : "ok", errors);
+    return errors ? 2 : 0;
+}
@@ -0,0 +1,192 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_text.hpp
+  * @brief   Host side parser for the text UART output of the DS2438 example
+  ******************************************************************************
+  * Parses the lines written by main.c and uart_put_page_content(), e.g.
+  *     V: 12.340000
+  *     mA: -150.25000000
+  *     Remaining Capacity in mAh: 1.23000000
+  *     Temperature: 23.53125000 °C
+  *     Page 1 content (MSB to LSB): 0 0 0 0 200 0 0 0
+  * Numbers are parsed by hand, no strtod and no locale.
+  ******************************************************************************
+  */
+
+#ifndef DS2438_TEXT_HPP
+#define DS2438_TEXT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace ds2438 {
+
+enum class LineKind : uint8_t
+{
+    Empty,              // empty line or header ("Pagedata (00h-06h):")
+    Voltage,            // value in V
+    Current,            // value in mA
+    Capacity,           // value in mAh
+    Temperature,        // value in C
+    Page,               // page number and 8 page bytes
+    DevicePresent,
+    DeviceNotFound,
+    ReadError,          // "Could not read ..."
+    Invalid             // line could not be parsed
+};
+
+struct TextRecord
+{
+    LineKind kind;
+    uint8_t page_number;
+    uint8_t page_data[8];
+    double value;
+};
+
+namespace text_detail {
+
+// Powers of ten that are exact in double
+constexpr double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+constexpr int MAX_DECIMALS = 22;
+
+inline bool starts_with(const char* p, const char* end, const char* prefix, size_t length)
+{
+    return static_cast<size_t>(end - p) >= length && std::memcmp(p, prefix, length) == 0;
+}
+
+// Parse a decimal number like "-150.25000000". Up to 2^53 the mantissa and
+// the power of ten are exact, so the single division rounds correctly.
+inline bool parse_decimal(const char*& p, const char* end, double& out)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+    uint64_t mantissa = 0;
+    int decimals = 0;
+    bool fraction = false, any_digit = false;
+    for (; p < end; p++)
+    {
+        char c = *p;
+        if (c >= '0' && c <= '9')
+        {
+            any_digit = true;
+            //POW10 ends at 1e22, further fraction digits are below the resolution
+            if (mantissa < 1844674407370955161ULL && decimals < MAX_DECIMALS)
+            {
+                mantissa = mantissa * 10 + static_cast<unsigned>(c - '0');
+                decimals += fraction;
+            }
+            else if (!fraction)
+            {
+                return false;//integer part too large
+            }
+            //further fraction digits are ignored
+        }
+        else if (c == '.' && !fraction)
+        {
+            fraction = true;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (!any_digit)
+        return false;
+    double value = static_cast<double>(mantissa) / POW10[decimals];
+    out = negative ? -value : value;
+    return true;
+}
+
+inline bool parse_uint8(const char*& p, const char* end, uint8_t& out)
+{
+    unsigned value = 0;
+    const char* start = p;
+    while (p < end && *p >= '0' && *p <= '9' && value <= 255)
+        value = value * 10 + static_cast<unsigned>(*p++ - '0');
+    if (p == start || value > 255)
+        return false;
+    out = static_cast<uint8_t>(value);
+    return true;
+}
+
+inline bool parse_value(const char* p, const char* end, TextRecord& record, LineKind kind)
+{
+    record.kind = kind;
+    if (!parse_decimal(p, end, record.value))
+        return false;
+    //only a unit may follow the number
+    return p == end || *p == ' ';
+}
+
+} // namespace text_detail
+
+/**
+*   \brief Parse one line, without the line ending.
+*
+*   A trailing '\r' is ignored.
+*   \return false if the line is not a valid line of the DS2438 output,
+*   record.kind is then LineKind::Invalid.
+*/
+inline bool parse_line(const char* p, const char* end, TextRecord& record)
+{
+    using namespace text_detail;
+    if (p < end && end[-1] == '\r')
+        end--;
+
+    bool ok;
+    if (p == end || starts_with(p, end, "Pagedata", 8))
+    {
+        record.kind = LineKind::Empty;
+        return true;
+    }
+    else if (starts_with(p, end, "V: ", 3))
+        ok = parse_value(p + 3, end, record, LineKind::Voltage);
+    else if (starts_with(p, end, "mA: ", 4))
+        ok = parse_value(p + 4, end, record, LineKind::Current);
+    else if (starts_with(p, end, "Remaining Capacity in mAh: ", 27))
+        ok = parse_value(p + 27, end, record, LineKind::Capacity);
+    else if (starts_with(p, end, "Temperature: ", 13))
+        ok = parse_value(p + 13, end, record, LineKind::Temperature);
+    else if (starts_with(p, end, "Page ", 5))
+    {
+        record.kind = LineKind::Page;
+        p += 5;
+        ok = parse_uint8(p, end, record.page_number) &&
+             starts_with(p, end, " content (MSB to LSB):", 22);
+        if (ok)
+            p += 22;
+        for (int i = 0; ok && i < 8; i++)
+        {
+            ok = p < end && *p++ == ' ' && parse_uint8(p, end, record.page_data[i]);
+        }
+        ok = ok && p == end;
+    }
+    else if (starts_with(p, end, "Device present", 14))
+    {
+        record.kind = LineKind::DevicePresent;
+        return true;
+    }
+    else if (starts_with(p, end, "no Device found", 15))
+    {
+        record.kind = LineKind::DeviceNotFound;
+        return true;
+    }
+    else if (starts_with(p, end, "Could not read", 14))
+    {
+        record.kind = LineKind::ReadError;
+        return true;
+    }
+    else
+        ok = false;
+
+    if (!ok)
+        record.kind = LineKind::Invalid;
+    return ok;
+}
+
+} // namespace ds2438
+
+#endif
@@ -0,0 +1,77 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_text_check.cpp
+  * @brief   Edge cases of the text parser of ds2438_text.hpp
+  ******************************************************************************
+  * Build:
+  *     g++ -std=c++17 -O2 -fsanitize=address,undefined ds2438_text_check.cpp -o ds2438_text_check
+  *
+  * Usage:
+  *     ds2438_text_check
+  *
+  * Parses valid lines, lines with numbers at the limits of the parser
+  * (fractions longer than the resolution of double, integer parts that do
+  * not fit) and damaged lines, and compares the records with the expected
+  * ones. Built with the sanitizers, any read outside the line or a table
+  * fails the check.
+  ******************************************************************************
+  */
+
+#include "ds2438_text.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+namespace {
+
+int errors = 0;
+
+void expect_value(const std::string& line, ds2438::LineKind kind, double value, const char* what)
+{
+    ds2438::TextRecord record{};
+    bool ok = ds2438::parse_line(line.data(), line.data() + line.size(), record);
+    if (!ok || record.kind != kind || std::fabs(record.value - value) > 1e-12 * std::fabs(value) + 1e-300)
+    {
+        std::fprintf(stderr, "%s: kind %d value %.17g, expected kind %d value %.17g\n", what,
+                     static_cast<int>(record.kind), record.value, static_cast<int>(kind), value);
+        errors++;
+    }
+}
+
+void expect_invalid(const std::string& line, const char* what)
+{
+    ds2438::TextRecord record{};
+    if (ds2438::parse_line(line.data(), line.data() + line.size(), record) ||
+        record.kind != ds2438::LineKind::Invalid)
+    {
+        std::fprintf(stderr, "%s: parsed as kind %d\n", what, static_cast<int>(record.kind));
+        errors++;
+    }
+}
+
+} // namespace
+
+int main()
+{
+    using ds2438::LineKind;
+
+    expect_value("V: 12.340000", LineKind::Voltage, 12.34, "voltage");
+    expect_value("mA: -150.25000000", LineKind::Current, -150.25, "current");
+    expect_value("Temperature: 23.53125000 \xB0" "C\r", LineKind::Temperature, 23.53125, "temperature");
+
+    // fraction digits beyond the 22 of the power of ten table are ignored
+    expect_value("V: 0." + std::string(4000, '0') + "1", LineKind::Voltage, 0.0, "long zero fraction");
+    expect_value("V: 1." + std::string(21, '0') + "1" + std::string(4000, '7'), LineKind::Voltage,
+                 1.0 + 1e-22, "long fraction");
+    expect_value("V: 0.1234567890123456789012345", LineKind::Voltage, 0.1234567890123456789012, "23 decimals");
+    expect_value("V: 18446744073709551.5", LineKind::Voltage, 18446744073709551.5, "large integer part");
+
+    expect_invalid("V: 184467440737095516150", "integer part too large");
+    expect_invalid("V: .", "no digits");
+    expect_invalid("V: 1.2.3", "two decimal points");
+    expect_invalid("V: 12.3x", "trailing garbage");
+
+    std::printf("%s, %d errors\n", errors ? "FAILED" : "ok", errors);
+    return errors ? 2 : 0;
+}
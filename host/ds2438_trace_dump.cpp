@@ -0,0 +1,168 @@
+/**
+  ******************************************************************************
+  * @file    ds2438_trace_dump.cpp
+  * @brief   Prints the 1-Wire trace sent by DS2438_TraceDump()
+  ******************************************************************************
+  * Build:
+  *     g++ -std=c++17 -O2 ds2438_trace_dump.cpp -o ds2438_trace_dump
+  *
+  * Usage:
+  *     ds2438_trace_dump [-c cpu_hz] [file]
+  *
+  * Reads the binary UART output (file or stdin), skips all other records
+  * and prints one line per trace entry: time since the first entry in us,
+  * delta to the previous entry, and the decoded operation. The first byte
+  * after a reset is shown as ROM command, the second (after the 8 ROM ID
+  * bytes of MATCH ROM) as function command, the next one as page number
+  * where the command takes one.
+  ******************************************************************************
+  */
+
+#include "ds2438_telemetry.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+namespace {
+
+const char* rom_command(uint8_t value)
+{
+    switch (value)
+    {
+    case 0x33: return "READ_ROM";
+    case 0x55: return "MATCH_ROM";
+    case 0xCC: return "SKIP_ROM";
+    case 0xF0: return "SEARCH_ROM";
+    default: return nullptr;
+    }
+}
+
+const char* function_command(uint8_t value)
+{
+    switch (value)
+    {
+    case 0x44: return "TEMP_CONV";
+    case 0xB4: return "VOLTAGE_CONV";
+    case 0xB8: return "RECALL_MEMORY";
+    case 0xBE: return "READ_SCRATCHPAD";
+    case 0x4E: return "WRITE_SCRATCHPAD";
+    case 0x48: return "COPY_SCRATCHPAD";
+    default: return nullptr;
+    }
+}
+
+class Printer
+{
+public:
+    explicit Printer(double cpu_hz) : cycles_per_us_(cpu_hz / 1e6) {}
+
+    void print(const ds2438::TraceEntry& entry)
+    {
+        if (!started_)
+        {
+            previous_ = entry.cycles;
+            started_ = true;
+        }
+        //unsigned differences handle the wrap of the 32-bit counter
+        elapsed_ += static_cast<uint32_t>(entry.cycles - previous_);
+        double delta = static_cast<uint32_t>(entry.cycles - previous_) / cycles_per_us_;
+        previous_ = entry.cycles;
+        std::printf("%12.1f %+10.1f  ", elapsed_ / cycles_per_us_, delta);
+
+        const char* name = nullptr;
+        switch (entry.type)
+        {
+        case ds2438::TRACE_RESET:
+            std::printf("RESET %s\n", entry.value == 0 ? "presence" : entry.value == 1 ? "no presence" : "bus held low");
+            position_ = 0;
+            rom_bytes_ = 0;
+            return;
+        case ds2438::TRACE_WRITE:
+            if (rom_bytes_)
+            {
+                std::printf("W %02X  ROM ID\n", entry.value);
+                rom_bytes_--;
+                return;
+            }
+            if (position_ == 0)
+                name = rom_command(entry.value);
+            else if (position_ == 1)
+                name = function_command(entry.value);
+            if (name)
+                std::printf("W %02X  %s\n", entry.value, name);
+            else if (position_ == 2 && takes_page_)
+                std::printf("W %02X  page %u\n", entry.value, entry.value);
+            else
+                std::printf("W %02X\n", entry.value);
+            if (position_ == 0 && entry.value == 0x55)
+                rom_bytes_ = 8;
+            if (position_ == 1)
+                takes_page_ = (entry.value & 0x0F) == 0x08 || (entry.value & 0x0F) == 0x0E;
+            break;
+        case ds2438::TRACE_READ:
+            std::printf("R %02X\n", entry.value);
+            break;
+        default:
+            std::printf("? %02X %02X\n", entry.type, entry.value);
+            break;
+        }
+        position_++;
+    }
+
+private:
+    double cycles_per_us_;
+    bool started_ = false;
+    uint32_t previous_ = 0;
+    uint64_t elapsed_ = 0;
+    int position_ = 0;          // bytes since the last reset, without the ROM ID
+    int rom_bytes_ = 0;         // ROM ID bytes of MATCH ROM still to come
+    bool takes_page_ = false;   // function command followed by a page number
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    double cpu_hz = 72e6;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:")) != -1)
+    {
+        if (opt != 'c')
+        {
+            std::fprintf(stderr, "usage: %s [-c cpu_hz] [file]\n", argv[0]);
+            return 1;
+        }
+        cpu_hz = std::atof(optarg);
+    }
+    FILE* in = stdin;
+    if (optind < argc && !(in = std::fopen(argv[optind], "rb")))
+    {
+        std::perror(argv[optind]);
+        return 1;
+    }
+
+    Printer printer(cpu_hz);
+    ds2438::FrameDecoder decoder;
+    uint64_t entries = 0;
+    uint8_t buffer[4096];
+    size_t length;
+    while ((length = std::fread(buffer, 1, sizeof(buffer), in)) > 0)
+    {
+        decoder.feed(buffer, length, [&](const ds2438::Record& record) {
+            if (const ds2438::Trace* trace = std::get_if<ds2438::Trace>(&record))
+            {
+                for (const ds2438::TraceEntry& entry : trace->entries)
+                {
+                    printer.print(entry);
+                    entries++;
+                }
+            }
+        });
+    }
+    std::fprintf(stderr, "%llu entries, %llu frames, %llu CRC errors, %llu lost frames\n",
+                 static_cast<unsigned long long>(entries), static_cast<unsigned long long>(decoder.frames_ok()),
+                 static_cast<unsigned long long>(decoder.crc_errors()),
+                 static_cast<unsigned long long>(decoder.lost_frames()));
+    return 0;
+}
@@ -0,0 +1,78 @@
+/**
+  ******************************************************************************
+  * @file    spsc_queue.hpp
+  * @brief   Lock-free single producer / single consumer queue
+  ******************************************************************************
+  */
+
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace ds2438 {
+
+/**
+*   \brief Bounded ring buffer for exactly one producer and one consumer thread.
+*
+*   Capacity is rounded up to a power of two. Head and tail live on separate
+*   cache lines and each side caches the other side's index, so the shared
+*   cache lines are only touched when the cached value is exhausted.
+*/
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask_ = size - 1;
+        items_.reset(new T[size]);
+    }
+
+    // Producer side, false if the queue is full
+    bool push(const T& item)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_cache_ > mask_)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head - tail_cache_ > mask_)
+                return false;
+        }
+        items_[head & mask_] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, false if the queue is empty
+    bool pop(T& item)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_cache_)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail == head_cache_)
+                return false;
+        }
+        item = items_[tail & mask_];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::unique_ptr<T[]> items_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t tail_cache_ = 0;     // producer's copy of tail_
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t head_cache_ = 0;     // consumer's copy of head_
+};
+
+} // namespace ds2438
+
+#endif
@@ -11,52 +11,59 @@
 */
 
 #include <stm32f10x.h>
-#include <stdio.h>
 #include "DS2438_Library.h"
 
+static ds2438_bus_t bus;
+static ds2438_t battery;
+
 int main(void) {
-    uart1_init();
-    init_OnewirePort();
+    uart1_init(UART_BAUDRATE_DEFAULT);
+    init_OnewirePort(&bus);
+    DS2438_Init(&battery, &bus, 0, DS2438_SENSE_RESISTOR);//only device on the bus
     float voltage, temperature, current, capacity = 0;
-    char msg[50];
 
-    if(!DS2438_IsDevicePresent())//DS2438 is not connected
+    if(!DS2438_IsDevicePresent(&battery))//DS2438 is not connected
     {
         uart_put_string_newline("no Device found");
     }
     else//DS2438 is connected
     {
         uart_put_string_newline("Device present");
-        DS2438_EnableIAD();//Enable Current measurement
-        DS2438_EnableCA();//Enable Current accumulator
-        DS2438_SelectInputSource(DS2438_INPUT_VOLTAGE_VAD);
+        DS2438_InitTimebase(&battery);//align the MCU cycle counter with the ETM
+        DS2438_EnableIAD(&battery);//Enable Current measurement
+        DS2438_EnableCA(&battery);//Enable Current accumulator
+        DS2438_SelectInputSource(&battery, DS2438_INPUT_VOLTAGE_VAD);
         while (1) {
-            if (DS2438_ReadVoltage(&voltage)) {
-                sprintf(msg, "V: %f", voltage);
-                uart_put_string_newline(msg);
+            if (DS2438_ReadVoltage(&battery, &voltage) == DS2438_OP_SUCCESS) {
+                uart_put_string("V: ");
+                uart_put_float(voltage, 6);
+                uart_put_string_newline("");
 
             } else {
                 uart_put_string_newline("Could not read voltage");
             }
-            if (DS2438_GetCurrentData(&current)) {
-                sprintf(msg, "mA: %.8f", current);
-                uart_put_string_newline(msg);
+            if (DS2438_GetCurrentData(&battery, &current) == DS2438_OP_SUCCESS) {
+                uart_put_string("mA: ");
+                uart_put_float(current, 8);
+                uart_put_string_newline("");
             } else {
                 uart_put_string_newline("Could not read current");
             }
-            if (DS2438_GetCapacity_mAh(&capacity))
+            if (DS2438_UpdateICA(&battery) == DS2438_OP_SUCCESS && DS2438_GetAccumulatedCapacity_mAh(&battery, &capacity) == DS2438_OP_SUCCESS)
             {
-                sprintf(msg, "Remaining Capacity in mAh: %.8f", capacity);
-                uart_put_string_newline(msg);
+                uart_put_string("Remaining Capacity in mAh: ");
+                uart_put_float(capacity, 8);
+                uart_put_string_newline("");
             }
             else
             {
                 uart_put_string_newline("Could not read current");
             }
-            if (DS2438_ReadTemperature(&temperature))
+            if (DS2438_ReadTemperature(&battery, &temperature) == DS2438_OP_SUCCESS)
             {
-                sprintf(msg, "Temperature: %.8f °C", temperature);
-                uart_put_string_newline(msg);
+                uart_put_string("Temperature: ");
+                uart_put_float(temperature, 8);
+                uart_put_string_newline(" °C");
             }
             else
             {
@@ -68,7 +75,7 @@ int main(void) {
             for (uint8_t page = 0; page < 7; page++)
             {
                 uint8_t page_data[9];
-                DS2438_ReadPage(page, page_data);
+                DS2438_ReadPage(&battery, page, page_data);
                 uart_put_page_content(page_data, page);
             }
             wait_10us(400000);